@@ -0,0 +1,116 @@
+#include "SummerArena.hh"
+
+#include "test.hh"
+#include "test.summer.hh"
+
+typedef CompactGraph::Index Index;
+
+Index rewrite(CompactGraph& graph, Index l)
+{
+    CompactTransformAll<CompactLiftSum> lift;
+    l = lift.process(graph, l);
+    CompactTransformAll<CompactRotateDotsMultsToRight> allDotsRotate;
+    l = allDotsRotate.process(graph, l);
+    CompactTransformAll<CompactAttachDotsToUnitVectors> moveDotsToVectors;
+    l = moveDotsToVectors.process(graph, l);
+    CompactTransformAll<CompactLiftUnitVectorUp> liftUnitVecUp;
+    l = liftUnitVecUp.process(graph, l);
+    return l;
+}
+
+void testBuild()
+{
+    CompactGraph graph;
+
+    Index m = graph.tensor("m", {"i","j"});
+    EXPECT_STREAMED_AS("sum_i(sum_j(U_i*U_j*m_ij))") << graph.render(m);
+
+    Index x = graph.tensor("x", {"k"});
+    Index l = graph.dot(x, m);
+    EXPECT_STREAMED_AS("sum_k(U_k*x_k).sum_i(sum_j(U_i*U_j*m_ij))") << graph.render(l);
+
+    // one Var per name
+    EXPECT_EQ(graph.var("i"), graph.kid(m, 0));
+    EXPECT_EQ(true,  graph.has(l, KindUnitVec));
+    EXPECT_EQ(false, graph.has(l, KindDelta));
+
+    // the round trip keeps the text
+    Handle handle = graph.toHandle(l);
+    EXPECT_EQ(graph.render(l), rendered(handle));
+    EXPECT_EQ(graph.render(l), graph.render(graph.fromHandle(handle)));
+
+    l = rewrite(graph, l);
+    EXPECT_STREAMED_AS("sum_k(sum_i(sum_j(U_k.U_i*U_j*x_k*m_ij)))") << graph.render(l);
+
+    graph.clear();
+    EXPECT_EQ(0u, graph.size());
+}
+
+void testMatchesNodes()
+{
+    // a long dot chain ends in the same place either way
+    CompactGraph graph;
+    Index  l = graph.tensor("t0", {"a0","b0"});
+    Handle h = Make::tensor("t0", {"a0","b0"});
+    for (int t = 1; t < 40; ++t)
+    {
+        std::string id = std::to_string(t);
+        l = graph.dot(l, graph.tensor("t" + id, {"a" + id, "b" + id}));
+        h = Make::dot(h, Make::tensor("t" + id, {"a" + id, "b" + id}));
+    }
+
+    l = rewrite(graph, l);
+    h = rewrite(h);
+    EXPECT_EQ(rendered(h), graph.render(l));
+}
+
+void testDeep()
+{
+    // far deeper than the stack would take one frame per level
+    const int depth = 1000000;
+    Handle k(new Var("k"));
+    Handle h(new Element("x", {k}));
+    for (int i = 1; i < depth; ++i)
+        h = Handle(new Mult(Handle(new Element("x", {k})), h));
+
+    CompactGraph graph;
+    Index l = graph.fromHandle(h);
+    std::string text = graph.render(l);
+    EXPECT_EQ(4u * depth - 1, text.size());
+    EXPECT_EQ("x_k*x_k*", text.substr(0, 8));
+    EXPECT_EQ(text, rendered(h));
+
+    h = graph.toHandle(l);
+    EXPECT_EQ(text, rendered(h));
+}
+
+void testStructure()
+{
+    // index sizes and element forms survive the trip both ways
+    Handle b = Make::tensor("b", {"i","j"}, {3,4}, FormBanded, 1);
+
+    CompactGraph graph;
+    Index l = graph.fromHandle(b);
+    EXPECT_EQ(3u, graph.varSize(graph.var("i")));
+    EXPECT_EQ(4u, graph.varSize(graph.var("j")));
+
+    Handle back = graph.toHandle(l);
+    EXPECT_EQ(rendered(b), rendered(back));
+
+    const Node* node = back.get();
+    while (node->kind_ != KindElement)
+        node = node->children_.back().get();
+    const Element* element = static_cast<const Element*>(node);
+    EXPECT_EQ(FormBanded, element->form_);
+    EXPECT_EQ(1u, element->band_);
+    EXPECT_EQ(3u, static_cast<const Var*>(element->children_[0].get())->size_);
+    EXPECT_EQ(4u, static_cast<const Var*>(element->children_[1].get())->size_);
+}
+
+int main()
+{
+    testBuild();
+    testMatchesNodes();
+    testDeep();
+    testStructure();
+}
@@ -0,0 +1,426 @@
+#ifndef SummerBatch_HH
+#define SummerBatch_HH
+
+#include "SummerExec.hh"
+
+#include <set>
+#include <map>
+#include <deque>
+#include <string>
+#include <vector>
+#include <memory>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <stdexcept>
+#include <condition_variable>
+
+// one graph run over many independent inputs at once
+//
+// Batch::of gives the graph an implicit batch index.. every Element read from
+// the batched inputs gets the index out in front and the whole graph is put
+// under a summer and unit vector for it
+//
+//     sum_i(sum_j(U_j*x_i*m_ij))
+//     sum_batch(U_batch*sum_i(sum_j(U_j*x_batchi*m_ij)))
+//
+// so a stack of x's goes through in one loop nest, and that nest is whatever
+// kernel its strides match.. the GEMV above becomes a GEMM.
+//
+// Batcher serves a stream of requests with it. submit() queues one input and
+// hands back a future. a collector thread takes the queue as a batch once it
+// is full or the oldest request has waited out the deadline and stacks the
+// inputs into a staging tensor, while a runner thread runs the batch before
+// it.. two staging slots so the copying in and the running overlap. batches
+// are rounded up to a power of two (up to the max) so there is only a plan
+// per bucket, built once and reused. the rows past the real requests hold
+// whatever was staged last, the batch index never mixes rows so they only
+// cost time.
+
+// ################################################
+// ################################################
+// ################################################
+
+class Batch
+{
+public:
+    // exp is rewritten in place (like the passes).. a batched element of a
+    // matrix only form (symmetric, diagonal or banded) reads as dense, the
+    // form doesnt cover the extra index
+    static Handle of(const Handle& exp,
+                     const std::vector<std::string>& inputs,
+                     const std::string& var = "batch")
+    {
+        Handle root = Unshare().process(exp);
+        std::set<std::string> names(inputs.begin(), inputs.end());
+        std::set<std::string> read;
+        Handle index(new Var(var));
+
+        // kids before parents so every summary is refreshed from fresh kids
+        std::vector<std::pair<Node*, bool> > stack(1, std::make_pair(root.get(), false));
+        while (not stack.empty())
+        {
+            Node* node = stack.back().first;
+            if (not stack.back().second)
+            {
+                stack.back().second = true;
+                for (const Handle& kid : node->children_)
+                    stack.push_back(std::make_pair(kid.get(), false));
+                continue;
+            }
+            stack.pop_back();
+
+            if (node->kind_ == KindVar and static_cast<const Var*>(node)->name_ == var)
+            {
+                std::stringstream ss;
+                ss << "Batch index " << var << " is already used by the graph";
+                throw std::runtime_error(ss.str());
+            }
+
+            if (node->kind_ == KindElement)
+            {
+                Element* element = static_cast<Element*>(node);
+                if (names.count(element->name_))
+                {
+                    element->children_.insert(element->children_.begin(), index);
+                    if (element->form_ != FormSparse)
+                        element->form_ = FormDense;
+                    read.insert(element->name_);
+                }
+            }
+            node->refresh();
+        }
+
+        for (const std::string& name : names)
+        {
+            if (not read.count(name))
+            {
+                std::stringstream ss;
+                ss << "Batch input " << name << " is not read by the graph";
+                throw std::runtime_error(ss.str());
+            }
+        }
+
+        return Handle(new Summer(index, Handle(new Mult(Handle(new UnitVec(index)), root))));
+    }
+};
+
+// ################################################
+// ################################################
+// ################################################
+
+template <typename Type>
+class Batcher
+{
+public:
+    typedef typename Tensor<Type>::Shape        Shape;
+    typedef std::chrono::steady_clock           Clock;
+
+private:
+    struct Request
+    {
+        std::vector<Tensor<Type> >   inputs_;
+        std::promise<Tensor<Type> >  promise_;
+        Clock::time_point            arrival_;
+    };
+
+    struct Stage
+    {
+        // a bucket's own bindings, staging tensors and plan
+        Executor<Type>              exec_;
+        std::vector<Tensor<Type> >  inputs_;
+        Plan<Type>                  plan_;
+        bool                        planned_;
+    };
+
+    struct Job
+    {
+        int                   slot_;
+        Stage*                stage_;
+        std::vector<Request>  requests_;
+    };
+
+    static const int Slots = 2;
+
+    Executor<Type>              exec_;
+    Handle                      graph_;
+    std::vector<std::string>    names_;
+    std::vector<Shape>          shapes_;    // of one input each
+    std::size_t                 maxBatch_;
+    Clock::duration             deadline_;
+
+    std::map<std::size_t, Stage> stages_[Slots];   // per bucket
+    bool                         busy_[Slots];
+    int                          next_;
+
+    std::mutex                  mutex_;
+    std::condition_variable     queued_;    // a request came in (or stop)
+    std::condition_variable     ready_;     // a job for the runner
+    std::condition_variable     freed_;     // a slot is free again
+    std::deque<Request>         queue_;
+    std::deque<Job>             jobs_;
+    bool                        stop_;
+    bool                        collecting_;
+
+    std::atomic<std::size_t>    batches_;
+    std::atomic<std::size_t>    served_;
+    std::atomic<std::size_t>    largest_;
+
+    std::thread                 collector_;
+    std::thread                 runner_;
+
+    static std::size_t elements(const Shape& shape)
+    {
+        std::size_t count = 1;
+        for (std::size_t len : shape) count *= len;
+        return count;
+    }
+
+    std::size_t bucket(std::size_t count) const
+    {
+        std::size_t size = 1;
+        while (size < count) size *= 2;
+        return std::min(size, maxBatch_);
+    }
+
+    Stage& stage(int slot, std::size_t size)
+    {
+        typename std::map<std::size_t, Stage>::iterator sit = stages_[slot].find(size);
+        if (sit != stages_[slot].end())
+            return sit->second;
+
+        Stage& fresh = stages_[slot][size];
+        fresh.exec_    = exec_;
+        fresh.planned_ = false;
+        for (std::size_t n = 0; n < names_.size(); ++n)
+        {
+            Shape shape(1, size);
+            shape.insert(shape.end(), shapes_[n].begin(), shapes_[n].end());
+            fresh.inputs_.push_back(Tensor<Type>(shape));
+            fresh.exec_.bind(names_[n], fresh.inputs_.back());
+        }
+        return fresh;
+    }
+
+    void collect()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;)
+        {
+            queued_.wait(lock, [this] { return stop_ or not queue_.empty(); });
+            if (queue_.empty())
+                break;
+
+            // a full batch or the oldest request is out of time
+            Clock::time_point due = queue_.front().arrival_ + deadline_;
+            while (not stop_ and queue_.size() < maxBatch_ and Clock::now() < due)
+                queued_.wait_until(lock, due);
+
+            freed_.wait(lock, [this] { return not busy_[next_]; });
+            Job job;
+            job.slot_ = next_;
+            busy_[next_] = true;
+            next_ = (next_ + 1) % Slots;
+
+            std::size_t take = std::min(queue_.size(), maxBatch_);
+            for (std::size_t r = 0; r < take; ++r)
+            {
+                job.requests_.push_back(std::move(queue_.front()));
+                queue_.pop_front();
+            }
+            lock.unlock();
+
+            // stacked outside the lock.. the runner is busy with the other slot
+            job.stage_ = &stage(job.slot_, bucket(take));
+            for (std::size_t n = 0; n < names_.size(); ++n)
+            {
+                Type*       staged = TensorUtils<Type>::data(job.stage_->inputs_[n]).data();
+                std::size_t row    = elements(shapes_[n]);
+                for (std::size_t r = 0; r < take; ++r)
+                {
+                    const Type* in = TensorUtils<Type>::data(job.requests_[r].inputs_[n]).data();
+                    std::copy(in, in + row, staged + r * row);
+                }
+            }
+
+            lock.lock();
+            jobs_.push_back(std::move(job));
+            ready_.notify_one();
+        }
+
+        collecting_ = false;
+        ready_.notify_one();
+    }
+
+    void execute(Job& job)
+    {
+        // the results are copied out, the next run of the plan reuses its arena
+        try
+        {
+            Stage& stage = *job.stage_;
+            if (not stage.planned_)
+            {
+                stage.plan_    = stage.exec_.plan(graph_);
+                stage.planned_ = true;
+            }
+            const Tensor<Type>& out   = stage.plan_.run();
+            const Shape&        shape = TensorUtils<Type>::shape(out);
+
+            Shape item(shape.begin() + 1, shape.end());
+            if (item.empty()) item.push_back(1);
+            std::size_t row = elements(item);
+            const Type* all = TensorUtils<Type>::data(out).data();
+            for (std::size_t r = 0; r < job.requests_.size(); ++r)
+            {
+                Tensor<Type> result(item);
+                std::copy(all + r * row, all + (r+1) * row, TensorUtils<Type>::data(result).data());
+                job.requests_[r].promise_.set_value(result);
+            }
+        }
+        catch (...)
+        {
+            for (Request& request : job.requests_)
+                request.promise_.set_exception(std::current_exception());
+        }
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;)
+        {
+            ready_.wait(lock, [this] { return not jobs_.empty() or not collecting_; });
+            if (jobs_.empty())
+                return;
+
+            Job job = std::move(jobs_.front());
+            jobs_.pop_front();
+            lock.unlock();
+
+            // counted first so they are up to date once a future is ready
+            ++batches_;
+            served_ += job.requests_.size();
+            if (job.requests_.size() > largest_)
+                largest_ = job.requests_.size();
+            execute(job);
+
+            lock.lock();
+            busy_[job.slot_] = false;
+            freed_.notify_one();
+        }
+    }
+
+public:
+    // the inputs are bound in exec as one item each (their shape is the shape
+    // of a request), the rest of the bindings are taken as they are now. if
+    // exec has a LoopScheduler it is used from the runner thread
+    Batcher(const Executor<Type>& exec,
+            const Handle& exp,
+            const std::vector<std::string>& inputs,
+            std::size_t maxBatch = 64,
+            Clock::duration deadline = std::chrono::milliseconds(1)) :
+        exec_(exec),
+        graph_(Batch::of(exp, inputs)),
+        names_(inputs),
+        shapes_(),
+        maxBatch_(std::max<std::size_t>(1, maxBatch)),
+        deadline_(deadline),
+        stages_(),
+        busy_(),
+        next_(0),
+        mutex_(),
+        queued_(),
+        ready_(),
+        freed_(),
+        queue_(),
+        jobs_(),
+        stop_(false),
+        collecting_(true),
+        batches_(0),
+        served_(0),
+        largest_(0),
+        collector_(),
+        runner_()
+    {
+        for (const std::string& name : names_)
+        {
+            typename std::map<std::string, Tensor<Type> >::const_iterator tit = exec.tensors().find(name);
+            if (tit == exec.tensors().end())
+            {
+                std::stringstream ss;
+                ss << "Graph element " << name << " is not bound";
+                throw std::runtime_error(ss.str());
+            }
+            shapes_.push_back(TensorUtils<Type>::shape(tit->second));
+        }
+        for (int slot = 0; slot < Slots; ++slot)
+            busy_[slot] = false;
+
+        collector_ = std::thread(&Batcher::collect, this);
+        runner_    = std::thread(&Batcher::run, this);
+    }
+
+    // everything queued is still run before the threads stop
+    ~Batcher()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        queued_.notify_one();
+        collector_.join();
+        runner_.join();
+    }
+
+    // one input per name given to the constructor, in that order.. they are
+    // read when the batch is staged so leave them alone till the future is ready
+    std::future<Tensor<Type> > submit(const std::vector<Tensor<Type> >& inputs)
+    {
+        if (inputs.size() != names_.size())
+        {
+            std::stringstream ss;
+            ss << "Batcher takes " << names_.size() << " inputs but was given " << inputs.size();
+            throw std::runtime_error(ss.str());
+        }
+        for (std::size_t n = 0; n < inputs.size(); ++n)
+        {
+            const Shape& shape = TensorUtils<Type>::shape(inputs[n]);
+            if (shape != shapes_[n])
+            {
+                std::stringstream ss;
+                ss << "Batcher input " << names_[n] << " has shape " << join(shape, "x")
+                   << " but the batch is of " << join(shapes_[n], "x");
+                throw std::runtime_error(ss.str());
+            }
+        }
+
+        Request request;
+        request.inputs_  = inputs;
+        request.arrival_ = Clock::now();
+        std::future<Tensor<Type> > result = request.promise_.get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(std::move(request));
+        }
+        queued_.notify_one();
+        return result;
+    }
+
+    std::future<Tensor<Type> > submit(const Tensor<Type>& input)
+    {
+        return submit(std::vector<Tensor<Type> >(1, input));
+    }
+
+    // the batched graph the plans are built from
+    const Handle& graph() const { return graph_; }
+
+    // batches run, requests answered and the biggest batch so far
+    std::size_t batches() const { return batches_; }
+    std::size_t served()  const { return served_; }
+    std::size_t largest() const { return largest_; }
+};
+
+#endif
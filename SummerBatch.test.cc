@@ -0,0 +1,115 @@
+#include "SummerBatch.hh"
+
+#include "test.hh"
+#include "test.summer.hh"
+
+Tensor<int> item(int seed)
+{
+    return Tensor<int>({3}, {seed, 1 - seed, 2 * seed});
+}
+
+void testBatch()
+{
+    Tensor<int> mData({3,2}, {1,2, 3,4, 5,6});
+
+    Executor<int> exec;
+    exec.bind("x", item(1))
+        .bind("m", mData);
+    exec.run(optimise(xm()));
+    EXPECT_EQ(Lowered<int>::AsGemv, exec.patterns()[0]);
+
+    // four x's stacked.. the same nest is now a GEMM
+    Handle batched = Batch::of(optimise(xm()), {"x"});
+    EXPECT_STREAMED_AS("sum_batch(U_batch*sum_i(sum_j(U_j*x_batchi*m_ij)))") << batched;
+
+    Tensor<int> xs({4,3}, {1,0,2, 2,-1,4, 3,-2,6, 4,-3,8});
+    exec.bind("x", xs);
+    EXPECT_EQ(TensorUtils<int>::dot(xs, mData), exec.run(batched));
+    EXPECT_EQ(1u, exec.patterns().size());
+    EXPECT_EQ(Lowered<int>::AsGemm, exec.patterns()[0]);
+
+    EXPECT_THROW(Batch::of(optimise(xm()), {"y"}), "Batch input y is not read by the graph");
+    EXPECT_THROW(Batch::of(optimise(xm()), {"x"}, "i"), "Batch index i is already used by the graph");
+}
+
+void testBatcher()
+{
+    Tensor<int> mData({3,2}, {1,2, 3,4, 5,6});
+
+    Executor<int> exec;
+    exec.bind("x", item(0))
+        .bind("m", mData);
+
+    std::size_t batches = 0;
+    {
+        Batcher<int> batcher(exec, optimise(xm()), {"x"}, 16, std::chrono::milliseconds(5));
+
+        std::vector<std::future<Tensor<int> > > results;
+        for (int r = 0; r < 100; ++r)
+            results.push_back(batcher.submit(item(r)));
+        for (int r = 0; r < 100; ++r)
+            EXPECT_EQ(TensorUtils<int>::dot(item(r), mData), results[r].get());
+
+        // a burst goes through as a few full batches not a run per request
+        EXPECT_EQ(100u, batcher.served());
+        batches = batcher.batches();
+        EXPECT_EQ(true, (batches < 100u));
+        EXPECT_EQ(16u, batcher.largest());
+
+        // a lone request goes on its own once the deadline passes
+        std::future<Tensor<int> > lone = batcher.submit(item(7));
+        EXPECT_EQ(TensorUtils<int>::dot(item(7), mData), lone.get());
+        EXPECT_EQ(batches + 1, batcher.batches());
+
+        EXPECT_THROW(batcher.submit(Tensor<int>({2}, {1,2})),
+                     "Batcher input x has shape 2x but the batch is of 3x");
+        EXPECT_THROW(batcher.submit(std::vector<Tensor<int> >()),
+                     "Batcher takes 1 inputs but was given 0");
+    }
+
+    // a sparse input has new non zeros every batch.. three batches of one
+    // through the same bucket, the third back on the first slot's plan
+    Handle sparse = optimise(Make::dot(Make::tensor("x", {"k"}, {}, FormSparse),
+                                       Make::tensor("m", {"i","j"})));
+    {
+        Batcher<int> batcher(exec, sparse, {"x"}, 1);
+        for (int r = 0; r < 3; ++r)
+        {
+            Tensor<int> one({3}, {r == 0, r == 1, r == 2});
+            EXPECT_EQ(TensorUtils<int>::dot(one, mData), batcher.submit(one).get());
+        }
+        EXPECT_EQ(3u, batcher.batches());
+    }
+
+    // whatever is still queued is run before the batcher goes
+    std::future<Tensor<int> > late;
+    {
+        Batcher<int> batcher(exec, optimise(xm()), {"x"}, 8, std::chrono::seconds(60));
+        late = batcher.submit(item(3));
+    }
+    EXPECT_EQ(TensorUtils<int>::dot(item(3), mData), late.get());
+
+    // a graph that cant run fails every request in the batch
+    Executor<int> missing;
+    missing.bind("x", item(0));
+    {
+        Batcher<int> batcher(missing, optimise(xm()), {"x"});
+        std::future<Tensor<int> > failed = batcher.submit(item(1));
+        EXPECT_THROW(failed.get(), "Graph element m is not bound");
+    }
+
+    EXPECT_THROW(Batcher<int>(Executor<int>(), optimise(xm()), {"x"}), "Graph element x is not bound");
+}
+
+int main()
+{
+    try
+    {
+        testBatch();
+        testBatcher();
+    }
+    catch (std::exception& e)
+    {
+        std::cout << "Opps... " << e.what() << "\n";
+    }
+}
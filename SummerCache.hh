@@ -0,0 +1,891 @@
+#ifndef SummerCache_HH
+#define SummerCache_HH
+
+#include "SummerExec.hh"
+
+#include <map>
+#include <set>
+#include <unordered_set>
+#include <string>
+#include <vector>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <functional>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// binary graphs and a plan cache on disk
+//
+// Serial writes a graph (or several sharing nodes) as a flat table in post
+// order.. each node is its kind, its name (Var and Element), a Var's size, an
+// Element's form and band and the table numbers of its kids. a node reached twice is written once so a
+// CommonSubExpr DAG comes back as the same DAG.
+//
+// DiskCache is what PlanCache and Jit (SummerJit.hh) share.. files in a
+// directory named by a hash of the graph as handed in (before any passes)
+// plus the type, the bound shapes and sizes, written aside and renamed in.
+//
+// PlanCache keeps the optimised graph under that hash and the plan
+// built from it.. steps, lowered kernels and the arena layout. a warm start
+// maps the file in and rebuilds the plan straight from it, no passes, no
+// lowering and no colouring. kernel reads are kept by the bound name and
+// pointed at the Executor's tensors on load.
+
+// ################################################
+// ################################################
+// ################################################
+
+class Serial
+{
+public:
+    struct Writer
+    {
+        std::string& out_;
+
+        void u8(uint8_t value) { out_.push_back(static_cast<char>(value)); }
+
+        void u32(uint32_t value)
+        {
+            for (int b = 0; b < 4; ++b) u8(value >> (8*b));
+        }
+
+        void u64(uint64_t value)
+        {
+            for (int b = 0; b < 8; ++b) u8(value >> (8*b));
+        }
+
+        void str(const std::string& text)
+        {
+            u32(text.size());
+            out_ += text;
+        }
+
+        void sizes(const std::vector<std::size_t>& values)
+        {
+            u32(values.size());
+            for (std::size_t value : values) u64(value);
+        }
+    };
+
+    struct Reader
+    {
+        const unsigned char* at_;
+        const unsigned char* end_;
+
+        void need(std::size_t bytes) const
+        {
+            if (static_cast<std::size_t>(end_ - at_) < bytes)
+                throw std::runtime_error("Serial data is truncated");
+        }
+
+        uint8_t u8()
+        {
+            need(1);
+            return *at_++;
+        }
+
+        uint32_t u32()
+        {
+            need(4);
+            uint32_t value = 0;
+            for (int b = 0; b < 4; ++b) value |= uint32_t(*at_++) << (8*b);
+            return value;
+        }
+
+        uint64_t u64()
+        {
+            need(8);
+            uint64_t value = 0;
+            for (int b = 0; b < 8; ++b) value |= uint64_t(*at_++) << (8*b);
+            return value;
+        }
+
+        std::string str()
+        {
+            uint32_t size = u32();
+            need(size);
+            std::string text(reinterpret_cast<const char*>(at_), size);
+            at_ += size;
+            return text;
+        }
+
+        std::vector<std::size_t> sizes()
+        {
+            uint32_t count = u32();
+            need(8 * std::size_t(count));
+            std::vector<std::size_t> values;
+            for (uint32_t i = 0; i < count; ++i) values.push_back(u64());
+            return values;
+        }
+    };
+
+    static const uint32_t Magic   = 0x47534d53;   // SMSG
+    static const uint32_t Version = 2;
+
+    static void write(Writer& out, const Nodes& roots)
+    {
+        // post order with an explicit stack.. kids are numbered before parents
+        std::unordered_map<const Node*, uint32_t> ids;
+        std::vector<const Node*> order;
+        std::vector<std::pair<const Node*, bool> > stack;
+        for (Nodes::const_reverse_iterator rit = roots.rbegin(); rit != roots.rend(); ++rit)
+            stack.push_back(std::make_pair(rit->get(), false));
+
+        while (not stack.empty())
+        {
+            const Node* node  = stack.back().first;
+            bool        ready = stack.back().second;
+            stack.pop_back();
+
+            if (ids.count(node))
+                continue;
+
+            if (not ready)
+            {
+                stack.push_back(std::make_pair(node, true));
+                for (Nodes::const_reverse_iterator iit = node->children_.rbegin();
+                     iit != node->children_.rend();
+                     ++iit)
+                {
+                    if (not ids.count(iit->get()))
+                        stack.push_back(std::make_pair(iit->get(), false));
+                }
+                continue;
+            }
+
+            ids[node] = order.size();
+            order.push_back(node);
+        }
+
+        out.u32(Magic);
+        out.u32(Version);
+        out.u32(order.size());
+        for (const Node* node : order)
+        {
+            out.u8(node->kind_);
+            if (node->kind_ == KindVar)
+            {
+                out.str(static_cast<const Var*>(node)->name_);
+                out.u64(static_cast<const Var*>(node)->size_);
+            }
+            else if (node->kind_ == KindElement)
+            {
+                const Element* element = static_cast<const Element*>(node);
+                out.str(element->name_);
+                out.u8(element->form_);
+                out.u64(element->band_);
+            }
+
+            out.u32(node->children_.size());
+            for (const Handle& kid : node->children_)
+                out.u32(ids[kid.get()]);
+        }
+
+        out.u32(roots.size());
+        for (const Handle& root : roots)
+            out.u32(ids[root.get()]);
+    }
+
+    static Nodes read(Reader& in)
+    {
+        if (in.u32() != Magic or in.u32() != Version)
+            throw std::runtime_error("Serial data is not a graph");
+
+        // every node takes at least its kind and kid count
+        uint32_t count = in.u32();
+        in.need(5 * std::size_t(count));
+
+        Nodes table(count);
+        for (std::size_t n = 0; n < table.size(); ++n)
+        {
+            uint8_t kind = in.u8();
+
+            std::string name;
+            std::size_t size = 0;
+            uint8_t     form = FormDense;
+            if (kind == KindVar)
+            {
+                name = in.str();
+                size = in.u64();
+            }
+            else if (kind == KindElement)
+            {
+                name = in.str();
+                form = in.u8();
+                size = in.u64();   // the band
+            }
+
+            // only already built nodes.. so it can only ever be a DAG
+            uint32_t links = in.u32();
+            in.need(4 * std::size_t(links));
+            Nodes kids(links);
+            for (Handle& kid : kids)
+                kid = at(table, in.u32(), n);
+
+            table[n] = make(kind, name, size, form, kids);
+        }
+
+        uint32_t tops = in.u32();
+        in.need(4 * std::size_t(tops));
+        Nodes roots(tops);
+        for (Handle& root : roots)
+            root = at(table, in.u32(), table.size());
+        return roots;
+    }
+
+    static std::string write(const Nodes& roots)
+    {
+        std::string data;
+        Writer out = { data };
+        write(out, roots);
+        return data;
+    }
+
+    static std::string write(const Handle& root)
+    {
+        return write(Nodes(1, root));
+    }
+
+    static Nodes read(const std::string& data)
+    {
+        const unsigned char* start = reinterpret_cast<const unsigned char*>(data.data());
+        Reader in = { start, start + data.size() };
+        return read(in);
+    }
+
+    static uint64_t fnv(const std::string& text, uint64_t hash = 14695981039346656037ull)
+    {
+        // stable across processes and compilers unlike std::hash
+        for (unsigned char c : text)
+        {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+private:
+    static const Handle& at(const Nodes& table, uint32_t id, std::size_t built)
+    {
+        if (id >= built)
+            throw std::runtime_error("Serial data links a node out of order");
+        return table[id];
+    }
+
+    static Handle make(uint8_t kind,
+                       const std::string& name,
+                       std::size_t size,
+                       uint8_t form,
+                       const Nodes& kids)
+    {
+        std::size_t want = 2;
+        switch (kind)
+        {
+        case KindVar:     want = 0; break;
+        case KindUnitVec: want = 1; break;
+        case KindElement: want = kids.size(); break;
+        case KindSummer:
+        case KindMult:
+        case KindDot:
+        case KindDelta:   break;
+        default:
+            throw std::runtime_error("Serial data has an unknown node kind");
+        }
+        if (kids.size() != want)
+            throw std::runtime_error("Serial data has a node with the wrong kids");
+
+        switch (kind)
+        {
+        case KindVar:     return Handle(new Var(name, size));
+        case KindUnitVec: return Handle(new UnitVec(kids[0]));
+        case KindSummer:  return Handle(new Summer(kids[0], kids[1]));
+        case KindMult:    return Handle(new Mult(kids[0], kids[1]));
+        case KindDot:     return Handle(new Dot(kids[0], kids[1]));
+        case KindDelta:   return Handle(new Delta(kids[0], kids[1]));
+        default:
+        {
+            if (form > FormSparse)
+                throw std::runtime_error("Serial data has an unknown element form");
+            Element* element = new Element(name, static_cast<ElementForm>(form), size);
+            Handle   exp(element);
+            element->children_ = kids;
+            element->refresh();
+            return exp;
+        }
+        }
+    }
+};
+
+// ################################################
+// ################################################
+// ################################################
+
+// a fixed name per element type.. for hashes (unlike typeid its the same
+// everywhere) and for the generated code
+template <typename Type> struct JitType;
+template <> struct JitType<float>   { static const char* name() { return "float"; } };
+template <> struct JitType<double>  { static const char* name() { return "double"; } };
+template <> struct JitType<int8_t>  { static const char* name() { return "std::int8_t"; } };
+template <> struct JitType<int16_t> { static const char* name() { return "std::int16_t"; } };
+template <> struct JitType<int32_t> { static const char* name() { return "std::int32_t"; } };
+template <> struct JitType<int64_t> { static const char* name() { return "std::int64_t"; } };
+
+// ################################################
+// ################################################
+// ################################################
+
+template <typename Type>
+class DiskCache
+{
+public:
+    typedef std::function<Handle (const Handle&)> Passes;
+
+protected:
+    const Executor<Type>& exec_;
+    std::string           dir_;
+    std::size_t           builds_;
+    std::size_t           loads_;
+
+    // dir has to exist
+    DiskCache(const Executor<Type>& exec,
+              const std::string& dir) :
+        exec_(exec),
+        dir_(dir),
+        builds_(0),
+        loads_(0)
+    {}
+
+    static std::vector<std::string> inputs(const Handle& exp)
+    {
+        // the names of the tensors the graph reads, sorted.. each node once
+        std::set<std::string> names;
+        std::unordered_set<const Node*> seen;
+        std::vector<const Node*> stack(1, exp.get());
+        while (not stack.empty())
+        {
+            const Node* node = stack.back();
+            stack.pop_back();
+            if (not seen.insert(node).second)
+                continue;
+            if (node->kind_ == KindElement)
+                names.insert(static_cast<const Element*>(node)->name_);
+            for (const Handle& kid : node->children_)
+                stack.push_back(kid.get());
+        }
+        return std::vector<std::string>(names.begin(), names.end());
+    }
+
+    std::string key(const Handle& exp) const
+    {
+        // the graph and the shapes of the tensors it reads
+        std::stringstream ss;
+        ss << JitType<Type>::name();
+        for (const std::string& input : inputs(exp))
+            ss << ';' << input << '=' << join(TensorUtils<Type>::shape(exec_.tensor(input)), "x");
+        for (const std::pair<const std::string, std::size_t>& size : exec_.sizes())
+            ss << ';' << size.first << ':' << size.second;
+
+        std::stringstream hex;
+        hex << std::hex << Serial::fnv(Serial::write(exp), Serial::fnv(ss.str()));
+        return hex.str();
+    }
+
+    std::string path(const std::string& name, const char* ext) const
+    {
+        return dir_ + "/summer_" + name + ext;
+    }
+
+    static bool replace(const std::string& file,
+                        const std::function<bool (const std::string&)>& write)
+    {
+        // written aside and renamed in so another process never loads half a
+        // file.. false (and nothing left behind) if either fails
+        std::stringstream tmp;
+        tmp << file << "." << getpid() << ".tmp";
+        if (write(tmp.str()) and std::rename(tmp.str().c_str(), file.c_str()) == 0)
+            return true;
+        std::remove(tmp.str().c_str());
+        return false;
+    }
+
+    template <typename Found>
+    Found fetch(const std::string& name,
+                const std::function<bool (const std::string&, Found&)>& load,
+                const std::function<Found ()>& build)
+    {
+        // off disk if its there.. the passes are only run in build
+        Found found;
+        if (load(name, found))
+        {
+            ++loads_;
+            return found;
+        }
+        found = build();
+        ++builds_;
+        return found;
+    }
+
+public:
+    // entries made from scratch and read back off disk
+    std::size_t builds() const { return builds_; }
+    std::size_t loads()  const { return loads_; }
+};
+
+// ################################################
+// ################################################
+// ################################################
+
+template <typename Type>
+class PlanCache : public DiskCache<Type>
+{
+public:
+    typedef typename Tensor<Type>::Shape          Shape;
+    typedef typename DiskCache<Type>::Passes      Passes;
+
+    struct Entry
+    {
+        Handle     graph_;   // after the passes
+        Plan<Type> plan_;
+    };
+
+private:
+    static const uint32_t Magic   = 0x50534d53;   // SMSP
+    static const uint32_t Version = 2;
+
+    using DiskCache<Type>::exec_;
+
+    PlanCache(const PlanCache&);
+    PlanCache& operator=(const PlanCache&);
+
+    static std::size_t reach(const Shape& extent, const Shape& stride)
+    {
+        // one past the furthest element the loops get to through stride
+        std::size_t last = 0;
+        for (std::size_t l = 0; l < extent.size(); ++l)
+        {
+            if (extent[l] == 0) return 0;
+            last += (extent[l] - 1) * stride[l];
+        }
+        return last + 1;
+    }
+
+    static std::size_t reach(std::size_t rows, std::size_t row, std::size_t cols, std::size_t col)
+    {
+        // the same for one gemm operand
+        Shape extent = { rows, cols };
+        Shape stride = { row, col };
+        return reach(extent, stride);
+    }
+
+    static std::size_t elements(const Shape& shape)
+    {
+        std::size_t count = 1;
+        for (std::size_t dim : shape) count *= dim;
+        return count;
+    }
+
+    static void check(const Lowered<Type>& kernel, const Shape& shape)
+    {
+        // everything the kernel reads and writes has to be inside the bound
+        // tensors and its output.. the file cant be trusted for that
+        const LoopNest<Type>& nest  = kernel.nest_;
+        const std::size_t     loops = nest.extent_.size();
+        if (kernel.pattern_ > Lowered<Type>::AsBatched or nest.outStride_.size() != loops)
+            throw std::runtime_error("bad kernel");
+
+        for (const std::pair<int,int>& delta : nest.deltas_)
+            if (std::size_t(delta.first) >= loops or std::size_t(delta.second) >= loops)
+                throw std::runtime_error("bad delta");
+
+        for (const typename LoopNest<Type>::Read& read : nest.reads_)
+            if (read.stride_.size() != loops or reach(nest.extent_, read.stride_) > read.tensor_.size())
+                throw std::runtime_error("bad read");
+
+        std::size_t out = elements(shape);
+        if (reach(nest.extent_, nest.outStride_) > out)
+            throw std::runtime_error("bad kernel");
+
+        if (kernel.pattern_ == Lowered<Type>::AsLoops)
+            return;
+        if (nest.reads_.size() != 2)
+            throw std::runtime_error("bad kernel");
+        if (kernel.pattern_ == Lowered<Type>::AsElementwise)
+            return;
+
+        // the gemm walks from each batch offset.. nothing at all if a loop is empty
+        if (std::count(nest.extent_.begin(), nest.extent_.end(), std::size_t(0)))
+            return;
+        Shape batchExtent(loops, 1);
+        for (int loop : kernel.batch_)
+        {
+            if (std::size_t(loop) >= loops)
+                throw std::runtime_error("bad kernel");
+            batchExtent[loop] = nest.extent_[loop];
+        }
+        if (kernel.M_ == 0 or kernel.N_ == 0 or kernel.K_ == 0)
+            return;
+        if (reach(batchExtent, nest.reads_[0].stride_) - 1 +
+            reach(kernel.M_, kernel.aRow_, kernel.K_, kernel.aCol_) > nest.reads_[0].tensor_.size() or
+            reach(batchExtent, nest.reads_[1].stride_) - 1 +
+            reach(kernel.K_, kernel.bRow_, kernel.N_, kernel.bCol_) > nest.reads_[1].tensor_.size() or
+            reach(batchExtent, nest.outStride_) - 1 +
+            reach(kernel.M_, kernel.cRow_, kernel.N_, kernel.cCol_) > out)
+            throw std::runtime_error("bad kernel");
+    }
+
+    static void index(Serial::Writer& out, int idx) { out.u32(idx + 1); }
+    static int  index(Serial::Reader& in)           { return static_cast<int>(in.u32()) - 1; }
+
+    void save(const std::string& name, const Entry& entry) const
+    {
+        std::string data;
+        Serial::Writer out = { data };
+        out.u32(Magic);
+        out.u32(Version);
+        Serial::write(out, Nodes(1, entry.graph_));
+
+        const Plan<Type>& plan = entry.plan_;
+        out.u64(plan.naive_);
+        out.u32(plan.outputs_.size());
+        for (int output : plan.outputs_)
+            out.u32(output);
+
+        out.u32(plan.buffers_.size());
+        for (const typename Plan<Type>::Buffer& buffer : plan.buffers_)
+        {
+            out.u64(buffer.size_);
+            out.u32(buffer.first_);
+            out.u32(buffer.last_);
+            out.u64(buffer.offset_);
+        }
+
+        out.u32(plan.steps_.size());
+        for (const typename Plan<Type>::Step& step : plan.steps_)
+        {
+            out.u8(step.op_);
+            index(out, step.left_);
+            index(out, step.right_);
+            out.sizes(step.shape_);
+            index(out, step.buffer_);
+            out.u8(step.inPlace_);
+            if (step.op_ != Plan<Type>::Kernel and step.op_ != Plan<Type>::View)
+                continue;
+
+            const Lowered<Type>& kernel = step.kernel_;
+            out.u8(kernel.pattern_);
+            std::size_t gemm[] = { kernel.M_, kernel.N_, kernel.K_,
+                                   kernel.aRow_, kernel.aCol_,
+                                   kernel.bRow_, kernel.bCol_,
+                                   kernel.cRow_, kernel.cCol_ };
+            out.sizes(std::vector<std::size_t>(gemm, gemm + 9));
+            out.sizes(std::vector<std::size_t>(kernel.batch_.begin(), kernel.batch_.end()));
+
+            const LoopNest<Type>& nest = kernel.nest_;
+            out.sizes(nest.extent_);
+            out.sizes(nest.outStride_);
+            out.sizes(nest.outShape_);
+            out.u32(nest.deltas_.size());
+            for (const std::pair<int,int>& delta : nest.deltas_)
+            {
+                out.u32(delta.first);
+                out.u32(delta.second);
+            }
+            out.u32(nest.reads_.size());
+            for (const typename LoopNest<Type>::Read& read : nest.reads_)
+            {
+                out.str(read.name_);
+                out.sizes(read.stride_);
+            }
+            out.u32(nest.bands_.size());
+            for (const typename LoopNest<Type>::Band& band : nest.bands_)
+            {
+                out.u32(band.first_);
+                out.u32(band.second_);
+                out.u64(band.width_);
+            }
+            // the non zeros arent kept.. they are the data not the shape
+            index(out, nest.sparse_.read_);
+            out.sizes(std::vector<std::size_t>(nest.sparse_.loops_.begin(), nest.sparse_.loops_.end()));
+        }
+
+        std::string file = this->path(name, ".plan");
+        bool written = DiskCache<Type>::replace(file, [&data](const std::string& tmp)
+        {
+            std::FILE* handle = std::fopen(tmp.c_str(), "wb");
+            bool written = handle and std::fwrite(data.data(), 1, data.size(), handle) == data.size();
+            if (handle) written = std::fclose(handle) == 0 and written;
+            return written;
+        });
+        if (not written)
+        {
+            std::stringstream ss;
+            ss << "Plan cache could not write " << file;
+            throw std::runtime_error(ss.str());
+        }
+    }
+
+    bool load(const std::string& name, Entry& entry) const
+    {
+        // false if it isnt on disk
+        std::string file = this->path(name, ".plan");
+        int fd = ::open(file.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat info;
+        void* mapped = MAP_FAILED;
+        if (fstat(fd, &info) == 0 and info.st_size > 0)
+            mapped = mmap(0, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED)
+        {
+            std::stringstream ss;
+            ss << "Plan cache could not map " << file;
+            throw std::runtime_error(ss.str());
+        }
+
+        const unsigned char* start = static_cast<const unsigned char*>(mapped);
+        Serial::Reader in = { start, start + info.st_size };
+        try
+        {
+            parse(in, entry);
+        }
+        catch (std::exception& e)
+        {
+            munmap(mapped, info.st_size);
+            std::stringstream ss;
+            ss << "Plan cache file " << file << " is bad: " << e.what();
+            throw std::runtime_error(ss.str());
+        }
+        munmap(mapped, info.st_size);
+        return true;
+    }
+
+    void parse(Serial::Reader& in, Entry& entry) const
+    {
+        if (in.u32() != Magic or in.u32() != Version)
+            throw std::runtime_error("not a plan");
+
+        Nodes graph = Serial::read(in);
+        if (graph.size() != 1)
+            throw std::runtime_error("not one graph");
+        entry.graph_ = graph[0];
+
+        // counts are checked against whats left before anything is sized
+        Plan<Type>& plan = entry.plan_;
+        plan.naive_ = in.u64();
+        uint32_t outputs = in.u32();
+        in.need(4 * std::size_t(outputs));
+        plan.outputs_.resize(outputs);
+        for (int& output : plan.outputs_)
+            output = in.u32();
+
+        uint32_t buffers = in.u32();
+        in.need(24 * std::size_t(buffers));
+        plan.buffers_.resize(buffers);
+        for (typename Plan<Type>::Buffer& buffer : plan.buffers_)
+        {
+            buffer.size_   = in.u64();
+            buffer.first_  = in.u32();
+            buffer.last_   = in.u32();
+            buffer.offset_ = in.u64();
+        }
+
+        uint32_t steps = in.u32();
+        in.need(18 * std::size_t(steps));
+        plan.steps_.resize(steps);
+        for (std::size_t s = 0; s < plan.steps_.size(); ++s)
+        {
+            typename Plan<Type>::Step& step = plan.steps_[s];
+            uint8_t op = in.u8();
+            if (op > Plan<Type>::Scale)
+                throw std::runtime_error("bad step");
+            step.op_      = static_cast<typename Plan<Type>::Op>(op);
+            step.left_    = index(in);
+            step.right_   = index(in);
+            step.shape_   = in.sizes();
+            step.buffer_  = index(in);
+            step.inPlace_ = in.u8() != 0;
+
+            if (step.op_ == Plan<Type>::Kernel or step.op_ == Plan<Type>::View)
+            {
+                Lowered<Type>& kernel = step.kernel_;
+                uint8_t pattern = in.u8();
+                if (pattern > Lowered<Type>::AsBatched)
+                    throw std::runtime_error("bad kernel");
+                kernel.pattern_ = static_cast<typename Lowered<Type>::Pattern>(pattern);
+                std::vector<std::size_t> gemm = in.sizes();
+                if (gemm.size() != 9)
+                    throw std::runtime_error("bad kernel");
+                kernel.M_    = gemm[0]; kernel.N_    = gemm[1]; kernel.K_    = gemm[2];
+                kernel.aRow_ = gemm[3]; kernel.aCol_ = gemm[4];
+                kernel.bRow_ = gemm[5]; kernel.bCol_ = gemm[6];
+                kernel.cRow_ = gemm[7]; kernel.cCol_ = gemm[8];
+                std::vector<std::size_t> batch = in.sizes();
+                kernel.batch_.assign(batch.begin(), batch.end());
+
+                LoopNest<Type>& nest = kernel.nest_;
+                nest.extent_    = in.sizes();
+                nest.outStride_ = in.sizes();
+                nest.outShape_  = in.sizes();
+                uint32_t deltas = in.u32();
+                in.need(8 * std::size_t(deltas));
+                nest.deltas_.resize(deltas);
+                for (std::pair<int,int>& delta : nest.deltas_)
+                {
+                    delta.first  = in.u32();
+                    delta.second = in.u32();
+                }
+                uint32_t reads = in.u32();
+                in.need(8 * std::size_t(reads));
+                nest.reads_.resize(reads);
+                for (typename LoopNest<Type>::Read& read : nest.reads_)
+                {
+                    read.name_   = in.str();
+                    read.tensor_ = exec_.tensor(read.name_);
+                    read.stride_ = in.sizes();
+                }
+
+                const std::size_t loops = nest.extent_.size();
+                uint32_t bands = in.u32();
+                in.need(16 * std::size_t(bands));
+                nest.bands_.resize(bands);
+                for (typename LoopNest<Type>::Band& band : nest.bands_)
+                {
+                    band.first_  = in.u32();
+                    band.second_ = in.u32();
+                    band.width_  = in.u64();
+                    if (std::size_t(band.first_) >= loops or std::size_t(band.second_) >= loops)
+                        throw std::runtime_error("bad band");
+                }
+                int sparse = index(in);
+                std::vector<std::size_t> sparseLoops = in.sizes();
+                if (sparse >= 0)
+                {
+                    if (std::size_t(sparse) >= nest.reads_.size() or
+                        sparseLoops.size() != TensorUtils<Type>::shape(nest.reads_[sparse].tensor_).size())
+                        throw std::runtime_error("bad sparse");
+                    for (std::size_t l : sparseLoops)
+                        if (l >= loops)
+                            throw std::runtime_error("bad sparse");
+                    nest.index(sparse, std::vector<int>(sparseLoops.begin(), sparseLoops.end()));
+                }
+            }
+
+            // only earlier steps.. and they have to fit together
+            if (step.op_ == Plan<Type>::Contract or step.op_ == Plan<Type>::Scale)
+            {
+                if (step.left_  < 0 or std::size_t(step.left_)  >= s or
+                    step.right_ < 0 or std::size_t(step.right_) >= s)
+                    throw std::runtime_error("bad step");
+
+                const Shape& left  = plan.steps_[step.left_].shape_;
+                const Shape& right = plan.steps_[step.right_].shape_;
+                Shape shape;
+                if (step.op_ == Plan<Type>::Scale)
+                {
+                    if (elements(left) != 1)
+                        throw std::runtime_error("bad step");
+                    shape = right;
+                }
+                else
+                {
+                    if (left.empty() or right.empty() or left.back() != right.front())
+                        throw std::runtime_error("bad step");
+                    shape.assign(left.begin(), left.end() - 1);
+                    shape.insert(shape.end(), right.begin() + 1, right.end());
+                    if (shape.empty()) shape.push_back(1);
+                }
+                if (shape != step.shape_)
+                    throw std::runtime_error("bad step");
+            }
+            else
+            {
+                check(step.kernel_, step.shape_);
+            }
+
+            if (step.op_ == Plan<Type>::View)
+            {
+                if (step.kernel_.nest_.reads_.size() != 1 or
+                    TensorUtils<Type>::shape(step.kernel_.nest_.reads_[0].tensor_) != step.shape_)
+                    throw std::runtime_error("bad view");
+                step.out_ = step.kernel_.nest_.reads_[0].tensor_;
+            }
+            else if (step.buffer_ < 0 or step.buffer_ >= static_cast<int>(plan.buffers_.size()) or
+                     plan.buffers_[step.buffer_].size_ < elements(step.shape_))
+            {
+                throw std::runtime_error("bad buffer");
+            }
+        }
+
+        // each buffer is the size of the step that first writes it and the
+        // arena is no bigger than one buffer per step.. so nothing is sized
+        // off a number the shapes dont back up
+        std::size_t naive = 0;
+        for (const typename Plan<Type>::Step& step : plan.steps_)
+            if (step.op_ != Plan<Type>::View)
+                naive += elements(step.shape_);
+
+        std::size_t total = 0;
+        for (const typename Plan<Type>::Buffer& buffer : plan.buffers_)
+        {
+            if (buffer.first_ < 0 or std::size_t(buffer.first_) >= plan.steps_.size() or
+                plan.steps_[buffer.first_].op_ == Plan<Type>::View or
+                buffer.size_ != elements(plan.steps_[buffer.first_].shape_) or
+                buffer.offset_ > naive)
+                throw std::runtime_error("bad buffer");
+            total = std::max(total, buffer.offset_ + buffer.size_);
+        }
+        if (plan.naive_ != naive or total > naive)
+            throw std::runtime_error("bad arena");
+
+        plan.arena_.reset(new std::vector<Type>(total));
+        for (typename Plan<Type>::Step& step : plan.steps_)
+        {
+            if (step.op_ != Plan<Type>::View)
+                step.out_ = Tensor<Type>(step.shape_,
+                                         plan.arena_->data() + plan.buffers_[step.buffer_].offset_,
+                                         plan.arena_);
+        }
+
+        for (int output : plan.outputs_)
+            if (output < 0 or output >= static_cast<int>(plan.steps_.size()))
+                throw std::runtime_error("bad output");
+
+        if (in.at_ != in.end_)
+            throw std::runtime_error("trailing data");
+    }
+
+public:
+    PlanCache(const Executor<Type>& exec,
+              const std::string& dir) :
+        DiskCache<Type>(exec, dir)
+    {}
+
+    // the optimised graph and its plan.. passes are only run (and the plan
+    // only built) when the file for exp isnt there
+    Entry lookup(const Handle& exp, const Passes& passes = Passes())
+    {
+        std::string name = this->key(exp);
+        return this->template fetch<Entry>(
+            name,
+            [this](const std::string& name, Entry& entry) { return load(name, entry); },
+            [this, &name, &exp, &passes]()
+            {
+                Entry entry;
+                entry.graph_ = passes ? passes(exp) : exp;
+                entry.plan_  = exec_.plan(entry.graph_);
+                save(name, entry);
+                return entry;
+            });
+    }
+};
+
+#endif
@@ -0,0 +1,191 @@
+#include "SummerCache.hh"
+
+#include "test.hh"
+#include "test.summer.hh"
+
+#include <cstdlib>
+#include <fstream>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+void testSerial()
+{
+    Handle l = Make::tensor("m", {"i","j"}, {3,4});
+    Nodes back = Serial::read(Serial::write(l));
+    EXPECT_EQ(1u, back.size());
+    EXPECT_EQ(rendered(l), rendered(back[0]));
+
+    // sizes and the subtree summaries come back too
+    const Handle& i = back[0]->children_[0];
+    EXPECT_EQ(3u, static_cast<const Var*>(i.get())->size_);
+    EXPECT_EQ(l->kinds_, back[0]->kinds_);
+    EXPECT_EQ(l->vars_,  back[0]->vars_);
+
+    // and the structure of an element
+    Handle band = Make::tensor("b", {"i","j"}, {}, FormBanded, 2);
+    Handle bandBack = Serial::read(Serial::write(band))[0];
+    const Element* read = static_cast<const Element*>(
+        bandBack->children_[1]->children_[1]->children_[1]->children_[1].get());
+    EXPECT_EQ(FormBanded, read->form_);
+    EXPECT_EQ(2u, read->band_);
+
+    // a shared subtree is written once and read back shared
+    Handle tree = Make::dot(xm(), xm());
+    std::string copies = Serial::write(tree);
+    CommonSubExpr cse;
+    Handle dag = cse.process(Make::dot(xm(), xm()));
+    std::string shared = Serial::write(dag);
+    EXPECT_EQ(true, (shared.size() < copies.size()));
+
+    Handle again = Serial::read(shared)[0];
+    EXPECT_EQ(rendered(tree), rendered(again));
+    EXPECT_EQ(again->children_[0], again->children_[1]);
+
+    // several roots share the one table
+    Nodes roots = Serial::read(Serial::write(Nodes({dag->children_[0], dag})));
+    EXPECT_EQ(roots[0], roots[1]->children_[1]);
+
+    EXPECT_THROW(Serial::read(shared.substr(0, shared.size() - 3)), "Serial data is truncated");
+    EXPECT_THROW(Serial::read(std::string("nonsense")), "Serial data is not a graph");
+    std::string bad = Serial::write(Handle(new UnitVec(Handle(new Var("i")))));
+    bad[bad.size() - 9] = 5;   // the UnitVec's kid is past anything built
+    EXPECT_THROW(Serial::read(bad), "Serial data links a node out of order");
+}
+
+void testCache(const std::string& dir)
+{
+    Tensor<int> xData({3}, {1,2,3});
+    Tensor<int> mData({3,4}, {1,2,3,4, 5,6,7,8, 9,10,11,12});
+
+    Executor<int> exec;
+    exec.bind("x", xData)
+        .bind("m", mData)
+        .bind("A", Tensor<int>({2,3}, {1,2,3, 4,5,6}))
+        .bind("B", Tensor<int>({3,2}, {1,0, 0,1, 1,1}))
+        .bind("C", Tensor<int>({2,2}, {2,1, 1,2}));
+
+    int passes = 0;
+    PlanCache<int>::Passes counted = [&passes](const Handle& l) { ++passes; return optimise(l); };
+
+    Tensor<int> expXM    = TensorUtils<int>::dot(xData, mData);
+    Tensor<int> expChain = exec.run(chain());
+    {
+        PlanCache<int> cache(exec, dir);
+        PlanCache<int>::Entry entry = cache.lookup(xm(), counted);
+        EXPECT_EQ(1u, cache.builds());
+        EXPECT_EQ(1, passes);
+        EXPECT_STREAMED_AS("sum_i(sum_j(U_j*x_i*m_ij))") << entry.graph_;
+        EXPECT_EQ(expXM, entry.plan_.run());
+
+        EXPECT_EQ(expChain, cache.lookup(chain()).plan_.run());
+        EXPECT_EQ(2u, cache.builds());
+    }
+
+    // a new cache (or process) maps the plans in.. no passes and no planning
+    {
+        PlanCache<int> cache(exec, dir);
+        PlanCache<int>::Entry entry = cache.lookup(xm(), counted);
+        EXPECT_EQ(0u, cache.builds());
+        EXPECT_EQ(1u, cache.loads());
+        EXPECT_EQ(1, passes);
+        EXPECT_STREAMED_AS("sum_i(sum_j(U_j*x_i*m_ij))") << entry.graph_;
+        EXPECT_EQ(expXM, entry.plan_.run());
+
+        // the arena layout and the kernels are what was planned
+        Plan<int> fresh = exec.plan(chain());
+        Plan<int> loaded = cache.lookup(chain()).plan_;
+        EXPECT_EQ(fresh.peak(), loaded.peak());
+        EXPECT_EQ(fresh.steps_.size(), loaded.steps_.size());
+        EXPECT_EQ(fresh.iterations(), loaded.iterations());
+        EXPECT_EQ(expChain, loaded.run());
+        EXPECT_EQ(expChain, loaded.run(2, 1));
+
+        // new data in the bound tensors is picked up as is
+        TensorUtils<int>::data(xData)[0] = 0;
+        EXPECT_EQ(TensorUtils<int>::dot(xData, mData), entry.plan_.run());
+
+        // structured kernels come back with their bands and non zeros
+        Tensor<int> sData({3,3}, {0,0,2, 0,0,0, 1,0,0});
+        exec.bind("s", sData);
+        Handle sparse = Make::dot(Make::tensor("x", {"k"}),
+                                  Make::tensor("s", {"i","j"}, {}, FormSparse));
+        PlanCache<int> other(exec, dir);
+        Plan<int> built = other.lookup(sparse, optimise).plan_;
+        Plan<int> mapped = cache.lookup(Make::dot(Make::tensor("x", {"k"}),
+                                                  Make::tensor("s", {"i","j"}, {}, FormSparse)),
+                                        counted).plan_;
+        EXPECT_EQ(3u, cache.loads());
+        EXPECT_EQ(TensorUtils<int>::dot(xData, sData), mapped.run());
+        EXPECT_EQ(built.iterations(), mapped.iterations());
+        EXPECT_EQ(2u, mapped.iterations());
+
+        // a new shape is a new plan
+        exec.bind("m", Tensor<int>({3,2}, {1,2, 3,4, 5,6}));
+        cache.lookup(xm(), counted);
+        EXPECT_EQ(1u, cache.builds());
+        EXPECT_EQ(2, passes);
+    }
+
+    // every byte of a plan file flipped in turn.. it either still loads a
+    // plan that runs or its reported bad, it never reaches past its buffers
+    std::string flips = dir + "/flips";
+    mkdir(flips.c_str(), 0700);
+    PlanCache<int>(exec, flips).lookup(chain());
+
+    std::string file;
+    DIR* listing = opendir(flips.c_str());
+    for (dirent* entry = readdir(listing); entry; entry = readdir(listing))
+        if (std::string(entry->d_name).find(".plan") != std::string::npos)
+            file = flips + "/" + entry->d_name;
+    closedir(listing);
+
+    std::ifstream original(file.c_str(), std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(original)), std::istreambuf_iterator<char>());
+    std::size_t bad = 0;
+    for (std::size_t at = 0; at < data.size(); ++at)
+    {
+        std::string flipped = data;
+        flipped[at] = ~flipped[at];
+        std::ofstream(file.c_str(), std::ios::binary) << flipped;
+        try
+        {
+            PlanCache<int>(exec, flips).lookup(chain()).plan_.run();
+        }
+        catch (std::exception& e)
+        {
+            EXPECT_EQ(true, (std::string(e.what()).find(" is bad: ") != std::string::npos));
+            ++bad;
+        }
+    }
+    EXPECT_EQ(true, (bad > data.size() / 2));
+
+    std::string error;
+    try
+    {
+        PlanCache<int>(exec, dir + "/missing").lookup(xm());
+    }
+    catch (std::exception& e)
+    {
+        error = e.what();
+    }
+    EXPECT_EQ(0u, error.find("Plan cache could not write " + dir + "/missing/summer_"));
+}
+
+int main()
+{
+    char tmpl[] = "/tmp/summer_cache_XXXXXX";
+    std::string dir = mkdtemp(tmpl);
+
+    try
+    {
+        testSerial();
+        testCache(dir);
+    }
+    catch (std::exception& e)
+    {
+        std::cout << "Opps... " << e.what() << "\n";
+    }
+
+    std::system(("rm -rf " + dir).c_str());
+}
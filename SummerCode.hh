@@ -0,0 +1,302 @@
+#ifndef SummerCode_HH
+#define SummerCode_HH
+
+#include "SummerExec.hh"
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <stdexcept>
+
+// bytecode for planned graphs
+//
+// for the many little graphs where the jit costs more than it saves. a Plan
+// (already post order) is flattened into one instruction array and run by a
+// switch loop. the loop nests are unrolled into explicit Loop/Next/Delta/Mac
+// instructions over registers.. loop counters in idx_ and running offsets in
+// off_, each operand a fixed pointer in base_.. so a run never recurses,
+// never touches a Node or a shared_ptr and never allocates.
+//
+// operands are numbered once at compile time: every input a kernel reads,
+// every step output in the arena. Contract and Scale are single instructions
+// over them (Contract runs on the Gemm kernel)
+
+// ################################################
+// ################################################
+// ################################################
+
+template <typename Type>
+class Program
+{
+public:
+    typedef typename Tensor<Type>::Shape Shape;
+
+    enum OpCode
+    {
+        OpZero,       // a: operand  b: count                       .. fill with 0
+        OpLoop,       // a: loop     b: extent  c: pc past its Next .. idx = 0
+        OpNext,       // a: loop     b: pc of body  c: consts at      .. step offsets, loop or rewind
+        OpDelta,      // a: loop     b: loop    c: pc of the Next     .. skip unless equal
+        OpMac,        // a: out      b: first read  c: reads           .. out += product
+        OpContract,   // a: out      b: left    c: right  d: consts at .. M N K gemm
+        OpScale,      // a: out      b: scaler  c: tensor d: count
+        OpHalt
+    };
+
+    struct Instr
+    {
+        OpCode   op_;
+        uint32_t a_;
+        uint32_t b_;
+        uint32_t c_;
+        uint32_t d_;
+    };
+
+private:
+    std::vector<Instr>                  code_;
+    std::vector<std::size_t>            consts_;  // extents, strides and gemm sizes
+    std::vector<Type*>                  base_;    // per operand
+    std::vector<std::size_t>            off_;     // per operand.. only moves inside a nest
+    std::vector<std::size_t>            idx_;     // per loop depth
+    std::vector<Tensor<Type> >          keep_;    // inputs held alive
+    std::shared_ptr<std::vector<Type> > arena_;   // its own.. the plans runs cant touch it
+    Tensor<Type>                        output_;
+
+    uint32_t operand(Type* base)
+    {
+        base_.push_back(base);
+        return base_.size() - 1;
+    }
+
+    uint32_t input(const Tensor<Type>& tensor)
+    {
+        keep_.push_back(tensor);
+        // inputs are only ever read
+        return operand(const_cast<Type*>(TensorUtils<Type>::data(tensor).data()));
+    }
+
+    void emit(OpCode op, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0, uint32_t d = 0)
+    {
+        Instr instr = { op, a, b, c, d };
+        code_.push_back(instr);
+    }
+
+    uint32_t here() const { return code_.size(); }
+
+    void nest(const LoopNest<Type>& nest, uint32_t out, std::size_t size)
+    {
+        // the reads go in back to back so Mac can walk them as a range
+        uint32_t first = base_.size();
+        for (const typename LoopNest<Type>::Read& read : nest.reads_)
+            input(read.tensor_);
+
+        const std::size_t depth = nest.extent_.size();
+        if (idx_.size() < depth)
+            idx_.resize(depth);
+
+        emit(OpZero, out, size);
+
+        std::vector<uint32_t> loops;
+        for (std::size_t l = 0; l < depth; ++l)
+        {
+            loops.push_back(here());
+            emit(OpLoop, l, nest.extent_[l]);
+        }
+
+        std::vector<uint32_t> deltas;
+        for (const std::pair<int,int>& delta : nest.deltas_)
+        {
+            deltas.push_back(here());
+            emit(OpDelta, delta.first, delta.second);
+        }
+
+        emit(OpMac, out, first, nest.reads_.size());
+
+        for (std::size_t l = depth; l-- > 0; )
+        {
+            // extent, count then (operand, stride) for each that moves
+            uint32_t at = consts_.size();
+            consts_.push_back(nest.extent_[l]);
+            consts_.push_back(0);
+            for (std::size_t r = 0; r < nest.reads_.size(); ++r)
+            {
+                if (nest.reads_[r].stride_[l] == 0) continue;
+                consts_.push_back(first + r);
+                consts_.push_back(nest.reads_[r].stride_[l]);
+                ++consts_[at+1];
+            }
+            if (nest.outStride_[l] != 0)
+            {
+                consts_.push_back(out);
+                consts_.push_back(nest.outStride_[l]);
+                ++consts_[at+1];
+            }
+
+            // the innermost Next is where a failed delta goes
+            if (l + 1 == depth)
+                for (uint32_t pc : deltas)
+                    code_[pc].c_ = here();
+
+            emit(OpNext, l, loops[l] + 1, at);
+            code_[loops[l]].c_ = here();
+        }
+    }
+
+public:
+    Program() :
+        code_(),
+        consts_(),
+        base_(),
+        off_(),
+        idx_(),
+        keep_(),
+        arena_(),
+        output_()
+    {}
+
+    static Program of(const Plan<Type>& plan)
+    {
+        // the steps get the same offsets in an arena of the programs own
+        Program program;
+        program.arena_.reset(new std::vector<Type>(plan.peak()));
+
+        std::vector<uint32_t> at(plan.steps_.size());
+        for (std::size_t s = 0; s < plan.steps_.size(); ++s)
+        {
+            const typename Plan<Type>::Step& step = plan.steps_[s];
+            if (step.op_ == Plan<Type>::View)
+            {
+                at[s] = program.input(step.out_);
+                continue;
+            }
+
+            Type* out = program.arena_->data() + plan.buffers_[step.buffer_].offset_;
+            at[s] = program.operand(out);
+
+            if (step.op_ == Plan<Type>::Kernel)
+            {
+                program.nest(step.kernel_.nest_, at[s], step.out_.size());
+            }
+            else if (step.op_ == Plan<Type>::Contract)
+            {
+                const typename Plan<Type>::Step& left  = plan.steps_[step.left_];
+                const typename Plan<Type>::Step& right = plan.steps_[step.right_];
+                std::size_t K = left.shape_.back();
+
+                uint32_t sizes = program.consts_.size();
+                program.consts_.push_back(left.out_.size() / K);
+                program.consts_.push_back(right.out_.size() / K);
+                program.consts_.push_back(K);
+                program.emit(OpContract, at[s], at[step.left_], at[step.right_], sizes);
+            }
+            else if (step.op_ == Plan<Type>::Scale)
+            {
+                program.emit(OpScale, at[s], at[step.left_], at[step.right_], step.out_.size());
+            }
+        }
+        program.emit(OpHalt);
+
+        program.off_.assign(program.base_.size(), 0);
+        const typename Plan<Type>::Step& result = plan.steps_[plan.outputs_[0]];
+        if (result.op_ == Plan<Type>::View)
+            program.output_ = result.out_;
+        else
+            program.output_ = Tensor<Type>(result.shape_,
+                                           program.arena_->data() + plan.buffers_[result.buffer_].offset_,
+                                           program.arena_);
+        return program;
+    }
+
+    std::size_t size() const { return code_.size(); }
+
+    // instructions of one kind
+    std::size_t count(OpCode op) const
+    {
+        std::size_t count = 0;
+        for (const Instr& instr : code_)
+            if (instr.op_ == op) ++count;
+        return count;
+    }
+
+    const Tensor<Type>& run()
+    {
+        Type* const*       base   = base_.data();
+        std::size_t*       off    = off_.data();
+        std::size_t*       idx    = idx_.data();
+        const std::size_t* consts = consts_.data();
+
+        for (const Instr* pc = code_.data(); ; )
+        {
+            const Instr& in = *pc++;
+            switch (in.op_)
+            {
+            case OpZero:
+                std::fill(base[in.a_], base[in.a_] + in.b_, Type(0));
+                break;
+
+            case OpLoop:
+                idx[in.a_] = 0;
+                if (in.b_ == 0) pc = code_.data() + in.c_;
+                break;
+
+            case OpNext:
+            {
+                const std::size_t  extent = consts[in.c_];
+                const std::size_t  count  = consts[in.c_ + 1];
+                const std::size_t* step   = consts + in.c_ + 2;
+                for (std::size_t s = 0; s < count; ++s)
+                    off[step[2*s]] += step[2*s + 1];
+
+                if (++idx[in.a_] < extent)
+                {
+                    pc = code_.data() + in.b_;
+                    break;
+                }
+
+                for (std::size_t s = 0; s < count; ++s)
+                    off[step[2*s]] -= extent * step[2*s + 1];
+                break;
+            }
+
+            case OpDelta:
+                if (idx[in.a_] != idx[in.b_]) pc = code_.data() + in.c_;
+                break;
+
+            case OpMac:
+            {
+                Type prod = 1;
+                for (uint32_t r = in.b_; r < in.b_ + in.c_; ++r)
+                    prod *= base[r][off[r]];
+                base[in.a_][off[in.a_]] += prod;
+                break;
+            }
+
+            case OpContract:
+            {
+                const std::size_t M = consts[in.d_];
+                const std::size_t N = consts[in.d_ + 1];
+                const std::size_t K = consts[in.d_ + 2];
+                Gemm<Type>::run(M, N, K,
+                                base[in.b_], K, 1,
+                                base[in.c_], N, 1,
+                                base[in.a_], N, 1,
+                                Type(0));
+                break;
+            }
+
+            case OpScale:
+            {
+                const Type scaler = base[in.b_][0];
+                for (uint32_t i = 0; i < in.d_; ++i)
+                    base[in.a_][i] = TensorUtils<Type>::Helpers::mul(scaler, base[in.c_][i]);
+                break;
+            }
+
+            case OpHalt:
+                return output_;
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,108 @@
+#include "SummerCode.hh"
+
+#include "test.hh"
+#include "test.summer.hh"
+
+#include <atomic>
+#include <new>
+
+// count heap traffic so the interpreter can be shown allocation free
+std::atomic<std::size_t> allocations(0);
+
+void* operator new(std::size_t size)
+{
+    ++allocations;
+    if (void* ptr = std::malloc(size)) return ptr;
+    throw std::bad_alloc();
+}
+
+// stable_sort takes its scratch from the nothrow form
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    ++allocations;
+    return std::malloc(size);
+}
+
+void operator delete(void* ptr) noexcept              { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+
+void checkProgram(Executor<int>& exec, const Handle& exp)
+{
+    // the bytecode has to agree with the executor
+    Program<int> program = Program<int>::of(exec.plan(exp));
+    EXPECT_EQ(exec.run(exp), program.run());
+}
+
+void testProgram()
+{
+    Tensor<int> xData({3}, {1,2,3});
+    Tensor<int> mData({3,4}, {1,2,3,4, 5,6,7,8, 9,10,11,12});
+
+    Executor<int> exec;
+    exec.bind("x", xData)
+        .bind("m", mData)
+        .bind("y", Tensor<int>({4}, {1,0,0,1}))
+        .bind("A", Tensor<int>({2,3}, {1,2,3, 4,5,6}))
+        .bind("B", Tensor<int>({3,2}, {1,0, 0,1, 1,1}));
+
+    // U_k.U_i is a delta between loops.. Delta instructions skip the rest
+    Program<int> loops = Program<int>::of(exec.plan(rewrite(xm())));
+    EXPECT_EQ(1u, loops.count(Program<int>::OpDelta));
+    EXPECT_EQ(TensorUtils<int>::dot(xData, mData), loops.run());
+
+    // reduced it is two loops and a multiply add
+    Program<int> gemv = Program<int>::of(exec.plan(reduce(rewrite(xm()))));
+    EXPECT_EQ(0u, gemv.count(Program<int>::OpDelta));
+    EXPECT_EQ(2u, gemv.count(Program<int>::OpLoop));
+    EXPECT_EQ(TensorUtils<int>::dot(xData, mData), gemv.run());
+
+    // contracts, a scaler and a bound tensor on its own
+    checkProgram(exec, xm());
+    checkProgram(exec, Make::dot(xm(), Make::tensor("y", {"l"})));
+    checkProgram(exec, Make::tensor("m", {"i","j"}));
+    checkProgram(exec, Handle(new Mult(Make::dot(Make::tensor("x", {"k"}),
+                                                 Make::tensor("x", {"q"})),
+                                       Make::dot(Make::tensor("A", {"i","j"}),
+                                                 Make::tensor("B", {"k","l"})))));
+
+    // once built, runs dont allocate
+    std::size_t before = 0;
+    for (int step = 0; step < 4; ++step)
+    {
+        if (step == 1) before = allocations;
+        loops.run();
+        gemv.run();
+    }
+    EXPECT_EQ(before, allocations);
+
+    // new data in the bound tensors is picked up as is
+    TensorUtils<int>::data(xData)[0] = 0;
+    EXPECT_EQ(TensorUtils<int>::dot(xData, mData), gemv.run());
+
+    // a program has its own arena.. running the plan it came from (or
+    // another program made from it) leaves its result alone
+    Plan<int> plan = exec.plan(Make::dot(Make::tensor("A", {"i","j"}),
+                                         Make::tensor("B", {"k","l"})));
+    Program<int> first = Program<int>::of(plan);
+    const Tensor<int>& result = first.run();
+    Tensor<int> held = TensorUtils<int>::dot(exec.tensor("A"), exec.tensor("B"));
+    EXPECT_EQ(held, result);
+
+    Tensor<int> aData = exec.tensor("A");
+    TensorUtils<int>::data(aData)[0] = 100;
+    plan.run();
+    Program<int>::of(plan).run();
+    EXPECT_EQ(held, result);
+}
+
+int main()
+{
+    try
+    {
+        testProgram();
+    }
+    catch (std::exception& e)
+    {
+        std::cout << "Opps... " << e.what() << "\n";
+    }
+}
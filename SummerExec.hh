@@ -0,0 +1,1977 @@
+#ifndef SummerExec_HH
+#define SummerExec_HH
+
+#include "SummerGraph.hh"
+#include "Tensor.hh"
+
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <stdexcept>
+#include <chrono>
+
+// execution of summation graphs against real Tensor data
+//
+// the graph (at any stage of rewriting) is flattened into a Contraction..
+// which is basically an einsum: the Summers are the loops, the Unit vectors
+// left standing are the output axes, the Elements are the factors and any
+// Unit vectors joined by a Dot become deltas between two loop indexes.
+// that is then compiled into a LoopNest that walks strided memory directly.
+//
+// a Dot whose two sides are closed (every index used is summed inside them) is
+// run as steps instead: each side is evaluated to a Tensor and the two are
+// contracted with TensorUtils::dot. so the nesting of a dot chain is the order
+// it is computed in (see ReorderDots) and a node shared by CommonSubExpr is
+// computed only once per run.
+
+// ################################################
+// ################################################
+// ################################################
+
+struct Contraction
+{
+    typedef std::vector<std::string>                       Names;
+    typedef std::vector<std::pair<std::string,std::string> > Deltas;
+
+    struct Factor
+    {
+        std::string name_;
+        Names       vars_;
+        ElementForm form_;
+        std::size_t band_;
+    };
+
+    Names               loops_;    // summer vars.. outer most first
+    Names               basis_;    // output axes in order
+    std::vector<Factor> factors_;
+    Deltas              deltas_;
+};
+
+class Flatten
+{
+    // walks an expression and collects its Contraction.. with an explicit
+    // stack, a dot needs to see the basis before and after each of its sides
+    // so its frame is visited three times
+    struct Frame
+    {
+        const Node* node_;
+        int         stage_;
+        std::size_t start_;   // basis size before the left side
+        std::size_t split_;   // and before the right
+    };
+
+    Contraction&       form_;
+    std::vector<Frame> stack_;
+
+    void push(const Handle& node)
+    {
+        Frame frame = { node.get(), 0, 0, 0 };
+        stack_.push_back(frame);
+    }
+
+    void step(Frame frame)
+    {
+        const Node&  node = *frame.node_;
+        const Nodes& kids = node.children_;
+        switch (node.kind_)
+        {
+        case KindVar:
+        {
+            std::stringstream ss;
+            ss << "Graph index " << static_cast<const Var&>(node).name_ << " used as an expression";
+            throw std::runtime_error(ss.str());
+        }
+
+        case KindUnitVec:
+            form_.basis_.push_back(name(kids[0]));
+            break;
+
+        case KindElement:
+        {
+            const Element& element = static_cast<const Element&>(node);
+            Contraction::Factor factor;
+            factor.name_ = element.name_;
+            factor.form_ = element.form_;
+            factor.band_ = element.band_;
+            for (Nodes::const_iterator iit = kids.begin();
+                 iit != kids.end();
+                 ++iit)
+            {
+                factor.vars_.push_back(name(*iit));
+            }
+            form_.factors_.push_back(factor);
+            break;
+        }
+
+        case KindSummer:
+            form_.loops_.push_back(name(kids[0]));
+            push(kids[1]);
+            break;
+
+        case KindMult:
+            // outer product.. the basis of each side just concatenates
+            push(kids[1]);
+            push(kids[0]);
+            break;
+
+        case KindDot:
+            // contracts the last unit vector on the left with the first on the right
+            if (frame.stage_ == 0)
+            {
+                frame.start_ = form_.basis_.size();
+                ++frame.stage_;
+                stack_.push_back(frame);
+                push(kids[0]);
+            }
+            else if (frame.stage_ == 1)
+            {
+                frame.split_ = form_.basis_.size();
+                ++frame.stage_;
+                stack_.push_back(frame);
+                push(kids[1]);
+            }
+            else
+            {
+                std::size_t split = frame.split_;
+                if (split == frame.start_ or split == form_.basis_.size())
+                {
+                    throw std::runtime_error("Graph dot has no unit vectors to contract");
+                }
+
+                form_.deltas_.push_back(std::make_pair(form_.basis_[split-1],
+                                                       form_.basis_[split]));
+                form_.basis_.erase(form_.basis_.begin() + split - 1,
+                                   form_.basis_.begin() + split + 1);
+            }
+            break;
+
+        case KindDelta:
+            form_.deltas_.push_back(std::make_pair(name(kids[0]),
+                                                   name(kids[1])));
+            break;
+        }
+    }
+
+    static const std::string& name(const Handle& idx)
+    {
+        if (is<Var>(idx))
+            return static_cast<const Var*>(idx.get())->name_;
+        throw std::runtime_error("Graph index is not a Var");
+    }
+
+public:
+    Flatten(Contraction& form) :
+        form_(form),
+        stack_()
+    {}
+
+    static Contraction of(const Handle& exp)
+    {
+        Contraction form;
+        Flatten flatten(form);
+        flatten.push(exp);
+        while (not flatten.stack_.empty())
+        {
+            Frame frame = flatten.stack_.back();
+            flatten.stack_.pop_back();
+            flatten.step(frame);
+        }
+        return form;
+    }
+};
+
+// ################################################
+// ################################################
+// ################################################
+
+template <typename Type>
+class LoopNest
+{
+    // a contraction bound to real data.. every loop index becomes a stride
+    // into each factor and the output so the walk is pure pointer math.
+    //
+    // structured factors cut the loops down: a band keeps one loop within
+    // width of another (banded and unfolded diagonal factors) and a sparse
+    // factor drives its loops from a list of its non zeros.. at the outer most
+    // of them the walk steps through the list, setting all of them at once,
+    // and the deeper ones are then pinned to a single value. the list is taken
+    // at the start of every run so new data in the same tensor is picked up.
+    // both only skip structural zeros so a nest run without them gets the
+    // same answer
+public:
+    typedef typename Tensor<Type>::Shape Shape;
+
+    struct Read
+    {
+        std::string  name_;     // what it is bound as
+        Tensor<Type> tensor_;   // shares the bound data.. a rebind cant free it
+        Shape        stride_;   // per loop
+    };
+
+    struct Band
+    {
+        int         first_;    // loop idxs.. |first - second| <= width
+        int         second_;
+        std::size_t width_;
+    };
+
+    struct Sparse
+    {
+        int              read_;     // -1 if there isnt one
+        std::vector<int> loops_;    // loop per axis of the read
+    };
+
+    Shape                            extent_;     // per loop
+    std::vector<Read>                reads_;
+    Shape                            outStride_;  // per loop
+    Shape                            outShape_;
+    std::vector<std::pair<int,int> > deltas_;     // loop idx pairs that must match
+    std::vector<Band>                bands_;
+    Sparse                           sparse_;
+
+    LoopNest() :
+        extent_(),
+        reads_(),
+        outStride_(),
+        outShape_(),
+        deltas_(),
+        bands_(),
+        sparse_()
+    {
+        sparse_.read_ = -1;
+    }
+
+    bool structured() const { return not bands_.empty() or sparse_.read_ >= 0; }
+
+    void index(int read, const std::vector<int>& loops)
+    {
+        // the read whose non zeros drive the walk
+        sparse_.read_  = read;
+        sparse_.loops_ = loops;
+    }
+
+    std::size_t nonzeros() const
+    {
+        if (sparse_.read_ < 0)
+            return 0;
+        const Tensor<Type>& tensor = reads_[sparse_.read_].tensor_;
+        const Type*         data   = TensorUtils<Type>::data(tensor).data();
+        return tensor.size() - std::count(data, data + tensor.size(), Type(0));
+    }
+
+    std::size_t iterations() const
+    {
+        // bodies the walk gets to.. exact for the sparse loops and a band on
+        // its own, an upper bound where bands share loops
+        std::vector<bool> done(extent_.size(), false);
+        std::size_t count = 1;
+        if (sparse_.read_ >= 0)
+        {
+            count = sparse_.loops_.empty() ? 0 : nonzeros();
+            for (int l : sparse_.loops_) done[l] = true;
+        }
+        for (const Band& band : bands_)
+        {
+            if (done[band.first_] or done[band.second_] or band.first_ == band.second_)
+                continue;
+            std::size_t pairs = 0;
+            std::size_t outer = extent_[band.first_];
+            std::size_t inner = extent_[band.second_];
+            for (std::size_t i = 0; i < outer; ++i)
+            {
+                std::size_t lo = i > band.width_ ? i - band.width_ : 0;
+                std::size_t hi = std::min(inner, i + band.width_ + 1);
+                pairs += hi > lo ? hi - lo : 0;
+            }
+            count *= pairs;
+            done[band.first_] = done[band.second_] = true;
+        }
+        for (std::size_t l = 0; l < extent_.size(); ++l)
+            if (not done[l]) count *= extent_[l];
+        return count;
+    }
+
+    int split() const
+    {
+        // the loop over the outer most output axis (or its tiles).. each of
+        // its values writes its own run of rows. -1 if there isnt one
+        std::size_t size = 1;
+        for (std::size_t len : outShape_) size *= len;
+        for (std::size_t l = 0; l < extent_.size(); ++l)
+            if (outStride_[l] != 0 and outStride_[l] * extent_[l] == size)
+                return l;
+        return -1;
+    }
+
+    // the parts run can cut the output into
+    std::size_t rows() const
+    {
+        int l = split();
+        return l < 0 ? 1 : extent_[l];
+    }
+
+    void run(Type* out, std::size_t outSize) const
+    {
+        run(out, outSize, 0, rows());
+    }
+
+    void run(Type* out, std::size_t outSize, std::size_t from, std::size_t to) const
+    {
+        // only rows [from, to) of the split loop.. and only their part of out
+        // is cleared, so runs over different rows can go at the same time.
+        // the read buffers are looked up here, not when the nest was built
+        Walk walk;
+        walk.split_ = split();
+        walk.from_  = from;
+        walk.to_    = to;
+        walk.out_   = out;
+        if (walk.split_ < 0)
+            std::fill(out, out + outSize, Type(0));
+        else
+            std::fill(out + from * outStride_[walk.split_],
+                      out + std::min(outSize, to * outStride_[walk.split_]),
+                      Type(0));
+
+        walk.idx_.assign(extent_.size(), 0);
+        walk.offsets_.assign(reads_.size() + 1, 0);
+        walk.pinned_.assign(extent_.size(), false);
+        walk.driver_ = extent_.size();
+        for (const Read& read : reads_)
+            walk.data_.push_back(TensorUtils<Type>::data(read.tensor_).data());
+        if (sparse_.read_ >= 0)
+        {
+            for (int l : sparse_.loops_)
+            {
+                walk.pinned_[l] = true;
+                walk.driver_    = std::min<std::size_t>(walk.driver_, l);
+            }
+            list(walk.points_);
+        }
+        step(0, walk);
+    }
+
+private:
+    struct Walk
+    {
+        Shape                    idx_;
+        Shape                    offsets_;
+        std::vector<bool>        pinned_;
+        std::size_t              driver_;   // loop the sparse list is walked at
+        int                      split_;    // loop cut to [from, to).. -1 if none
+        std::size_t              from_;
+        std::size_t              to_;
+        std::vector<const Type*> data_;     // each reads buffer
+        Shape                    points_;   // axis indexes of each non zero, back to back
+        Type*                    out_;
+    };
+
+    void list(Shape& points) const
+    {
+        // the sparse reads non zeros as they are now
+        const Tensor<Type>& tensor = reads_[sparse_.read_].tensor_;
+        const Shape&        shape  = TensorUtils<Type>::shape(tensor);
+        const Type*         data   = TensorUtils<Type>::data(tensor).data();
+        for (std::size_t at = 0; at < tensor.size(); ++at)
+        {
+            if (data[at] == Type(0)) continue;
+
+            std::size_t start = points.size();
+            points.resize(start + shape.size());
+            for (std::size_t axis = shape.size(), rest = at; axis-- > 0; rest /= shape[axis])
+                points[start + axis] = rest % shape[axis];
+        }
+    }
+
+    bool deltasHold(const Shape& idx) const
+    {
+        for (const std::pair<int,int>& delta : deltas_)
+        {
+            if (idx[delta.first] != idx[delta.second]) return false;
+        }
+        return true;
+    }
+
+    void body(Walk& walk) const
+    {
+        if (not deltasHold(walk.idx_)) return;
+
+        Type prod = 1;
+        for (std::size_t f = 0; f < reads_.size(); ++f)
+            prod *= walk.data_[f][walk.offsets_[f]];
+        walk.out_[walk.offsets_[reads_.size()]] += prod;
+    }
+
+    bool point(std::size_t at, Walk& walk) const
+    {
+        // set the sparse loops from one non zero.. false if a loop used on two
+        // axes gets two different values or the split loop lands outside its rows
+        Shape& idx = walk.idx_;
+        const std::size_t rank = sparse_.loops_.size();
+        for (std::size_t axis = 0; axis < rank; ++axis)
+        {
+            int l = sparse_.loops_[axis];
+            for (std::size_t before = 0; before < axis; ++before)
+                if (sparse_.loops_[before] == l and idx[l] != walk.points_[at + axis])
+                    return false;
+            idx[l] = walk.points_[at + axis];
+        }
+        return walk.split_ < 0 or not walk.pinned_[walk.split_] or
+               (idx[walk.split_] >= walk.from_ and idx[walk.split_] < walk.to_);
+    }
+
+    void step(std::size_t depth, Walk& walk) const
+    {
+        Shape& idx = walk.idx_;
+        if (depth == extent_.size())
+        {
+            body(walk);
+            return;
+        }
+
+        if (depth == walk.driver_)
+        {
+            const std::size_t rank = sparse_.loops_.size();
+            for (std::size_t at = 0; at < walk.points_.size(); at += rank)
+                if (point(at, walk))
+                    span(depth, idx[depth], idx[depth] + 1, walk);
+            return;
+        }
+
+        std::size_t lo = 0;
+        std::size_t hi = extent_[depth];
+        if (walk.pinned_[depth])
+        {
+            lo = idx[depth];
+            hi = lo + 1;
+        }
+        if (static_cast<int>(depth) == walk.split_)
+        {
+            lo = std::max(lo, walk.from_);
+            hi = std::min(hi, walk.to_);
+        }
+
+        for (const Band& band : bands_)
+        {
+            // clip against the other end if it is already set.. outer or
+            // pinned by a sparse point we are under
+            int at    = static_cast<int>(depth);
+            int other = band.first_  == at ? band.second_
+                      : band.second_ == at ? band.first_
+                      : -1;
+            if (other < 0 or other == at or
+                not (other < at or (walk.pinned_[other] and walk.driver_ < depth)))
+                continue;
+            std::size_t near = idx[other];
+            lo = std::max(lo, near > band.width_ ? near - band.width_ : 0);
+            hi = std::min(hi, near + band.width_ + 1);
+        }
+
+        span(depth, lo, std::max(lo, hi), walk);
+    }
+
+    void span(std::size_t depth,
+              std::size_t lo,
+              std::size_t hi,
+              Walk& walk) const
+    {
+        Shape&            offsets = walk.offsets_;
+        const std::size_t outSlot = reads_.size();
+        for (std::size_t f = 0; f < reads_.size(); ++f)
+            offsets[f] += lo * reads_[f].stride_[depth];
+        offsets[outSlot] += lo * outStride_[depth];
+
+        for (std::size_t i = lo; i < hi; ++i)
+        {
+            walk.idx_[depth] = i;
+            step(depth+1, walk);
+
+            for (std::size_t f = 0; f < reads_.size(); ++f)
+                offsets[f] += reads_[f].stride_[depth];
+            offsets[outSlot] += outStride_[depth];
+        }
+
+        // rewind this level
+        for (std::size_t f = 0; f < reads_.size(); ++f)
+            offsets[f] -= hi * reads_[f].stride_[depth];
+        offsets[outSlot] -= hi * outStride_[depth];
+    }
+};
+
+// ################################################
+// ################################################
+// ################################################
+
+struct Schedule
+{
+    // a loop order (outer most first, as loop indexes of the nest it was made
+    // for) and a tile per loop. a loop with tile < extent is strip mined: the
+    // tile steps go out in front of every point loop in the same order
+    std::vector<int>         order_;
+    std::vector<std::size_t> tiles_;
+
+    template <typename Type>
+    LoopNest<Type> apply(const LoopNest<Type>& nest) const
+    {
+        LoopNest<Type> out = nest;
+        out.extent_.clear();
+        out.outStride_.clear();
+        for (typename LoopNest<Type>::Read& read : out.reads_)
+            read.stride_.clear();
+
+        std::vector<int> point(order_.size());
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            // tile loops then point loops
+            for (int l : order_)
+            {
+                std::size_t tile = tiles_[l];
+                bool        tiled = tile < nest.extent_[l];
+                if (pass == 0 and not tiled)
+                    continue;
+
+                std::size_t scale = (pass == 0) ? tile : 1;
+                if (pass == 1) point[l] = out.extent_.size();
+
+                out.extent_.push_back(pass == 0 ? nest.extent_[l] / tile : tile);
+                out.outStride_.push_back(scale * nest.outStride_[l]);
+                for (std::size_t r = 0; r < out.reads_.size(); ++r)
+                    out.reads_[r].stride_.push_back(scale * nest.reads_[r].stride_[l]);
+            }
+        }
+
+        // deltas, bands and sparse loops are never tiled so their point loop
+        // is the whole index
+        for (std::pair<int,int>& delta : out.deltas_)
+            delta = std::make_pair(point[delta.first], point[delta.second]);
+        for (typename LoopNest<Type>::Band& band : out.bands_)
+        {
+            band.first_  = point[band.first_];
+            band.second_ = point[band.second_];
+        }
+        for (int& l : out.sparse_.loops_)
+            l = point[l];
+        return out;
+    }
+};
+
+template <typename Type>
+class LoopScheduler
+{
+    // picks the loop order and tiles for a LoopNest from its strides.
+    //
+    // order: each loop is scored by how far it jumps through memory, an
+    // operand with stride 1 costs 1, 0 (the loop doesnt move it) costs
+    // nothing and anything else costs a whole cache line. the cheapest loop
+    // goes inner most so the hot loop streams (and can vectorize), the rest
+    // by cost outwards. ties keep the original order
+    //
+    // tiles: the box of data the point loops touch (summed over operands, only
+    // counting the loops each one moves on) is shrunk until it fits the cache
+    // by halving the biggest tile, down to a divisor of the extent. the inner
+    // most loop is kept at least a line long and loops tied by a delta, band or
+    // sparse factor are left whole.
+    //
+    // tune() times the candidates (this one, the original order, each loop
+    // inner most, and the tiles at half and twice the cache) and remembers the
+    // winner per shape signature
+public:
+    typedef typename Tensor<Type>::Shape Shape;
+
+private:
+    std::size_t                     cache_;   // bytes
+    std::size_t                     line_;    // bytes
+    std::map<std::string, Schedule> tuned_;
+    std::size_t                     timed_;
+
+    std::size_t lineElems() const { return std::max<std::size_t>(1, line_ / sizeof(Type)); }
+
+    std::size_t cost(const LoopNest<Type>& nest, int l) const
+    {
+        std::size_t total = 0;
+        std::size_t stride = nest.outStride_[l];
+        total += (stride == 0) ? 0 : (stride == 1) ? 1 : lineElems();
+        for (const typename LoopNest<Type>::Read& read : nest.reads_)
+        {
+            stride = read.stride_[l];
+            total += (stride == 0) ? 0 : (stride == 1) ? 1 : lineElems();
+        }
+        return total;
+    }
+
+    static std::size_t footprint(const LoopNest<Type>& nest, const std::vector<std::size_t>& tiles)
+    {
+        std::size_t total = 0;
+        std::size_t box   = 1;
+        for (std::size_t l = 0; l < tiles.size(); ++l)
+            if (nest.outStride_[l] != 0) box *= tiles[l];
+        total += box;
+
+        for (const typename LoopNest<Type>::Read& read : nest.reads_)
+        {
+            box = 1;
+            for (std::size_t l = 0; l < tiles.size(); ++l)
+                if (read.stride_[l] != 0) box *= tiles[l];
+            total += box;
+        }
+        return total;
+    }
+
+    static std::size_t divisorBelow(std::size_t extent, std::size_t limit)
+    {
+        for (std::size_t d = std::min(extent, limit); d > 1; --d)
+            if (extent % d == 0) return d;
+        return 1;
+    }
+
+    std::vector<std::size_t> tiles(const LoopNest<Type>& nest,
+                                   const std::vector<int>& order,
+                                   std::size_t cache) const
+    {
+        const std::size_t loops = nest.extent_.size();
+        std::vector<std::size_t> tiles(nest.extent_.begin(), nest.extent_.end());
+        if (loops == 0)
+            return tiles;
+
+        std::vector<bool> fixed(loops, false);
+        for (const std::pair<int,int>& delta : nest.deltas_)
+            fixed[delta.first] = fixed[delta.second] = true;
+        for (const typename LoopNest<Type>::Band& band : nest.bands_)
+            fixed[band.first_] = fixed[band.second_] = true;
+        for (int l : nest.sparse_.loops_)
+            fixed[l] = true;
+
+        const int         inner    = order.back();
+        const std::size_t capacity = std::max<std::size_t>(1, cache / sizeof(Type));
+        while (footprint(nest, tiles) > capacity)
+        {
+            int pick = -1;
+            for (std::size_t l = 0; l < loops; ++l)
+            {
+                std::size_t floor = (static_cast<int>(l) == inner) ? lineElems() : 1;
+                if (fixed[l] or tiles[l] / 2 < floor)
+                    continue;
+                if (pick < 0 or tiles[l] > tiles[pick])
+                    pick = l;
+            }
+            if (pick < 0)
+                break;
+
+            std::size_t smaller = divisorBelow(nest.extent_[pick], tiles[pick] / 2);
+            if (smaller == tiles[pick])
+                break;
+            tiles[pick] = smaller;
+        }
+        return tiles;
+    }
+
+    std::vector<int> order(const LoopNest<Type>& nest, int inner) const
+    {
+        std::vector<int> order;
+        for (std::size_t l = 0; l < nest.extent_.size(); ++l)
+            if (static_cast<int>(l) != inner) order.push_back(l);
+
+        std::stable_sort(order.begin(), order.end(),
+                         [&](int x, int y) { return cost(nest, x) > cost(nest, y); });
+
+        if (inner >= 0)
+            order.push_back(inner);
+        return order;
+    }
+
+    double time(const LoopNest<Type>& nest, const Schedule& schedule, std::size_t runs)
+    {
+        LoopNest<Type>    trial = schedule.apply(nest);
+        std::vector<Type> out(elements(nest.outShape_));
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (std::size_t r = 0; r < runs; ++r)
+            trial.run(out.data(), out.size());
+        ++timed_;
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    static std::size_t elements(const Shape& shape)
+    {
+        std::size_t count = 1;
+        for (std::size_t len : shape) count *= len;
+        return count;
+    }
+
+public:
+    LoopScheduler(std::size_t cache = 32*1024,
+                  std::size_t line  = 64) :
+        cache_(cache),
+        line_(line),
+        tuned_(),
+        timed_(0)
+    {}
+
+    Schedule choose(const LoopNest<Type>& nest) const
+    {
+        // the inner most loop is the cheapest.. the longest if its a tie
+        int inner = -1;
+        for (std::size_t l = 0; l < nest.extent_.size(); ++l)
+        {
+            if (inner < 0 or
+                cost(nest, l) < cost(nest, inner) or
+                (cost(nest, l) == cost(nest, inner) and nest.extent_[l] > nest.extent_[inner]))
+                inner = l;
+        }
+
+        Schedule schedule;
+        schedule.order_ = order(nest, inner);
+        schedule.tiles_ = tiles(nest, schedule.order_, cache_);
+        return schedule;
+    }
+
+    static std::string signature(const LoopNest<Type>& nest)
+    {
+        std::stringstream ss;
+        ss << sizeof(Type) << ':' << join(nest.extent_, ",") << ':' << join(nest.outStride_, ",");
+        for (const typename LoopNest<Type>::Read& read : nest.reads_)
+            ss << ':' << join(read.stride_, ",");
+        for (const std::pair<int,int>& delta : nest.deltas_)
+            ss << ':' << delta.first << '=' << delta.second;
+        for (const typename LoopNest<Type>::Band& band : nest.bands_)
+            ss << ':' << band.first_ << '~' << band.second_ << '/' << band.width_;
+        if (nest.sparse_.read_ >= 0)
+            ss << ":sparse" << nest.sparse_.read_ << '/' << join(nest.sparse_.loops_, ",")
+               << '/' << nest.nonzeros();
+        return ss.str();
+    }
+
+    Schedule tune(const LoopNest<Type>& nest, std::size_t runs = 3)
+    {
+        std::string key = signature(nest);
+        std::map<std::string, Schedule>::const_iterator tit = tuned_.find(key);
+        if (tit != tuned_.end())
+            return tit->second;
+
+        std::vector<Schedule> candidates(1, choose(nest));
+
+        Schedule original;
+        for (std::size_t l = 0; l < nest.extent_.size(); ++l)
+            original.order_.push_back(l);
+        original.tiles_.assign(nest.extent_.begin(), nest.extent_.end());
+        candidates.push_back(original);
+
+        for (std::size_t l = 0; l < nest.extent_.size(); ++l)
+        {
+            Schedule inner;
+            inner.order_ = order(nest, l);
+            inner.tiles_ = tiles(nest, inner.order_, cache_);
+            candidates.push_back(inner);
+        }
+
+        const std::vector<int> best = candidates[0].order_;
+        for (std::size_t cache : { cache_ / 2, cache_ * 2, std::size_t(-1) })
+        {
+            Schedule sized;
+            sized.order_ = best;
+            sized.tiles_ = tiles(nest, best, cache);
+            candidates.push_back(sized);
+        }
+
+        std::size_t pick = 0;
+        double      fastest = 0;
+        for (std::size_t c = 0; c < candidates.size(); ++c)
+        {
+            double taken = time(nest, candidates[c], runs);
+            if (c == 0 or taken < fastest)
+            {
+                pick    = c;
+                fastest = taken;
+            }
+        }
+
+        tuned_[key] = candidates[pick];
+        return candidates[pick];
+    }
+
+    // shape signatures remembered and schedules timed so far
+    std::size_t tuned() const { return tuned_.size(); }
+    std::size_t timed() const { return timed_; }
+};
+
+// ################################################
+// ################################################
+// ################################################
+
+template <typename Type>
+struct Lowered
+{
+    // a compiled LoopNest matched against the standard contraction patterns so
+    // it can run on the tuned kernels.. with two facters A and B and output C
+    // every loop is one of
+    //   batch: in A, B and C     M: in A and C     N: in B and C     K: in A and B
+    // the M, N and K loops are each fused into one strided dim (they need to
+    // be laid out back to back) and the batch loops are walked around a Gemm.
+    // anything else (deltas, 3+ factors, indexes only one side sums away..)
+    // stays on the generated loops
+    typedef typename Tensor<Type>::Shape Shape;
+
+    enum Pattern
+    {
+        AsLoops,
+        AsElementwise,
+        AsOuter,
+        AsGemv,
+        AsGemm,
+        AsBatched
+    };
+
+    Pattern        pattern_;
+    LoopNest<Type> nest_;
+
+    std::size_t    M_, N_, K_;
+    std::size_t    aRow_, aCol_;
+    std::size_t    bRow_, bCol_;
+    std::size_t    cRow_, cCol_;
+
+    std::vector<int> batch_;   // loops walked around the gemm
+
+    Lowered() :
+        pattern_(AsLoops),
+        nest_(),
+        M_(1), N_(1), K_(1),
+        aRow_(0), aCol_(0),
+        bRow_(0), bCol_(0),
+        cRow_(0), cCol_(0),
+        batch_()
+    {}
+
+    static Lowered of(const LoopNest<Type>& nest)
+    {
+        Lowered lowered;
+        lowered.nest_ = nest;
+
+        if (not nest.deltas_.empty() or nest.structured() or nest.reads_.size() != 2)
+            return lowered;
+
+        const Shape& a = nest.reads_[0].stride_;
+        const Shape& b = nest.reads_[1].stride_;
+        const Shape& c = nest.outStride_;
+
+        std::vector<int> mLoops, nLoops, kLoops;
+        for (std::size_t l = 0; l < nest.extent_.size(); ++l)
+        {
+            if (nest.extent_[l] == 1)
+                continue;
+
+            bool inA = a[l] != 0;
+            bool inB = b[l] != 0;
+            bool inC = c[l] != 0;
+            if      (inA and inB and inC)         lowered.batch_.push_back(l);
+            else if (inA and not inB and inC)     mLoops.push_back(l);
+            else if (not inA and inB and inC)     nLoops.push_back(l);
+            else if (inA and inB and not inC)     kLoops.push_back(l);
+            else                                  return lowered;
+        }
+
+        if (mLoops.empty() and nLoops.empty() and kLoops.empty())
+        {
+            if (not lowered.batch_.empty() and elementwise(nest))
+                lowered.pattern_ = AsElementwise;
+            return lowered;
+        }
+
+        if (not fuse(nest, mLoops, c, a, lowered.M_, lowered.cRow_, lowered.aRow_) or
+            not fuse(nest, nLoops, c, b, lowered.N_, lowered.cCol_, lowered.bCol_) or
+            not fuse(nest, kLoops, a, b, lowered.K_, lowered.aCol_, lowered.bRow_))
+            return lowered;
+
+        if (not lowered.batch_.empty())
+            lowered.pattern_ = AsBatched;
+        else if (kLoops.empty())
+            lowered.pattern_ = (mLoops.empty() or nLoops.empty()) ? AsLoops : AsOuter;
+        else if (mLoops.empty() or nLoops.empty())
+            lowered.pattern_ = AsGemv;
+        else
+            lowered.pattern_ = AsGemm;
+        return lowered;
+    }
+
+    std::size_t rows() const
+    {
+        // the parts run can cut the output into.. the gemms are cut by M rows
+        // (N columns for a row vector) like a Contract, the rest by whatever
+        // the nest or the elements allow
+        switch (pattern_)
+        {
+        case AsLoops:       return nest_.rows();
+        case AsElementwise: return elements(nest_.outShape_);
+        default:            return M_ > 1 ? M_ : N_;
+        }
+    }
+
+    void run(Tensor<Type>& out) const
+    {
+        run(out, 0, 1);
+    }
+
+    // part of parts.. each writes its own share of out
+    void run(Tensor<Type>& out, std::size_t part, std::size_t parts) const
+    {
+        Type*       c    = TensorUtils<Type>::data(out).data();
+        std::size_t rows = this->rows();
+        std::size_t from = rows * part / parts;
+        std::size_t to   = rows * (part + 1) / parts;
+        switch (pattern_)
+        {
+        case AsLoops:
+            nest_.run(c, out.size(), from, to);
+            break;
+
+        case AsElementwise:
+        {
+            const Type* a = data(0);
+            const Type* b = data(1);
+            for (std::size_t i = from; i < to; ++i)
+                c[i] = TensorUtils<Type>::Helpers::mul(a[i], b[i]);
+            break;
+        }
+
+        case AsBatched:
+            batched(0, data(0), data(1), c, from, to);
+            break;
+
+        default:
+            gemm(data(0), data(1), c, from, to);
+            break;
+        }
+    }
+
+private:
+    const Type* data(std::size_t read) const
+    {
+        return TensorUtils<Type>::data(nest_.reads_[read].tensor_).data();
+    }
+
+    static bool fuse(const LoopNest<Type>& nest,
+                     std::vector<int> loops,
+                     const Shape& first,
+                     const Shape& second,
+                     std::size_t& extent,
+                     std::size_t& firstStride,
+                     std::size_t& secondStride)
+    {
+        // the loops must sit back to back (same order) in both tensors
+        extent       = 1;
+        firstStride  = 0;
+        secondStride = 0;
+        if (loops.empty())
+            return true;
+
+        std::sort(loops.begin(), loops.end(),
+                  [&first](int x, int y) { return first[x] > first[y]; });
+
+        for (std::size_t t = 0; t + 1 < loops.size(); ++t)
+        {
+            std::size_t inner = nest.extent_[loops[t+1]];
+            if (first[loops[t]]  != first[loops[t+1]]  * inner or
+                second[loops[t]] != second[loops[t+1]] * inner)
+                return false;
+        }
+
+        for (int loop : loops)
+            extent *= nest.extent_[loop];
+        firstStride  = first[loops.back()];
+        secondStride = second[loops.back()];
+        return true;
+    }
+
+    static bool elementwise(const LoopNest<Type>& nest)
+    {
+        // both factors laid out exactly like the output
+        const Shape& out = nest.outShape_;
+        for (const typename LoopNest<Type>::Read& read : nest.reads_)
+        {
+            if (TensorUtils<Type>::shape(read.tensor_) != out or
+                read.stride_ != nest.outStride_)
+                return false;
+        }
+        return true;
+    }
+
+    void gemm(const Type* a, const Type* b, Type* c, std::size_t from, std::size_t to) const
+    {
+        // rows [from, to) of M.. or columns of N when M is 1
+        if (M_ > 1)
+            Gemm<Type>::run(to - from, N_, K_,
+                            a + from * aRow_, aRow_, aCol_,
+                            b,                bRow_, bCol_,
+                            c + from * cRow_, cRow_, cCol_);
+        else
+            Gemm<Type>::run(M_, to - from, K_,
+                            a,                aRow_, aCol_,
+                            b + from * bCol_, bRow_, bCol_,
+                            c + from * cCol_, cRow_, cCol_);
+    }
+
+    void batched(std::size_t depth,
+                 const Type* a,
+                 const Type* b,
+                 Type* c,
+                 std::size_t from,
+                 std::size_t to) const
+    {
+        if (depth == batch_.size())
+        {
+            gemm(a, b, c, from, to);
+            return;
+        }
+
+        int loop = batch_[depth];
+        for (std::size_t i = 0; i < nest_.extent_[loop]; ++i)
+        {
+            batched(depth + 1,
+                    a + i * nest_.reads_[0].stride_[loop],
+                    b + i * nest_.reads_[1].stride_[loop],
+                    c + i * nest_.outStride_[loop],
+                    from,
+                    to);
+        }
+    }
+
+    static std::size_t elements(const Shape& shape)
+    {
+        std::size_t count = 1;
+        for (std::size_t len : shape) count *= len;
+        return count;
+    }
+};
+
+// ################################################
+// ################################################
+// ################################################
+
+template <typename Type>
+class Plan
+{
+    // a graph cut into steps (see Executor::plan) with every intermediate
+    // placed in one preallocated arena.
+    //
+    // each buffer lives from the step that writes it to the last step that
+    // reads it. buffers are placed biggest first at the lowest offset that
+    // doesnt overlap anything already placed that is alive at the same time
+    // (interval colouring) so the arena is close to the real working set
+    // instead of the sum of everything. a Scale whose input dies at that step
+    // writes straight over it (inPlace_).
+    //
+    // once built, run() only allocates the index scratch of the plain loop
+    // nests.. the results are views on the arena that the next run
+    // overwrites. run(threads) spreads the steps over a TaskGraph instead
+public:
+    typedef typename Tensor<Type>::Shape Shape;
+
+    enum Op
+    {
+        View,       // a bound tensor used as is
+        Kernel,     // a lowered loop nest
+        Contract,   // TensorUtils dot of two steps
+        Scale       // a scaler step times a tensor step
+    };
+
+    struct Step
+    {
+        Op            op_;
+        int           left_;      // input steps.. -1 if none
+        int           right_;
+        Lowered<Type> kernel_;
+        Shape         shape_;
+        int           buffer_;    // -1 for a View
+        bool          inPlace_;
+        Tensor<Type>  out_;
+    };
+
+    struct Buffer
+    {
+        std::size_t size_;
+        int         first_;     // step that writes it
+        int         last_;      // last step that reads it
+        std::size_t offset_;
+    };
+
+    std::vector<Step>                   steps_;
+    std::vector<int>                    outputs_;   // steps the caller gets back
+    std::vector<Buffer>                 buffers_;
+    std::shared_ptr<std::vector<Type> > arena_;
+    std::size_t                         naive_;   // elements with a buffer per step and no reuse
+
+    Plan() :
+        steps_(),
+        outputs_(),
+        buffers_(),
+        arena_(),
+        naive_(0)
+    {}
+
+    const Tensor<Type>& output(std::size_t i) const { return steps_[outputs_[i]].out_; }
+
+    // arena elements.. the planned peak memory
+    std::size_t peak() const { return arena_ ? arena_->size() : 0; }
+
+    std::size_t iterations() const
+    {
+        std::size_t count = 0;
+        for (const Step& step : steps_)
+        {
+            if (step.op_ == Kernel)
+                count += step.kernel_.nest_.iterations();
+            else if (step.op_ == Contract)
+                count += steps_[step.left_].out_.size() *
+                         (steps_[step.right_].out_.size() / steps_[step.right_].shape_.front());
+            else if (step.op_ == Scale)
+                count += step.out_.size();
+        }
+        return count;
+    }
+
+    void allocate()
+    {
+        // lifetimes.. the results live to the end
+        std::vector<int> lastUse(steps_.size(), -1);
+        for (std::size_t s = 0; s < steps_.size(); ++s)
+        {
+            if (steps_[s].left_  >= 0) lastUse[steps_[s].left_]  = s;
+            if (steps_[s].right_ >= 0) lastUse[steps_[s].right_] = s;
+        }
+        for (int out : outputs_)
+            lastUse[out] = steps_.size();
+
+        buffers_.clear();
+        naive_ = 0;
+        for (std::size_t s = 0; s < steps_.size(); ++s)
+        {
+            Step& step = steps_[s];
+            step.buffer_  = -1;
+            step.inPlace_ = false;
+            if (step.op_ == View)
+                continue;
+
+            std::size_t size = elements(step.shape_);
+            naive_ += size;
+
+            if (step.op_ == Scale)
+            {
+                const Step& input = steps_[step.right_];
+                if (input.buffer_ >= 0 and lastUse[step.right_] == static_cast<int>(s))
+                {
+                    step.buffer_  = input.buffer_;
+                    step.inPlace_ = true;
+                    buffers_[step.buffer_].last_ = lastUse[s];
+                    continue;
+                }
+            }
+
+            Buffer buffer = { size, static_cast<int>(s), lastUse[s], 0 };
+            buffers_.push_back(buffer);
+            step.buffer_ = buffers_.size() - 1;
+        }
+
+        std::size_t total = colour();
+        arena_.reset(new std::vector<Type>(total));
+
+        for (Step& step : steps_)
+        {
+            if (step.buffer_ >= 0)
+                step.out_ = Tensor<Type>(step.shape_,
+                                         arena_->data() + buffers_[step.buffer_].offset_,
+                                         arena_);
+        }
+    }
+
+    const Tensor<Type>& run()
+    {
+        for (Step& step : steps_)
+        {
+            switch (step.op_)
+            {
+            case View:
+                break;
+
+            case Kernel:
+                step.kernel_.run(step.out_);
+                break;
+
+            case Contract:
+                TensorUtils<Type>::dot_into(step.out_,
+                                            steps_[step.left_].out_,
+                                            steps_[step.right_].out_);
+                break;
+
+            case Scale:
+                TensorUtils<Type>::bifunctor_scaler_into(step.out_,
+                                                         &TensorUtils<Type>::Helpers::mul,
+                                                         TensorUtils<Type>::data(steps_[step.left_].out_)[0],
+                                                         steps_[step.right_].out_);
+                break;
+            }
+        }
+        return output(0);
+    }
+
+    const Tensor<Type>& run(std::size_t threads, std::size_t grain = 1 << 15)
+    {
+        // each step waits on the last writer of what it reads and, for the
+        // arena space it writes, on the last writer and the readers since then
+        // of every buffer there.. the colouring only promised no overlap in
+        // step order. steps over grain multiply adds are cut into row tiles so
+        // one big node still fills the cores
+        TaskGraph graph;
+        std::vector<std::size_t>               finish(steps_.size(), 0);
+        std::vector<int>                       writer(buffers_.size(), -1);
+        std::vector<std::vector<int> >         readers(buffers_.size());
+        const std::vector<std::vector<int> >   shared = overlaps();
+        std::vector<int>                       after;
+        for (std::size_t s = 0; s < steps_.size(); ++s)
+        {
+            const Step& step = steps_[s];
+            if (step.op_ == View)
+                continue;
+
+            std::size_t count = tilesOf(step, grain);
+            std::vector<std::size_t> tiles;
+            for (std::size_t t = 0; t < count; ++t)
+                tiles.push_back(graph.add([this, s, t, count]() { tile(steps_[s], t, count); }));
+
+            after.clear();
+            for (int input : { step.left_, step.right_ })
+                if (input >= 0 and steps_[input].buffer_ >= 0 and writer[steps_[input].buffer_] >= 0)
+                    after.push_back(writer[steps_[input].buffer_]);
+            for (int other : shared[step.buffer_])
+            {
+                if (writer[other] >= 0)
+                    after.push_back(writer[other]);
+                after.insert(after.end(), readers[other].begin(), readers[other].end());
+                readers[other].clear();
+            }
+            std::sort(after.begin(), after.end());
+            after.erase(std::unique(after.begin(), after.end()), after.end());
+            for (int before : after)
+                for (std::size_t task : tiles)
+                    graph.depends(task, finish[before]);
+
+            writer[step.buffer_] = s;
+            for (int input : { step.left_, step.right_ })
+                if (input >= 0 and steps_[input].buffer_ >= 0 and steps_[input].buffer_ != step.buffer_)
+                    readers[steps_[input].buffer_].push_back(s);
+
+            if (count == 1)
+            {
+                finish[s] = tiles[0];
+                continue;
+            }
+
+            finish[s] = graph.add([]() {});
+            for (std::size_t task : tiles)
+                graph.depends(finish[s], task);
+        }
+
+        graph.run(threads);
+        return output(0);
+    }
+
+private:
+    std::vector<std::vector<int> > overlaps() const
+    {
+        // per buffer the buffers sharing any of its arena space, itself too..
+        // a sweep in offset order so only the real pairs are looked at
+        std::vector<std::vector<int> > shared(buffers_.size());
+        std::vector<int> order;
+        for (std::size_t b = 0; b < buffers_.size(); ++b)
+        {
+            shared[b].push_back(b);
+            if (buffers_[b].size_ != 0)
+                order.push_back(b);
+        }
+        std::sort(order.begin(), order.end(),
+                  [this](int x, int y) { return buffers_[x].offset_ < buffers_[y].offset_; });
+
+        for (std::size_t i = 0; i < order.size(); ++i)
+        {
+            const Buffer& first = buffers_[order[i]];
+            for (std::size_t j = i + 1; j < order.size(); ++j)
+            {
+                if (buffers_[order[j]].offset_ >= first.offset_ + first.size_)
+                    break;
+                shared[order[i]].push_back(order[j]);
+                shared[order[j]].push_back(order[i]);
+            }
+        }
+        return shared;
+    }
+
+    std::size_t tilesOf(const Step& step, std::size_t grain) const
+    {
+        std::size_t rows = 1;
+        std::size_t work = 0;
+        if (step.op_ == Kernel)
+        {
+            rows = step.kernel_.rows();
+            work = step.kernel_.nest_.iterations();
+        }
+        else if (step.op_ == Contract)
+        {
+            const Shape& left = steps_[step.left_].shape_;
+            rows = elements(left) / left.back();
+            work = elements(left) * elements(steps_[step.right_].shape_) / left.back();
+        }
+        else if (step.op_ == Scale)
+        {
+            rows = elements(step.shape_);
+            work = rows;
+        }
+        return std::max<std::size_t>(1, std::min(rows, work / std::max<std::size_t>(grain, 1)));
+    }
+
+    void tile(Step& step, std::size_t t, std::size_t count)
+    {
+        switch (step.op_)
+        {
+        case View:
+            break;
+
+        case Kernel:
+            step.kernel_.run(step.out_, t, count);
+            break;
+
+        case Contract:
+        {
+            // rows of the left side against all of the right
+            const Step& left  = steps_[step.left_];
+            const Step& right = steps_[step.right_];
+            std::size_t K    = left.shape_.back();
+            std::size_t M    = elements(left.shape_) / K;
+            std::size_t N    = elements(right.shape_) / K;
+            std::size_t from = M * t / count;
+            std::size_t to   = M * (t + 1) / count;
+
+            Gemm<Type>::run(to - from, N, K,
+                            TensorUtils<Type>::data(left.out_).data() + from*K, K, 1,
+                            TensorUtils<Type>::data(right.out_).data(),        N, 1,
+                            TensorUtils<Type>::data(step.out_).data() + from*N, N, 1,
+                            Type(0));
+            break;
+        }
+
+        case Scale:
+        {
+            const Type  scaler = TensorUtils<Type>::data(steps_[step.left_].out_)[0];
+            const Type* in     = TensorUtils<Type>::data(steps_[step.right_].out_).data();
+            Type*       out    = TensorUtils<Type>::data(step.out_).data();
+            std::size_t size   = step.out_.size();
+            for (std::size_t i = size * t / count; i < size * (t + 1) / count; ++i)
+                out[i] = TensorUtils<Type>::Helpers::mul(scaler, in[i]);
+            break;
+        }
+        }
+    }
+
+    static std::size_t elements(const Shape& shape)
+    {
+        std::size_t count = 1;
+        for (std::size_t len : shape) count *= len;
+        return count;
+    }
+
+    std::size_t colour()
+    {
+        // biggest first.. each at the lowest offset clear of its live neighbours
+        std::vector<int> order(buffers_.size());
+        for (std::size_t b = 0; b < order.size(); ++b) order[b] = b;
+        std::stable_sort(order.begin(), order.end(),
+                         [this](int x, int y) { return buffers_[x].size_ > buffers_[y].size_; });
+
+        std::size_t      total = 0;
+        std::vector<int> placed;
+        for (int b : order)
+        {
+            Buffer& buffer = buffers_[b];
+
+            std::vector<std::pair<std::size_t, std::size_t> > taken;
+            for (int other : placed)
+            {
+                const Buffer& them = buffers_[other];
+                if (them.first_ <= buffer.last_ and buffer.first_ <= them.last_)
+                    taken.push_back(std::make_pair(them.offset_, them.offset_ + them.size_));
+            }
+            std::sort(taken.begin(), taken.end());
+
+            std::size_t offset = 0;
+            for (const std::pair<std::size_t, std::size_t>& range : taken)
+            {
+                if (offset + buffer.size_ <= range.first)
+                    break;
+                offset = std::max(offset, range.second);
+            }
+
+            buffer.offset_ = offset;
+            total = std::max(total, offset + buffer.size_);
+            placed.push_back(b);
+        }
+        return total;
+    }
+};
+
+// ################################################
+// ################################################
+// ################################################
+
+template <typename Type>
+class Executor
+{
+    // binds Element names to tensors and Var names to sizes then runs graphs
+public:
+    typedef typename Tensor<Type>::Shape Shape;
+
+private:
+    std::map<std::string, Tensor<Type> >         tensors_;
+    std::map<std::string, std::size_t>           sizes_;
+    std::size_t                                  iterations_;
+    std::vector<typename Lowered<Type>::Pattern>   patterns_;
+    std::size_t                                  threads_;
+    LoopScheduler<Type>*                         scheduler_;
+    bool                                         tune_;
+
+    static Shape stridesOf(const Shape& shape)
+    {
+        Shape stride(shape.size(), 1);
+        for (int r = static_cast<int>(shape.size()) - 2; r >= 0; --r)
+            stride[r] = stride[r+1] * shape[r+1];
+        return stride;
+    }
+
+    void sizeVar(std::map<std::string, std::size_t>& sizes,
+                 const std::string& var,
+                 std::size_t len) const
+    {
+        std::map<std::string, std::size_t>::iterator sit = sizes.find(var);
+        if (sit == sizes.end())
+        {
+            sizes[var] = len;
+        }
+        else if (sit->second != len)
+        {
+            std::stringstream ss;
+            ss << "Graph index " << var << " has conflicting sizes "
+               << sit->second << " and " << len;
+            throw std::runtime_error(ss.str());
+        }
+    }
+
+    int loopOf(const Contraction& form, const std::string& var) const
+    {
+        Contraction::Names::const_iterator lit = std::find(form.loops_.begin(), form.loops_.end(), var);
+        if (lit == form.loops_.end())
+        {
+            std::stringstream ss;
+            ss << "Graph index " << var << " is not bound by a summer";
+            throw std::runtime_error(ss.str());
+        }
+        return lit - form.loops_.begin();
+    }
+
+public:
+    Executor() :
+        tensors_(),
+        sizes_(),
+        iterations_(0),
+        patterns_(),
+        threads_(1),
+        scheduler_(0),
+        tune_(false)
+    {}
+
+    Executor& bind(const std::string& name,
+                   const Tensor<Type>& tensor)
+    {
+        tensors_[name] = tensor;
+        return *this;
+    }
+
+    Executor& size(const std::string& var,
+                   std::size_t len)
+    {
+        sizes_[var] = len;
+        return *this;
+    }
+
+    const std::map<std::string, Tensor<Type> >& tensors() const { return tensors_; }
+    const std::map<std::string, std::size_t>&    sizes()   const { return sizes_; }
+
+    // the tensor bound to name.. throws if there isnt one
+    const Tensor<Type>& tensor(const std::string& name) const
+    {
+        typename std::map<std::string, Tensor<Type> >::const_iterator tit = tensors_.find(name);
+        if (tit == tensors_.end())
+        {
+            std::stringstream ss;
+            ss << "Graph element " << name << " is not bound";
+            throw std::runtime_error(ss.str());
+        }
+        return tit->second;
+    }
+
+    // loop body evaluations (multiply adds for dot steps) done by the last run
+    std::size_t iterations() const { return iterations_; }
+
+    LoopNest<Type> compile(const Contraction& form) const
+    {
+        LoopNest<Type> nest;
+
+        for (std::size_t l = 0; l < form.loops_.size(); ++l)
+        {
+            if (std::count(form.loops_.begin(), form.loops_.end(), form.loops_[l]) != 1)
+            {
+                std::stringstream ss;
+                ss << "Graph index " << form.loops_[l] << " is bound by more than one summer";
+                throw std::runtime_error(ss.str());
+            }
+        }
+
+        // sizes.. explicit ones first then whatever the bound tensors imply
+        std::map<std::string, std::size_t> sizes = sizes_;
+        for (const Contraction::Factor& factor : form.factors_)
+        {
+            const Shape& shape = TensorUtils<Type>::shape(tensor(factor.name_));
+            if (shape.size() != factor.vars_.size())
+            {
+                std::stringstream ss;
+                ss << "Graph element " << factor.name_ << " has " << factor.vars_.size()
+                   << " indexes but is bound to shape " << join(shape, "x");
+                throw std::runtime_error(ss.str());
+            }
+            for (std::size_t axis = 0; axis < shape.size(); ++axis)
+                sizeVar(sizes, factor.vars_[axis], shape[axis]);
+        }
+
+        for (const std::string& var : form.loops_)
+        {
+            if (sizes.find(var) == sizes.end())
+            {
+                std::stringstream ss;
+                ss << "Graph index " << var << " has no size";
+                throw std::runtime_error(ss.str());
+            }
+            nest.extent_.push_back(sizes[var]);
+        }
+
+        for (const Contraction::Factor& factor : form.factors_)
+        {
+            const Tensor<Type>& bound  = tensor(factor.name_);
+            Shape               stride = stridesOf(TensorUtils<Type>::shape(bound));
+
+            typename LoopNest<Type>::Read read;
+            read.name_   = factor.name_;
+            read.tensor_ = bound;
+            read.stride_.assign(form.loops_.size(), 0);
+            for (std::size_t axis = 0; axis < factor.vars_.size(); ++axis)
+                read.stride_[loopOf(form, factor.vars_[axis])] += stride[axis];
+            nest.reads_.push_back(read);
+        }
+
+        for (const std::string& var : form.basis_)
+            nest.outShape_.push_back(sizes[var]);
+        Shape outStride = stridesOf(nest.outShape_);
+        nest.outStride_.assign(form.loops_.size(), 0);
+        for (std::size_t axis = 0; axis < form.basis_.size(); ++axis)
+            nest.outStride_[loopOf(form, form.basis_[axis])] += outStride[axis];
+        if (nest.outShape_.empty()) nest.outShape_.push_back(1);
+
+        for (const std::pair<std::string,std::string>& delta : form.deltas_)
+        {
+            int first  = loopOf(form, delta.first);
+            int second = loopOf(form, delta.second);
+            if (nest.extent_[first] != nest.extent_[second])
+            {
+                std::stringstream ss;
+                ss << "Graph delta joins indexes of different sizes "
+                   << delta.first  << ": " << nest.extent_[first] << " "
+                   << delta.second << ": " << nest.extent_[second];
+                throw std::runtime_error(ss.str());
+            }
+            nest.deltas_.push_back(std::make_pair(first, second));
+        }
+
+        // structure.. a banded (or still folded diagonal) factor keeps its two
+        // loops close and the first sparse factor drives its loops from its
+        // non zero pattern, read each time the nest runs
+        for (std::size_t f = 0; f < form.factors_.size(); ++f)
+        {
+            const Contraction::Factor& factor = form.factors_[f];
+            if (factor.form_ == FormBanded or factor.form_ == FormDiagonal)
+            {
+                typename LoopNest<Type>::Band band;
+                band.first_  = loopOf(form, factor.vars_[0]);
+                band.second_ = loopOf(form, factor.vars_[1]);
+                band.width_  = factor.form_ == FormBanded ? factor.band_ : 0;
+                nest.bands_.push_back(band);
+            }
+            else if (factor.form_ == FormSparse and
+                     nest.sparse_.read_ < 0 and
+                     not factor.vars_.empty())
+            {
+                std::vector<int> loops;
+                for (const std::string& var : factor.vars_)
+                    loops.push_back(loopOf(form, var));
+                nest.index(f, loops);
+            }
+        }
+
+        return nest;
+    }
+
+    Lowered<Type> lower(const Handle& exp) const
+    {
+        // only nests left on the plain loops are rescheduled.. the kernels
+        // have their own blocking
+        Lowered<Type> kernel = Lowered<Type>::of(compile(Flatten::of(exp)));
+        if (scheduler_ and kernel.pattern_ == Lowered<Type>::AsLoops)
+        {
+            Schedule schedule = tune_ ? scheduler_->tune(kernel.nest_)
+                                      : scheduler_->choose(kernel.nest_);
+            kernel.nest_ = schedule.apply(kernel.nest_);
+        }
+        return kernel;
+    }
+
+    // reorder and tile the plain loop nests.. timing the candidates if tune
+    Executor& schedule(LoopScheduler<Type>& scheduler, bool tune = false)
+    {
+        scheduler_ = &scheduler;
+        tune_      = tune;
+        return *this;
+    }
+
+    // the kernel each loop step of the last run was lowered to
+    const std::vector<typename Lowered<Type>::Pattern>& patterns() const { return patterns_; }
+
+    // workers for run.. 0 is one per core, 1 runs the plan in order
+    Executor& threads(std::size_t count)
+    {
+        threads_ = count;
+        return *this;
+    }
+
+    Plan<Type> plan(const Nodes& outputs) const
+    {
+        // steps in run order.. a closed Dot becomes a Contract of its sides, a
+        // closed Mult by a scaler a Scale and the rest a lowered loop nest.
+        // shared subgraphs (within or across the outputs) are one step
+        Plan<Type> plan;
+        std::unordered_map<const Node*, int> done;
+        Outlines                             outlines;
+        for (const Handle& exp : outputs)
+        {
+            int out = step(plan, exp, done, outlines);
+
+            // a result must not be a bound tensor the caller could then scribble on
+            if (plan.steps_[out].op_ == Plan<Type>::View)
+                plan.steps_[out].op_ = Plan<Type>::Kernel;
+            plan.outputs_.push_back(out);
+        }
+
+        plan.allocate();
+        return plan;
+    }
+
+    Plan<Type> plan(const Handle& exp) const
+    {
+        return plan(Nodes(1, exp));
+    }
+
+    std::vector<Tensor<Type> > run(const Nodes& outputs)
+    {
+        Plan<Type> steps = plan(outputs);
+        if (threads_ == 1)
+            steps.run();
+        else
+            steps.run(threads_);
+
+        iterations_ = steps.iterations();
+        patterns_.clear();
+        for (const typename Plan<Type>::Step& step : steps.steps_)
+            if (step.op_ == Plan<Type>::Kernel)
+                patterns_.push_back(step.kernel_.pattern_);
+
+        std::vector<Tensor<Type> > results;
+        for (std::size_t i = 0; i < outputs.size(); ++i)
+            results.push_back(steps.output(i));
+        return results;
+    }
+
+    Tensor<Type> run(const Handle& exp)
+    {
+        return run(Nodes(1, exp))[0];
+    }
+
+private:
+    struct Outline
+    {
+        // what step needs of a node's Contraction.. its basis (each axis
+        // marked once a summer inside the node sums it) and the factor
+        // indexes nothing inside it sums, sorted. closed if neither is left
+        typedef std::pair<std::string, bool> Axis;
+
+        std::vector<Axis>   basis_;
+        Contraction::Names  free_;
+
+        bool closed() const
+        {
+            if (not free_.empty()) return false;
+            for (const Axis& axis : basis_)
+                if (not axis.second) return false;
+            return true;
+        }
+    };
+
+    typedef std::unordered_map<const Node*, Outline> Outlines;
+
+    static const std::string& varOf(const Handle& idx)
+    {
+        if (is<Var>(idx))
+            return static_cast<const Var*>(idx.get())->name_;
+        throw std::runtime_error("Graph index is not a Var");
+    }
+
+    static void outline(const Handle& top, Outlines& outlines)
+    {
+        // bottom up so each node is looked at once however many Dots above
+        // it ask.. the children are done before the node comes back off
+        std::vector<std::pair<const Node*, bool> > stack(1, std::make_pair(top.get(), false));
+        while (not stack.empty())
+        {
+            const Node* node = stack.back().first;
+            bool        kids = stack.back().second;
+            if (outlines.count(node))
+            {
+                stack.pop_back();
+                continue;
+            }
+
+            if (not kids and (node->kind_ == KindSummer or
+                              node->kind_ == KindMult or
+                              node->kind_ == KindDot))
+            {
+                stack.back().second = true;
+                for (std::size_t c = node->children_.size(); c-- > 0; )
+                    if (not is<Var>(node->children_[c]))
+                        stack.push_back(std::make_pair(node->children_[c].get(), false));
+                continue;
+            }
+            stack.pop_back();
+
+            Outline made;
+            const Nodes& children = node->children_;
+            switch (node->kind_)
+            {
+            case KindVar:
+            {
+                std::stringstream ss;
+                ss << "Graph index " << static_cast<const Var*>(node)->name_ << " used as an expression";
+                throw std::runtime_error(ss.str());
+            }
+
+            case KindUnitVec:
+                made.basis_.push_back(typename Outline::Axis(varOf(children[0]), false));
+                break;
+
+            case KindElement:
+                for (const Handle& idx : children)
+                    made.free_.push_back(varOf(idx));
+                std::sort(made.free_.begin(), made.free_.end());
+                made.free_.erase(std::unique(made.free_.begin(), made.free_.end()), made.free_.end());
+                break;
+
+            case KindSummer:
+            {
+                const std::string& var = varOf(children[0]);
+                made = outlines[children[1].get()];
+                Contraction::Names::iterator fit =
+                    std::lower_bound(made.free_.begin(), made.free_.end(), var);
+                if (fit != made.free_.end() and *fit == var)
+                    made.free_.erase(fit);
+                for (typename Outline::Axis& axis : made.basis_)
+                    if (axis.first == var) axis.second = true;
+                break;
+            }
+
+            case KindMult:
+            case KindDot:
+            {
+                const Outline& left  = outlines[children[0].get()];
+                const Outline& right = outlines[children[1].get()];
+                std::set_union(left.free_.begin(),  left.free_.end(),
+                               right.free_.begin(), right.free_.end(),
+                               std::back_inserter(made.free_));
+                made.basis_ = left.basis_;
+                std::size_t split = made.basis_.size();
+                made.basis_.insert(made.basis_.end(), right.basis_.begin(), right.basis_.end());
+                if (node->kind_ == KindDot)
+                {
+                    // the last axis on the left meets the first on the right
+                    if (split == 0 or split == made.basis_.size())
+                        throw std::runtime_error("Graph dot has no unit vectors to contract");
+                    made.basis_.erase(made.basis_.begin() + split - 1,
+                                      made.basis_.begin() + split + 1);
+                }
+                break;
+            }
+
+            case KindDelta:
+                break;
+            }
+            outlines[node] = made;
+        }
+    }
+
+    static bool identity(const Lowered<Type>& kernel)
+    {
+        // a single bound tensor read straight out in its own layout
+        const LoopNest<Type>& nest = kernel.nest_;
+        return nest.reads_.size() == 1 and
+               nest.deltas_.empty() and
+               nest.reads_[0].stride_ == nest.outStride_ and
+               TensorUtils<Type>::shape(nest.reads_[0].tensor_) == nest.outShape_;
+    }
+
+    int add(Plan<Type>& plan,
+            typename Plan<Type>::Op op,
+            int left,
+            int right,
+            const Shape& shape) const
+    {
+        typename Plan<Type>::Step step;
+        step.op_      = op;
+        step.left_    = left;
+        step.right_   = right;
+        step.shape_   = shape;
+        step.buffer_  = -1;
+        step.inPlace_ = false;
+        plan.steps_.push_back(step);
+        return plan.steps_.size() - 1;
+    }
+
+    struct Pending
+    {
+        Handle                  exp_;
+        bool                    ready_;        // its sides have steps
+        typename Plan<Type>::Op op_;           // Contract or Scale once ready
+        bool                    leftScaler_;
+        std::string             leftIndex_;    // the joined indexes.. for the error
+        std::string             rightIndex_;
+    };
+
+    int step(Plan<Type>& plan,
+             const Handle& top,
+             std::unordered_map<const Node*, int>& done,
+             Outlines& outlines) const
+    {
+        // a split Dot or Mult comes back off the stack once both its sides
+        // have steps.. an explicit stack so a long chain cant blow the real one
+        Pending first = { top, false, Plan<Type>::Kernel, false, "", "" };
+        std::vector<Pending> stack(1, first);
+        while (not stack.empty())
+        {
+            Pending pending = stack.back();
+            const Handle& exp = pending.exp_;
+            if (done.count(exp.get()))
+            {
+                stack.pop_back();
+                continue;
+            }
+
+            if (pending.ready_ and pending.op_ == Plan<Type>::Contract)
+            {
+                stack.pop_back();
+                int left  = done[exp->children_[0].get()];
+                int right = done[exp->children_[1].get()];
+
+                const Shape leftShape  = plan.steps_[left].shape_;
+                const Shape rightShape = plan.steps_[right].shape_;
+                if (leftShape.back() != rightShape.front())
+                {
+                    std::stringstream ss;
+                    ss << "Graph delta joins indexes of different sizes "
+                       << pending.leftIndex_  << ": " << leftShape.back() << " "
+                       << pending.rightIndex_ << ": " << rightShape.front();
+                    throw std::runtime_error(ss.str());
+                }
+
+                Shape shape(leftShape.begin(), leftShape.end() - 1);
+                shape.insert(shape.end(), rightShape.begin() + 1, rightShape.end());
+                if (shape.empty()) shape.push_back(1);
+
+                done[exp.get()] = add(plan, Plan<Type>::Contract, left, right, shape);
+                continue;
+            }
+
+            if (pending.ready_)
+            {
+                // scaler times tensor.. the scaler goes on the left
+                stack.pop_back();
+                int scaler = done[exp->children_[pending.leftScaler_ ? 0 : 1].get()];
+                int tensor = done[exp->children_[pending.leftScaler_ ? 1 : 0].get()];
+                done[exp.get()] = add(plan, Plan<Type>::Scale, scaler, tensor, plan.steps_[tensor].shape_);
+                continue;
+            }
+
+            bool split = is<Dot>(exp) or is<Mult>(exp);
+            if (split) outline(exp, outlines);
+            const Outline* leftForm  = split ? &outlines[exp->children_[0].get()] : 0;
+            const Outline* rightForm = split ? &outlines[exp->children_[1].get()] : 0;
+            split = split and leftForm->closed() and rightForm->closed();
+
+            if (split and is<Dot>(exp) and
+                not leftForm->basis_.empty() and
+                not rightForm->basis_.empty())
+            {
+                // the sides come off the stack left first
+                Pending& ready = stack.back();
+                ready.ready_      = true;
+                ready.op_         = Plan<Type>::Contract;
+                ready.leftIndex_  = leftForm->basis_.back().first;
+                ready.rightIndex_ = rightForm->basis_.front().first;
+                Pending right = { exp->children_[1], false, Plan<Type>::Kernel, false, "", "" };
+                Pending left  = { exp->children_[0], false, Plan<Type>::Kernel, false, "", "" };
+                stack.push_back(right);
+                stack.push_back(left);
+            }
+            else if (split and is<Mult>(exp) and
+                     leftForm->basis_.empty() != rightForm->basis_.empty())
+            {
+                bool leftScaler = leftForm->basis_.empty();
+                Pending& ready = stack.back();
+                ready.ready_      = true;
+                ready.op_         = Plan<Type>::Scale;
+                ready.leftScaler_ = leftScaler;
+                Pending tensor = { exp->children_[leftScaler ? 1 : 0], false, Plan<Type>::Kernel, false, "", "" };
+                Pending scaler = { exp->children_[leftScaler ? 0 : 1], false, Plan<Type>::Kernel, false, "", "" };
+                stack.push_back(tensor);
+                stack.push_back(scaler);
+            }
+            else
+            {
+                stack.pop_back();
+                Lowered<Type> kernel = lower(exp);
+                int at = add(plan, identity(kernel) ? Plan<Type>::View : Plan<Type>::Kernel,
+                             -1, -1, kernel.nest_.outShape_);
+
+                typename Plan<Type>::Step& made = plan.steps_[at];
+                made.kernel_ = kernel;
+                if (made.op_ == Plan<Type>::View)
+                    made.out_ = kernel.nest_.reads_[0].tensor_;
+                done[exp.get()] = at;
+            }
+        }
+        return done[top.get()];
+    }
+};
+
+#endif
@@ -0,0 +1,548 @@
+#include "SummerExec.hh"
+
+#include "test.hh"
+#include "test.summer.hh"
+
+#include <atomic>
+#include <new>
+
+// count heap traffic so the planned runs can be shown allocation free
+std::atomic<std::size_t> allocations(0);
+
+void* operator new(std::size_t size)
+{
+    ++allocations;
+    if (void* ptr = std::malloc(size)) return ptr;
+    throw std::bad_alloc();
+}
+
+// stable_sort takes its scratch from the nothrow form
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    ++allocations;
+    return std::malloc(size);
+}
+
+void operator delete(void* ptr) noexcept              { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+
+void testExecute()
+{
+    Tensor<int> xData({3}, {1,2,3});
+    Tensor<int> mData({3,4},
+                      {1,2,3,4,
+                       5,6,7,8,
+                       9,10,11,12});
+
+    Executor<int> exec;
+    exec.bind("x", xData)
+        .bind("m", mData);
+
+    // a tensor on its own is just itself
+    EXPECT_EQ(mData, exec.run(Make::tensor("m", {"i","j"})));
+    EXPECT_EQ(12u, exec.iterations());
+
+    Handle l = Make::dot(Make::tensor("x", {"k"}),
+                         Make::tensor("m", {"i","j"}));
+
+    Tensor<int> expXM = TensorUtils<int>::dot(xData, mData);
+    EXPECT_EQ(expXM, exec.run(l));
+
+    l = rewrite(l);
+    EXPECT_STREAMED_AS("sum_k(sum_i(sum_j(U_k.U_i*U_j*x_k*m_ij)))") << l;
+    EXPECT_EQ(expXM, exec.run(l));
+    EXPECT_EQ(36u, exec.iterations());
+
+    // delta elimination drops the k loop.. O(n^3) down to the O(n^2) gemv
+    l = reduce(l);
+    EXPECT_STREAMED_AS("sum_i(sum_j(U_j*x_i*m_ij))") << l;
+    EXPECT_EQ(expXM, exec.run(l));
+    EXPECT_EQ(12u, exec.iterations());
+
+    // contracting both axes of m gives a scaler
+    Tensor<int> yData({4}, {1,0,0,1});
+    exec.bind("y", yData);
+    Handle s = Make::dot(Make::dot(Make::tensor("x", {"k"}),
+                                   Make::tensor("m", {"i","j"})),
+                         Make::tensor("y", {"l"}));
+    EXPECT_EQ(Tensor<int>({1}, {38+56}), exec.run(s));
+
+    EXPECT_THROW(exec.run(Make::tensor("q", {"i"})), "Graph element q is not bound");
+    EXPECT_THROW(exec.run(Make::dot(Make::tensor("m", {"i","j"}),
+                                    Make::tensor("x", {"k"}))),
+                 "Graph delta joins indexes of different sizes j: 4 k: 3");
+
+    // a long product flattens without recursing per factor
+    Handle q(new Var("q"));
+    Handle deep(new Element("x", {q}));
+    for (int i = 1; i < 1000000; ++i)
+        deep = Handle(new Mult(Handle(new Element("x", {q})), deep));
+    Contraction form = Flatten::of(deep);
+    EXPECT_EQ(1000000u, form.factors_.size());
+}
+
+typedef Lowered<int> Kernel;
+
+void checkLowered(const Executor<int>& exec,
+                  const Handle& exp,
+                  Kernel::Pattern pattern)
+{
+    // the kernel has to agree with the plain loops
+    Kernel kernel = exec.lower(exp);
+    EXPECT_EQ(pattern, kernel.pattern_);
+
+    Tensor<int> fast(kernel.nest_.outShape_);
+    Tensor<int> slow(kernel.nest_.outShape_);
+    kernel.run(fast);
+    kernel.nest_.run(TensorUtils<int>::data(slow).data(), slow.size());
+    EXPECT_EQ(slow, fast);
+}
+
+Handle element(const std::string& name, const std::initializer_list<Handle> idx)
+{
+    return Handle(new Element(name, idx));
+}
+
+Handle sum(const Handle& idx, const Handle& exp)
+{
+    return Handle(new Summer(idx, exp));
+}
+
+Handle mult(const Handle& left, const Handle& right)
+{
+    return Handle(new Mult(left, right));
+}
+
+Handle unit(const Handle& idx)
+{
+    return Handle(new UnitVec(idx));
+}
+
+void testLower()
+{
+    Tensor<int> mData({3,4}, {1,2,3,4, 5,6,7,8, 9,10,11,12});
+    Tensor<int> nData({4,2}, {1,2, 3,4, 5,6, 7,8});
+
+    Executor<int> exec;
+    exec.bind("x", Tensor<int>({3}, {1,2,3}))
+        .bind("y", Tensor<int>({4}, {4,3,2,1}))
+        .bind("m", mData)
+        .bind("n", nData)
+        .bind("p", Tensor<int>({3,4}, {2,0,1,3, 1,1,2,0, 0,3,1,2}))
+        .bind("s", Tensor<int>({2,3,4}, {1,2,3,4, 5,6,7,8, 9,10,11,12,
+                                         2,1,0,1, 2,1,0,1, 2,1,0,1}))
+        .bind("t", Tensor<int>({2,4,2}, {1,0, 0,1, 1,1, 2,0,
+                                         3,1, 1,3, 0,2, 2,2}));
+
+    Handle b(new Var("b"));
+    Handle i(new Var("i"));
+    Handle j(new Var("j"));
+    Handle k(new Var("k"));
+
+    // x.m after the rewrites.. sum_i(sum_j(U_j*x_i*m_ij))
+    Handle xm = reduce(rewrite(Make::dot(Make::tensor("x", {"k"}),
+                                         Make::tensor("m", {"i","j"}))));
+    checkLowered(exec, xm, Kernel::AsGemv);
+    exec.run(xm);
+    EXPECT_EQ(1u, exec.patterns().size());
+    EXPECT_EQ(Kernel::AsGemv, exec.patterns()[0]);
+
+    Handle mn = reduce(rewrite(Make::dot(Make::tensor("m", {"i","j"}),
+                                         Make::tensor("n", {"k","l"}))));
+    checkLowered(exec, mn, Kernel::AsGemm);
+    EXPECT_EQ(TensorUtils<int>::dot(mData, nData), exec.run(mn));
+
+    Handle outer = mult(element("x", {i}), element("y", {j}));
+    checkLowered(exec, sum(i, sum(j, mult(unit(i), mult(unit(j), outer)))),
+                 Kernel::AsOuter);
+
+    Handle same = mult(element("m", {i,j}), element("p", {i,j}));
+    checkLowered(exec, sum(i, sum(j, mult(unit(i), mult(unit(j), same)))),
+                 Kernel::AsElementwise);
+
+    // sum_j(s_bij * t_bjk) for each b
+    Handle batch = mult(element("s", {b,i,j}), element("t", {b,j,k}));
+    checkLowered(exec, sum(b, sum(i, sum(j, sum(k, mult(unit(b), mult(unit(i), mult(unit(k), batch))))))),
+                 Kernel::AsBatched);
+
+    // i is summed away inside m alone.. no kernel for that
+    Handle partial = mult(element("m", {i,j}), element("y", {j}));
+    checkLowered(exec, sum(i, sum(j, mult(unit(j), partial))),
+                 Kernel::AsLoops);
+}
+
+Tensor<int> filled(const Tensor<int>::Shape& shape, int start)
+{
+    Tensor<int> t(shape);
+    TensorUtils<int>::Data& data = TensorUtils<int>::data(t);
+    for (std::size_t i = 0; i < data.size(); ++i)
+        data[i] = start + i % 7;
+    return t;
+}
+
+void testSchedule()
+{
+    Tensor<int> mData = filled({16,16}, 1);
+    Tensor<int> xData = filled({16}, 2);
+
+    Executor<int> exec;
+    exec.bind("m", mData)
+        .bind("x", xData);
+
+    Handle i(new Var("i"));
+    Handle j(new Var("j"));
+
+    // sum over j outside i.. m_ij is walked down its columns
+    Handle colSums = sum(j, sum(i, mult(unit(i), element("m", {i,j}))));
+    Tensor<int> expected = exec.run(colSums);
+
+    LoopNest<int> nest = exec.lower(colSums).nest_;
+    EXPECT_EQ(1u, nest.reads_[0].stride_[0]);
+    EXPECT_EQ(16u, nest.reads_[0].stride_[1]);
+
+    // j moves m by one and the output not at all so it goes inner most
+    LoopScheduler<int> scheduler;
+    Schedule schedule = scheduler.choose(nest);
+    EXPECT_EQ("1,0,", join(schedule.order_, ","));
+    EXPECT_EQ("16,16,", join(schedule.tiles_, ","));
+
+    LoopNest<int> swapped = schedule.apply(nest);
+    EXPECT_EQ(1u, swapped.reads_[0].stride_[1]);
+    EXPECT_EQ(nest.iterations(), swapped.iterations());
+
+    exec.schedule(scheduler);
+    EXPECT_EQ(expected, exec.run(colSums));
+
+    // a 64 element cache cant hold m.. both loops get strip mined
+    LoopScheduler<int> small(64*sizeof(int), 4*sizeof(int));
+    schedule = small.choose(nest);
+    EXPECT_EQ(true, (schedule.tiles_[0] < 16 and schedule.tiles_[1] < 16));
+    EXPECT_EQ(true, (schedule.tiles_[0] >= 4));
+    LoopNest<int> tiled = schedule.apply(nest);
+    EXPECT_EQ(4u, tiled.extent_.size());
+    EXPECT_EQ(nest.iterations(), tiled.iterations());
+
+    exec.schedule(small);
+    EXPECT_EQ(expected, exec.run(colSums));
+
+    // loops tied by a delta are reordered but never tiled
+    Handle xm = rewrite(Make::dot(Make::tensor("x", {"k"}),
+                                  Make::tensor("m", {"i","j"})));
+    EXPECT_EQ(TensorUtils<int>::dot(xData, mData), exec.run(xm));
+
+    // tuning times the candidates once per shape signature
+    LoopScheduler<int> tuner;
+    tuner.tune(nest);
+    std::size_t timed = tuner.timed();
+    EXPECT_EQ(true, (timed > 2u));
+    Executor<int> plain;
+    plain.bind("m", mData);
+    tuner.tune(plain.lower(sum(j, sum(i, mult(unit(i), element("m", {i,j}))))).nest_);
+    EXPECT_EQ(1u, tuner.tuned());
+
+    exec.schedule(tuner, true);
+    EXPECT_EQ(expected, exec.run(colSums));
+    EXPECT_EQ(1u, tuner.tuned());
+    EXPECT_EQ(timed, tuner.timed());
+}
+
+Tensor<int> banded(std::size_t n, std::size_t width)
+{
+    // zero outside the band.. the structure is only a promise about the data
+    Tensor<int> t = filled({n,n}, 1);
+    TensorUtils<int>::Data& data = TensorUtils<int>::data(t);
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t j = 0; j < n; ++j)
+            if ((i > j ? i - j : j - i) > width) data[i*n + j] = 0;
+    return t;
+}
+
+void testStructure()
+{
+    Tensor<int> xData = filled({8}, 2);
+    Tensor<int> mData = filled({8,8}, 1);
+    Tensor<int> sData({8,8});
+    TensorUtils<int>::data(sData)[3]  = 5;
+    TensorUtils<int>::data(sData)[17] = -2;
+    TensorUtils<int>::data(sData)[63] = 7;
+
+    Executor<int> exec;
+    exec.bind("x", xData)
+        .bind("m", mData)
+        .bind("b", banded(8, 1))
+        .bind("d", banded(8, 0))
+        .bind("s", sData);
+
+    // x.b with b tridiagonal.. the j loop only walks the band
+    Handle dense = reduce(rewrite(Make::dot(Make::tensor("x", {"k"}),
+                                            Make::tensor("b", {"i","j"}))));
+    Tensor<int> expected = exec.run(dense);
+    EXPECT_EQ(64u, exec.iterations());
+
+    Handle band = reduce(rewrite(Make::dot(Make::tensor("x", {"k"}),
+                                           Make::tensor("b", {"i","j"}, {}, FormBanded, 1))));
+    EXPECT_EQ(expected, exec.run(band));
+    EXPECT_EQ(22u, exec.iterations());
+    EXPECT_EQ(1u, exec.patterns().size());
+    EXPECT_EQ(Lowered<int>::AsLoops, exec.patterns()[0]);
+
+    // the band follows the loops when they are reordered
+    LoopScheduler<int> scheduler;
+    LoopNest<int> nest = exec.lower(band).nest_;
+    Schedule swap;
+    swap.order_ = {1, 0};
+    swap.tiles_ = {8, 8};
+    LoopNest<int> swapped = swap.apply(nest);
+    EXPECT_EQ(1, swapped.bands_[0].first_);
+    std::vector<int> out(8);
+    swapped.run(out.data(), out.size());
+    EXPECT_EQ(expected, Tensor<int>({8}, out.data(), out.data() + out.size()));
+    EXPECT_EQ("8,8,", join(scheduler.choose(nest).tiles_, ","));
+
+    // a diagonal is a band of width 0.. or a delta once it is folded
+    Handle diag = reduce(rewrite(Make::dot(Make::tensor("x", {"k"}),
+                                           Make::tensor("d", {"i","j"}, {}, FormDiagonal))));
+    expected = TensorUtils<int>::dot(xData, banded(8, 0));
+    EXPECT_EQ(expected, exec.run(diag));
+    EXPECT_EQ(8u, exec.iterations());
+
+    TransformAll<DiagonalToDelta> diagonals;
+    Handle folded = reduce(diagonals.process(rewrite(Make::dot(Make::tensor("x", {"k"}),
+                                                               Make::tensor("d", {"i","j"}, {}, FormDiagonal)))));
+    EXPECT_STREAMED_AS("sum_j(U_j*x_j*d_jj)") << folded;
+    EXPECT_EQ(expected, exec.run(folded));
+    EXPECT_EQ(8u, exec.iterations());
+
+    // x.s and m.s with s sparse.. only its three non zeros are visited
+    Handle sparse = reduce(rewrite(Make::dot(Make::tensor("x", {"k"}),
+                                             Make::tensor("s", {"i","j"}, {}, FormSparse))));
+    EXPECT_EQ(TensorUtils<int>::dot(xData, sData), exec.run(sparse));
+    EXPECT_EQ(3u, exec.iterations());
+
+    Handle ms = reduce(rewrite(Make::dot(Make::tensor("m", {"i","j"}),
+                                         Make::tensor("s", {"k","l"}, {}, FormSparse))));
+    EXPECT_EQ(TensorUtils<int>::dot(mData, sData), exec.run(ms));
+    EXPECT_EQ(24u, exec.iterations());
+
+    // the pattern is read as the nest runs so new data is picked up
+    TensorUtils<int>::data(sData)[63] = 0;
+    TensorUtils<int>::data(sData)[8]  = 1;
+    TensorUtils<int>::data(sData)[9]  = 1;
+    EXPECT_EQ(TensorUtils<int>::dot(mData, sData), exec.run(ms));
+    EXPECT_EQ(32u, exec.iterations());
+
+    // a sparse band.. the band clips whatever the points leave
+    exec.schedule(scheduler);
+    Handle both = reduce(rewrite(Make::dot(Make::tensor("s", {"i","j"}, {}, FormSparse),
+                                           Make::tensor("b", {"k","l"}, {}, FormBanded, 1))));
+    EXPECT_EQ(TensorUtils<int>::dot(sData, banded(8, 1)), exec.run(both));
+
+    // .. by a plan thats kept and run again too
+    Tensor<int> tData({2,2}, {1,0,0,0});
+    Executor<int> kept;
+    kept.bind("t", tData)
+        .bind("x", Tensor<int>({2}, {1,1}));
+    Plan<int> plan = kept.plan(optimise(Make::dot(Make::tensor("t", {"i","k"}, {}, FormSparse),
+                                                  Make::tensor("x", {"l"}))));
+    EXPECT_EQ(Tensor<int>({2}, {1,0}), plan.run());
+    TensorUtils<int>::data(tData)[3] = 5;
+    EXPECT_EQ(Tensor<int>({2}, {1,5}), plan.run());
+}
+
+void testPlan()
+{
+    Tensor<int> aData = filled({4,5}, 1);
+    Tensor<int> bData = filled({5,6}, 2);
+    Tensor<int> cData = filled({6,3}, 3);
+    Tensor<int> dData = filled({3,2}, 4);
+
+    Executor<int> exec;
+    exec.bind("A", aData)
+        .bind("B", bData)
+        .bind("C", cData)
+        .bind("D", dData)
+        .bind("x", Tensor<int>({3}, {1,2,3}))
+        .bind("y", Tensor<int>({3}, {3,2,1}));
+
+    Handle chain = Make::dot(Make::dot(Make::dot(Make::tensor("A", {"i","j"}),
+                                                 Make::tensor("B", {"k","l"})),
+                                       Make::tensor("C", {"m","n"})),
+                             Make::tensor("D", {"o","p"}));
+
+    Tensor<int> expected = TensorUtils<int>::dot(TensorUtils<int>::dot(TensorUtils<int>::dot(aData, bData),
+                                                                       cData),
+                                                 dData);
+
+    // A.B (24) is dead by the time the result (8) is written so they share
+    Plan<int> plan = exec.plan(chain);
+    EXPECT_EQ(7u, plan.steps_.size());
+    EXPECT_EQ(24u + 12u + 8u, plan.naive_);
+    EXPECT_EQ(24u + 12u, plan.peak());
+    EXPECT_EQ(expected, plan.run());
+    EXPECT_EQ(expected, exec.run(chain));
+
+    // after the first run the scratch is all in place.. no more allocation
+    std::size_t before = 0;
+    for (int step = 0; step < 4; ++step)
+    {
+        if (step == 1) before = allocations;
+        plan.run();
+    }
+    EXPECT_EQ(before, allocations);
+    EXPECT_EQ(expected, plan.run());
+
+    // a scaler times A.B writes over A.B as its the last use
+    Handle scaled = mult(Make::dot(Make::tensor("x", {"k"}),
+                                   Make::tensor("y", {"l"})),
+                         Make::dot(Make::tensor("A", {"i","j"}),
+                                   Make::tensor("B", {"k","l"})));
+    Tensor<int> ab = TensorUtils<int>::dot(aData, bData);
+    TensorUtils<int>::bifunctor_scaler_into(ab, &TensorUtils<int>::Helpers::mul, 3+4+3, ab);
+
+    plan = exec.plan(scaled);
+    EXPECT_EQ(Plan<int>::Scale, plan.steps_.back().op_);
+    EXPECT_EQ(true, plan.steps_.back().inPlace_);
+    EXPECT_EQ(1u + 24u, plan.peak());
+    EXPECT_EQ(ab, plan.run());
+    EXPECT_EQ(ab, exec.run(scaled));
+
+    // a long chain is planned off an explicit stack, one Contract per dot..
+    // each node is outlined once, not flattened again by every dot above it
+    const int length = 4000;
+    exec.bind("R", Tensor<int>({2,2}, {1,1, 0,1}));
+    Handle powers = Make::tensor("R", {"a0","b0"});
+    for (int t = 1; t < length; ++t)
+    {
+        std::string id = std::to_string(t);
+        powers = Make::dot(powers, Make::tensor("R", {"a" + id, "b" + id}));
+    }
+    plan = exec.plan(powers);
+    EXPECT_EQ(std::size_t(2 * length - 1), plan.steps_.size());
+    EXPECT_EQ(Tensor<int>({2,2}, {1,length, 0,1}), plan.run());
+
+    // kernels are allocation free too once warmed up
+    Handle xm = reduce(rewrite(Make::dot(Make::tensor("x", {"k"}),
+                                         Make::tensor("A", {"i","j"}))));
+    exec.bind("A", filled({3,5}, 1));
+    plan = exec.plan(xm);
+    plan.run();
+    before = allocations;
+    plan.run();
+    EXPECT_EQ(before, allocations);
+    EXPECT_EQ(TensorUtils<int>::dot(Tensor<int>({3}, {1,2,3}), filled({3,5}, 1)), plan.run());
+
+    // a plan holds on to what it was built against.. binding a new tensor to
+    // the name (and dropping the old one) cant leave it reading freed memory
+    Executor<int> rebound;
+    rebound.bind("x", Tensor<int>({3}, {1,2,3}))
+           .bind("m", filled({3,5}, 1));
+    plan = rebound.plan(optimise(::xm()));
+    rebound.bind("x", Tensor<int>({3}, {4,5,6}));
+    EXPECT_EQ(TensorUtils<int>::dot(Tensor<int>({3}, {1,2,3}), filled({3,5}, 1)), plan.run());
+}
+
+void testParallel()
+{
+    Tensor<int> aData = filled({40,30}, 1);
+    Tensor<int> bData = filled({30,50}, 2);
+    Tensor<int> cData = filled({50,20}, 3);
+
+    Executor<int> exec;
+    exec.bind("A", aData)
+        .bind("B", bData)
+        .bind("C", cData)
+        .bind("x", Tensor<int>({3}, {1,2,3}))
+        .bind("y", Tensor<int>({3}, {3,2,1}));
+
+    // three outputs sharing A.B with a scaler branch off to the side
+    Handle ab = Make::dot(Make::tensor("A", {"i","j"}),
+                          Make::tensor("B", {"k","l"}));
+    Handle xy = Make::dot(Make::tensor("x", {"m"}),
+                          Make::tensor("y", {"n"}));
+    Nodes outputs;
+    outputs.push_back(Make::dot(ab, Make::tensor("C", {"o","p"})));
+    outputs.push_back(mult(xy, ab));
+    outputs.push_back(Make::tensor("C", {"o","p"}));
+
+    Tensor<int> abData = TensorUtils<int>::dot(aData, bData);
+    Tensor<int> scaled(Tensor<int>::Shape({40,50}));
+    TensorUtils<int>::bifunctor_scaler_into(scaled, &TensorUtils<int>::Helpers::mul, 3+4+3, abData);
+
+    std::vector<Tensor<int> > serial = exec.run(outputs);
+    EXPECT_EQ(3u, serial.size());
+    EXPECT_EQ(TensorUtils<int>::dot(abData, cData), serial[0]);
+    EXPECT_EQ(scaled, serial[1]);
+    EXPECT_EQ(cData,  serial[2]);
+
+    // A.B is one step even though two outputs use it
+    Plan<int> plan = exec.plan(outputs);
+    EXPECT_EQ(3u, plan.outputs_.size());
+    EXPECT_EQ(1, static_cast<int>(std::count_if(plan.steps_.begin(), plan.steps_.end(),
+                                                [](const Plan<int>::Step& step)
+                                                { return step.op_ == Plan<int>::Contract and
+                                                         step.shape_ == Tensor<int>::Shape({40,50}); })));
+
+    // a tiny grain cuts every step into row tiles.. the answers dont move
+    for (int round = 0; round < 4; ++round)
+    {
+        plan.run(4, 64);
+        EXPECT_EQ(serial[0], plan.output(0));
+        EXPECT_EQ(serial[1], plan.output(1));
+        EXPECT_EQ(serial[2], plan.output(2));
+    }
+
+    exec.threads(0);
+    std::vector<Tensor<int> > parallel = exec.run(outputs);
+    EXPECT_EQ(serial[0], parallel[0]);
+    EXPECT_EQ(serial[1], parallel[1]);
+    EXPECT_EQ(serial[2], parallel[2]);
+
+    // kernels are cut into rows too.. a gemm, a gemv, plain loops and a
+    // sparse banded nest
+    exec.threads(1);
+    exec.bind("s", banded(30, 2))
+        .bind("b", banded(30, 1))
+        .bind("v", filled({50}, 1));
+    Nodes kernels;
+    kernels.push_back(optimise(Make::dot(Make::tensor("A", {"i","j"}),
+                                         Make::tensor("B", {"k","l"}))));
+    kernels.push_back(optimise(Make::dot(Make::tensor("B", {"k","l"}),
+                                         Make::tensor("C", {"o","p"}))));
+    kernels.push_back(rewrite(Make::dot(Make::tensor("A", {"i","j"}),
+                                        Make::tensor("s", {"k","l"}))));
+    kernels.push_back(optimise(Make::dot(Make::tensor("s", {"i","j"}, {}, FormSparse),
+                                         Make::tensor("b", {"k","l"}, {}, FormBanded, 1))));
+    kernels.push_back(optimise(Make::dot(Make::tensor("v", {"m"}),
+                                         Make::tensor("C", {"o","p"}))));
+    serial = exec.run(kernels);
+
+    plan = exec.plan(kernels);
+    for (int output : plan.outputs_)
+    {
+        if (plan.steps_[output].op_ == Plan<int>::Kernel)
+            EXPECT_EQ(true, (plan.steps_[output].kernel_.rows() > 1));
+    }
+    for (int round = 0; round < 4; ++round)
+    {
+        plan.run(4, 1);
+        for (std::size_t k = 0; k < kernels.size(); ++k)
+            EXPECT_EQ(serial[k], plan.output(k));
+    }
+}
+
+int main()
+{
+    try
+    {
+        testExecute();
+        testLower();
+        testSchedule();
+        testStructure();
+        testPlan();
+        testParallel();
+    }
+    catch (std::exception& e)
+    {
+        std::cout << "Opps... " << e.what() << "\n";
+    }
+}
@@ -0,0 +1,204 @@
+#ifndef SummerGrad_HH
+#define SummerGrad_HH
+
+#include "SummerRules.hh"
+
+#include <map>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <stdexcept>
+
+// reverse mode differentiation of summation graphs
+//
+// the graph is first put in normal form by the rewrite passes.. every summer
+// on top and under them a product of unit vectors and factors, with the unit
+// vector dots reduced away
+//
+//     sum_i(sum_j(x_i*m_ij*y_j))
+//
+// in that form the adjoint of a factor is just everything else in the
+// product. so the gradient for m_ij is the same summers over m's own basis
+// times the product with that factor taken out
+//
+//     sum_i(sum_j(U_i*U_j*x_i*y_j))
+//
+// one walk records where every factor is. a gradient term rebuilds only the
+// path from the top down to that factor (a node per level) and links in all
+// the other subtrees of the forward graph as they are, so the backward graph
+// shares the forward one instead of copying it.. and has exactly the loops of
+// the forward graph, so costs the same to run.
+//
+// a tensor read more than once gives a term per read, the gradient is their
+// sum (the product rule). for a non scalar graph the term is the jacobian laid
+// out with the basis of the tensor first and then the basis of the graph.
+//
+// note an index only the removed factor sized may need an Executor::size
+
+// ################################################
+// ################################################
+// ################################################
+
+class Gradient
+{
+    struct Slot
+    {
+        Handle parent_;
+        int    idx_;
+    };
+
+    typedef std::unordered_map<const Node*, Slot> Parents;
+
+    Handle                                      forward_;
+    Nodes                                       summers_;   // outer most first
+    Handle                                      body_;
+    Parents                                     parents_;
+    std::map<std::string, std::vector<Handle> > reads_;     // per tensor name
+
+    static Handle normalise(Handle exp)
+    {
+        TransformAll<ApplyRules<StandardRules> > rules;
+        exp = rules.process(exp);
+        TransformAll<UnitVecDotToDelta> dotsToDeltas;
+        exp = dotsToDeltas.process(exp);
+        TransformAll<ReduceDelta> reduceDeltas;
+        exp = reduceDeltas.process(exp);
+        return exp;
+    }
+
+    static Handle rebuild(const Handle& node, int idx, const Handle& kid)
+    {
+        // a copy of node with one kid swapped.. the other kids are shared
+        switch (node->kind_)
+        {
+        case KindMult:
+            return idx == 0 ? Handle(new Mult(kid, node->children_[1]))
+                            : Handle(new Mult(node->children_[0], kid));
+        case KindDot:
+            return idx == 0 ? Handle(new Dot(kid, node->children_[1]))
+                            : Handle(new Dot(node->children_[0], kid));
+        default:
+            throw std::runtime_error("Gradient found a factor outside of a product");
+        }
+    }
+
+    void walk()
+    {
+        // one pass over the body.. parent links and the reads of each tensor
+        Nodes stack(1, body_);
+        while (not stack.empty())
+        {
+            Handle node = stack.back();
+            stack.pop_back();
+
+            if (is<Element>(node))
+            {
+                reads_[static_cast<const Element*>(node.get())->name_].push_back(node);
+                continue;
+            }
+            if (is<Summer>(node))
+            {
+                std::stringstream ss;
+                ss << "Gradient needs the summers on top but found " << node;
+                throw std::runtime_error(ss.str());
+            }
+
+            for (int childIdx = node->children_.size(); childIdx-- > 0; )
+            {
+                const Handle& child = node->children_[childIdx];
+                Slot slot = { node, childIdx };
+                parents_[child.get()] = slot;
+                stack.push_back(child);
+            }
+        }
+    }
+
+    Handle term(const Handle& read) const
+    {
+        // the product without read.. its sibling takes the place of its Mult
+        // and the path above is rebuilt on top of that
+        Handle adjoint;
+        Parents::const_iterator pit = parents_.find(read.get());
+        if (pit != parents_.end())
+        {
+            Slot   slot = pit->second;
+            Handle up   = slot.parent_;
+            if (not is<Mult>(up))
+                throw std::runtime_error("Gradient found a factor outside of a product");
+
+            adjoint = up->children_[1 - slot.idx_];
+            for (pit = parents_.find(up.get()); pit != parents_.end(); pit = parents_.find(up.get()))
+            {
+                adjoint = rebuild(pit->second.parent_, pit->second.idx_, adjoint);
+                up      = pit->second.parent_;
+            }
+        }
+
+        // the basis of the tensor goes in front
+        const Nodes& idx = read->children_;
+        for (Nodes::const_reverse_iterator iit = idx.rbegin(); iit != idx.rend(); ++iit)
+        {
+            Handle uvec(new UnitVec(*iit));
+            adjoint = adjoint ? Handle(new Mult(uvec, adjoint)) : uvec;
+        }
+        if (not adjoint)
+            throw std::runtime_error("Gradient of a scaler by itself");
+
+        for (Nodes::const_reverse_iterator sit = summers_.rbegin(); sit != summers_.rend(); ++sit)
+            adjoint = Handle(new Summer((*sit)->children_[0], adjoint));
+        return adjoint;
+    }
+
+public:
+    // exp is rewritten in place (like the passes it runs) into forward()
+    Gradient(const Handle& exp) :
+        forward_(normalise(exp)),
+        summers_(),
+        body_(),
+        parents_(),
+        reads_()
+    {
+        body_ = forward_;
+        while (is<Summer>(body_))
+        {
+            summers_.push_back(body_);
+            body_ = body_->children_[1];
+        }
+        walk();
+    }
+
+    // the normal form the gradients are taken from
+    const Handle& forward() const { return forward_; }
+
+    // tensors the graph reads
+    std::vector<std::string> names() const
+    {
+        std::vector<std::string> names;
+        for (std::map<std::string, std::vector<Handle> >::const_iterator rit = reads_.begin();
+             rit != reads_.end();
+             ++rit)
+        {
+            names.push_back(rit->first);
+        }
+        return names;
+    }
+
+    // the gradient by tensor name.. a term per read to be summed
+    Nodes of(const std::string& name) const
+    {
+        std::map<std::string, std::vector<Handle> >::const_iterator rit = reads_.find(name);
+        if (rit == reads_.end())
+        {
+            std::stringstream ss;
+            ss << "Gradient by " << name << " which the graph doesnt read";
+            throw std::runtime_error(ss.str());
+        }
+
+        Nodes terms;
+        for (const Handle& read : rit->second)
+            terms.push_back(term(read));
+        return terms;
+    }
+};
+
+#endif
@@ -0,0 +1,103 @@
+#include "SummerGrad.hh"
+#include "SummerExec.hh"
+
+#include "test.hh"
+
+Handle xmy()
+{
+    return Make::dot(Make::dot(Make::tensor("x", {"k"}),
+                               Make::tensor("m", {"i","j"})),
+                     Make::tensor("y", {"l"}));
+}
+
+Tensor<int> total(Executor<int>& exec, const Nodes& terms)
+{
+    // the product rule.. the gradient is the sum of the terms
+    std::vector<Tensor<int> > parts = exec.run(terms);
+    Tensor<int> sum = parts[0];
+    for (std::size_t t = 1; t < parts.size(); ++t)
+        sum = TensorUtils<int>::bifunctor(TensorUtils<int>::Helpers::add, sum, parts[t]);
+    return sum;
+}
+
+void testGradient()
+{
+    Tensor<int> xData({3}, {1,2,3});
+    Tensor<int> mData({3,2}, {1,2, 3,4, 5,6});
+    Tensor<int> yData({2}, {1,-1});
+
+    Executor<int> exec;
+    exec.bind("x", xData)
+        .bind("m", mData)
+        .bind("y", yData);
+
+    // x.m.y is a scaler.. the unit vector dots reduce away
+    Gradient grad(xmy());
+    EXPECT_STREAMED_AS("sum_i(sum_j(x_i*m_ij*y_j))") << grad.forward();
+    EXPECT_EQ(Tensor<int>({1}, {-6}), exec.run(grad.forward()));
+    std::size_t forward = exec.iterations();
+
+    std::vector<std::string> names = grad.names();
+    EXPECT_EQ(3u, names.size());
+    EXPECT_EQ("m", names[0]);
+
+    // d/dx is m.y, d/dy is x.m and d/dm is the outer product of x and y
+    Nodes dx = grad.of("x");
+    EXPECT_EQ(1u, dx.size());
+    EXPECT_STREAMED_AS("sum_i(sum_j(U_i*m_ij*y_j))") << dx[0];
+    EXPECT_EQ(TensorUtils<int>::dot(mData, yData), exec.run(dx[0]));
+
+    Nodes dy = grad.of("y");
+    EXPECT_STREAMED_AS("sum_i(sum_j(U_j*x_i*m_ij))") << dy[0];
+    EXPECT_EQ(TensorUtils<int>::dot(xData, mData), exec.run(dy[0]));
+
+    Nodes dm = grad.of("m");
+    EXPECT_STREAMED_AS("sum_i(sum_j(U_i*U_j*x_i*y_j))") << dm[0];
+    EXPECT_EQ(Tensor<int>({3,2}, {1,-1, 2,-2, 3,-3}), exec.run(dm[0]));
+
+    // each term runs the loops of the forward graph
+    exec.run(dm[0]);
+    EXPECT_EQ(forward, exec.iterations());
+
+    // and links in the forward subtrees it didnt have to change
+    const Handle& body = grad.forward()->children_[1]->children_[1];
+    Handle dxBody = dx[0]->children_[1]->children_[1];
+    EXPECT_EQ(body->children_[1], dxBody->children_[1]);
+    Handle dmBody = dm[0]->children_[1]->children_[1]->children_[1]->children_[1];
+    EXPECT_EQ(body->children_[0], dmBody->children_[0]);
+    EXPECT_EQ(body->children_[1]->children_[1], dmBody->children_[1]);
+
+    // a tensor read twice is a term per read.. d(x.x)/dx is 2x
+    Gradient square(Make::dot(Make::tensor("x", {"k"}),
+                              Make::tensor("x", {"q"})));
+    Nodes dxx = square.of("x");
+    EXPECT_EQ(2u, dxx.size());
+    EXPECT_EQ(Tensor<int>({3}, {2,4,6}), total(exec, dxx));
+
+    // a non scaler graph gives the jacobian, the tensor's basis first
+    Gradient xm(Make::dot(Make::tensor("x", {"k"}),
+                          Make::tensor("m", {"i","j"})));
+    EXPECT_STREAMED_AS("sum_i(sum_j(U_j*x_i*m_ij))") << xm.forward();
+    EXPECT_EQ(mData, exec.run(xm.of("x")[0]));
+
+    // m's j is only sized by m itself
+    exec.size("j", 2);
+    EXPECT_EQ(Tensor<int>({3,2,2}, {1,0, 0,1,
+                                    2,0, 0,2,
+                                    3,0, 0,3}), exec.run(xm.of("m")[0]));
+
+    EXPECT_THROW(grad.of("q"), "Gradient by q which the graph doesnt read");
+    EXPECT_THROW(Gradient(Make::tensor("s", {})).of("s"), "Gradient of a scaler by itself");
+}
+
+int main()
+{
+    try
+    {
+        testGradient();
+    }
+    catch (std::exception& e)
+    {
+        std::cout << "Opps... " << e.what() << "\n";
+    }
+}
@@ -0,0 +1,449 @@
+#include "SummerArena.hh"
+#include "SummerRules.hh"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <malloc.h>
+
+// how the rewrite passes scale.. synthetic graphs of growing size are put
+// through the passes one after the other (and through the combined rule set
+// and cse) and each pass is timed and counted: nodes looked at (checks),
+// rewrites, heap allocations and the peak heap over the pass.
+//
+// each series gets power laws fitted (the slope of log/log) against the size,
+// for reading, and against the work (nodes going in plus rewrites made), for
+// the limits. the worklist driver should cost a fixed amount per node and per
+// rewrite so checks over Linear is a fail, times are noisy so they get more
+// room.. a pass gone quadratic blows well past both. the exit code is 1 if
+// anything failed.
+//
+// the combined rule set (in its phases) must do no more rewrites than the
+// first four passes it stands for and take no longer, give or take Rules for
+// the noise, over each series.
+//
+// the compact series puts the same chains through the CompactGraph ports of
+// the first four passes and the report sets their time against the Node ones..
+// that has come out between 1.4x and 2.9x here, so it is printed, not checked.
+//
+//   g++ -std=c++11 -O2 -o bench SummerGraph.bench.cc && ./bench [longest chain]
+
+// heap traffic.. live bytes by the allocators own size of each block
+std::atomic<std::size_t> allocations(0);
+std::atomic<std::size_t> live(0);
+std::atomic<std::size_t> peak(0);
+
+void* counted(void* ptr)
+{
+    if (not ptr) return ptr;
+    ++allocations;
+    std::size_t now = live += malloc_usable_size(ptr);
+    for (std::size_t was = peak; now > was and not peak.compare_exchange_weak(was, now); ) {}
+    return ptr;
+}
+
+void* operator new(std::size_t size)
+{
+    if (void* ptr = counted(std::malloc(size))) return ptr;
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    return counted(std::malloc(size));
+}
+
+void release(void* ptr)
+{
+    if (ptr) live -= malloc_usable_size(ptr);
+    std::free(ptr);
+}
+
+void operator delete(void* ptr) noexcept              { release(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { release(ptr); }
+
+// ################################################
+// ################################################
+// ################################################
+
+const double Linear = 1.25;   // slope limit for checks against the work
+const double Timing = 1.6;    // and for times
+const double Rules  = 1.25;   // ApplyRules time over the four passes (noise)
+
+std::string id(const char* prefix, int n)
+{
+    std::stringstream ss;
+    ss << prefix << n;
+    return ss.str();
+}
+
+Handle tensor(const std::string& name, int rank, int& next)
+{
+    // fresh index names throughout
+    Handle exp(new Element(name));
+    Element* element = static_cast<Element*>(exp.get());
+    for (int r = 0; r < rank; ++r)
+        element->children_.push_back(Handle(new Var(id("i", next++))));
+    element->refresh();
+
+    for (Nodes::const_reverse_iterator iit = element->children_.rbegin();
+         iit != element->children_.rend();
+         ++iit)
+    {
+        exp = Handle(new Mult(Handle(new UnitVec(*iit)), exp));
+    }
+    for (Nodes::const_reverse_iterator iit = element->children_.rbegin();
+         iit != element->children_.rend();
+         ++iit)
+    {
+        exp = Handle(new Summer(*iit, exp));
+    }
+    return exp;
+}
+
+Handle chain(int len, int rank)
+{
+    // t0.t1.t2... of rank r tensors
+    int next = 0;
+    Handle l = tensor("t0", rank, next);
+    for (int t = 1; t < len; ++t)
+        l = Make::dot(l, tensor(id("t", t), rank, next));
+    return l;
+}
+
+Handle wide(int width)
+{
+    // x0*x1*x2... an outer product, a summer per factor to lift
+    int next = 0;
+    Handle l = tensor("x0", 1, next);
+    for (int t = 1; t < width; ++t)
+        l = Handle(new Mult(l, tensor(id("x", t), 1, next)));
+    return l;
+}
+
+Handle repeated(int count)
+{
+    // the same x.m term over and over.. all of it common
+    Handle l = Make::dot(Make::tensor("x", {"k"}), Make::tensor("m", {"i","j"}));
+    for (int t = 1; t < count; ++t)
+        l = Handle(new Mult(l, Make::dot(Make::tensor("x", {"k"}), Make::tensor("m", {"i","j"}))));
+    return l;
+}
+
+std::size_t nodes(const Handle& exp)
+{
+    std::unordered_set<const Node*> seen;
+    std::vector<const Node*>        stack(1, exp.get());
+    while (not stack.empty())
+    {
+        const Node* node = stack.back();
+        stack.pop_back();
+        if (not seen.insert(node).second) continue;
+        for (const Handle& kid : node->children_) stack.push_back(kid.get());
+    }
+    return seen.size();
+}
+
+// ################################################
+// ################################################
+// ################################################
+
+struct Sample
+{
+    double      size_;
+    std::size_t nodes_;       // going in
+    double      seconds_;
+    std::size_t checks_;
+    std::size_t rewrites_;
+    std::size_t allocations_;
+    std::size_t peak_;
+};
+
+struct Curve
+{
+    std::string         series_;
+    std::string         pass_;
+    std::vector<Sample> samples_;
+};
+
+typedef std::function<double (const Sample&)> Value;
+
+double work(const Sample& sample)
+{
+    // what a pass cant help doing.. look at the graph and make its rewrites
+    return double(sample.nodes_ + sample.rewrites_);
+}
+
+double slope(const std::vector<Sample>& samples, const Value& by, const Value& value)
+{
+    // least squares fit of log(value) = a + slope*log(by)
+    double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (const Sample& sample : samples)
+    {
+        double x = std::log(std::max(by(sample), 1e-9));
+        double y = std::log(std::max(value(sample), 1e-9));
+        n += 1; sx += x; sy += y; sxx += x*x; sxy += x*y;
+    }
+    double denom = n * sxx - sx * sx;
+    return denom == 0 ? 0 : (n * sxy - sx * sy) / denom;
+}
+
+class Bench
+{
+    std::vector<Curve> curves_;
+
+    Curve& curve(const std::string& series, const std::string& pass)
+    {
+        for (Curve& curve : curves_)
+            if (curve.series_ == series and curve.pass_ == pass)
+                return curve;
+        Curve fresh = { series, pass, std::vector<Sample>() };
+        curves_.push_back(fresh);
+        return curves_.back();
+    }
+
+    template <typename Pass>
+    Handle time(const std::string& series, double size, const std::string& name, Handle exp)
+    {
+        std::size_t count = nodes(exp);
+        std::size_t heapBefore = live;
+        std::size_t allocsBefore = allocations;
+        peak = heapBefore;
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        Pass pass;
+        exp = pass.process(exp);
+        double taken = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        Sample sample = { size, count, taken, pass.checks(), pass.rewrites(),
+                          allocations - allocsBefore, peak - heapBefore };
+        record(series, name, sample);
+        return exp;
+    }
+
+    template <typename Rule>
+    CompactGraph::Index time(const std::string& series,
+                             double size,
+                             const std::string& name,
+                             CompactGraph& graph,
+                             CompactGraph::Index exp)
+    {
+        std::size_t count = graph.size();
+        std::size_t heapBefore = live;
+        std::size_t allocsBefore = allocations;
+        peak = heapBefore;
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        CompactTransformAll<Rule> pass;
+        exp = pass.process(graph, exp);
+        double taken = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        Sample sample = { size, count, taken, pass.checks(), pass.rewrites(),
+                          allocations - allocsBefore, peak - heapBefore };
+        record(series, name, sample);
+        return exp;
+    }
+
+    Handle cse(const std::string& series, double size, Handle exp)
+    {
+        std::size_t count = nodes(exp);
+        std::size_t heapBefore = live;
+        std::size_t allocsBefore = allocations;
+        peak = heapBefore;
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        CommonSubExpr pass;
+        exp = pass.process(exp);
+        double taken = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // cse looks at every node once
+        Sample sample = { size, count, taken, count, pass.hits(),
+                          allocations - allocsBefore, peak - heapBefore };
+        record(series, "CommonSubExpr", sample);
+        return exp;
+    }
+
+    void record(const std::string& series, const std::string& pass, const Sample& sample)
+    {
+        curve(series, pass).samples_.push_back(sample);
+        std::cout << std::left  << std::setw(10) << series
+                  << std::right << std::setw(6)  << std::setprecision(0) << sample.size_
+                  << std::setw(9) << sample.nodes_ << "  "
+                  << std::left  << std::setw(24) << pass
+                  << std::right << std::setw(10) << std::fixed << std::setprecision(3) << sample.seconds_ * 1e3 << "ms"
+                  << std::setw(10) << sample.checks_
+                  << std::setw(10) << sample.rewrites_
+                  << std::setw(10) << sample.allocations_
+                  << std::setw(10) << sample.peak_ / 1024 << "kB\n";
+    }
+
+public:
+    void passes(const std::string& series, double size, const std::function<Handle ()>& make)
+    {
+        // the standard pipeline one pass at a time then the combined rules
+        Handle l = make();
+        l = time<TransformAll<LiftSum> >(series, size, "LiftSum", l);
+        l = time<TransformAll<RotateDotsMultsToRight> >(series, size, "RotateDotsMultsToRight", l);
+        l = time<TransformAll<AttachDotsToUnitVectors> >(series, size, "AttachDotsToUnitVectors", l);
+        l = time<TransformAll<LiftUnitVectorUp> >(series, size, "LiftUnitVectorUp", l);
+        l = time<TransformAll<UnitVecDotToDelta> >(series, size, "UnitVecDotToDelta", l);
+        l = time<TransformAll<ReduceDelta> >(series, size, "ReduceDelta", l);
+        l.reset();
+
+        l = time<TransformAll<ApplyRules<StandardRules> > >(series, size, "ApplyRules", make());
+    }
+
+    void compact(const std::string& series, double size, const Handle& exp)
+    {
+        // the first four passes again on the arena.. the copy in isnt timed
+        CompactGraph        graph;
+        CompactGraph::Index l = graph.fromHandle(exp);
+        l = time<CompactLiftSum>(series, size, "LiftSum", graph, l);
+        l = time<CompactRotateDotsMultsToRight>(series, size, "RotateDotsMultsToRight", graph, l);
+        l = time<CompactAttachDotsToUnitVectors>(series, size, "AttachDotsToUnitVectors", graph, l);
+        l = time<CompactLiftUnitVectorUp>(series, size, "LiftUnitVectorUp", graph, l);
+    }
+
+    double four(const std::string& series, double size, const Value& value) const
+    {
+        // over the four passes both sides have
+        double total = 0;
+        for (const Curve& curve : curves_)
+        {
+            if (curve.series_ != series) continue;
+            if (curve.pass_ != "LiftSum" and
+                curve.pass_ != "RotateDotsMultsToRight" and
+                curve.pass_ != "AttachDotsToUnitVectors" and
+                curve.pass_ != "LiftUnitVectorUp")
+                continue;
+            for (const Sample& sample : curve.samples_)
+                if (sample.size_ == size)
+                    total += value(sample);
+        }
+        return total;
+    }
+
+    void versus(const std::string& series, const std::string& against) const
+    {
+        Value seconds = [](const Sample& s) { return s.seconds_; };
+
+        std::cout << "\n" << series << " against " << against << " (the first four passes)\n";
+        for (const Curve& curve : curves_)
+        {
+            if (curve.series_ != series or curve.pass_ != "LiftSum") continue;
+            for (const Sample& sample : curve.samples_)
+            {
+                double ours   = four(series, sample.size_, seconds);
+                double theirs = four(against, sample.size_, seconds);
+                std::cout << "        " << std::right << std::setw(6) << std::setprecision(0) << sample.size_
+                          << std::setw(10) << std::fixed << std::setprecision(3) << ours * 1e3 << "ms"
+                          << std::setw(10) << theirs * 1e3 << "ms"
+                          << std::setw(8) << std::setprecision(2) << (ours > 0 ? theirs / ours : 0) << "x\n";
+            }
+        }
+    }
+
+    void common(const std::string& series, double size, const Handle& exp)
+    {
+        cse(series, size, exp);
+    }
+
+    bool report() const
+    {
+        // the size curves are for reading, the limits are on the slopes
+        // against the work.. a pass that lifts n summers n levels up does n^2
+        // rewrites and thats the graph not the driver
+        bool ok = true;
+        Value size     = [](const Sample& s) { return s.size_; };
+        Value checks   = [](const Sample& s) { return double(s.checks_); };
+        Value seconds  = [](const Sample& s) { return s.seconds_; };
+        Value rewrites = [](const Sample& s) { return double(s.rewrites_); };
+        Value heap     = [](const Sample& s) { return double(s.peak_); };
+
+        std::cout << "\nscaling (log/log slopes.. by size, then by nodes + rewrites)\n";
+        for (const Curve& curve : curves_)
+        {
+            if (curve.samples_.size() < 2) continue;
+
+            double perCheck = slope(curve.samples_, work, checks);
+            double perTime  = slope(curve.samples_, work, seconds);
+            bool   bad      = perCheck > Linear or perTime > Timing;
+            ok = ok and not bad;
+
+            std::cout << (bad ? "FAILED: " : "        ")
+                      << std::left  << std::setw(10) << curve.series_
+                      << std::setw(24) << curve.pass_
+                      << std::right << std::fixed << std::setprecision(2)
+                      << " rewrites " << std::setw(5) << slope(curve.samples_, size, rewrites)
+                      << " time "     << std::setw(5) << slope(curve.samples_, size, seconds)
+                      << " heap "     << std::setw(5) << slope(curve.samples_, size, heap)
+                      << " | checks " << std::setw(5) << perCheck
+                      << " time "     << std::setw(5) << perTime << "\n";
+        }
+
+        std::cout << "\nApplyRules against the four passes (rewrites, time over the series)\n";
+        for (const Curve& curve : curves_)
+        {
+            if (curve.pass_ != "ApplyRules") continue;
+
+            double ours = 0, theirs = 0;
+            bool   more = false;
+            for (const Sample& sample : curve.samples_)
+            {
+                ours   += sample.seconds_;
+                theirs += four(curve.series_, sample.size_, seconds);
+                more    = more or sample.rewrites_ > four(curve.series_, sample.size_, rewrites);
+            }
+            bool bad = more or ours > Rules * theirs;
+            ok = ok and not bad;
+
+            const Sample& last = curve.samples_.back();
+            std::cout << (bad ? "FAILED: " : "        ")
+                      << std::left  << std::setw(10) << curve.series_
+                      << std::right << std::setw(6)  << std::setprecision(0) << last.size_
+                      << std::setw(10) << last.rewrites_
+                      << std::setw(10) << four(curve.series_, last.size_, rewrites)
+                      << std::setw(10) << std::fixed << std::setprecision(3) << ours * 1e3 << "ms"
+                      << std::setw(10) << theirs * 1e3 << "ms"
+                      << std::setw(8)  << std::setprecision(2) << (theirs > 0 ? ours / theirs : 0) << "x\n";
+        }
+        return ok;
+    }
+};
+
+int main(int argc, char** argv)
+{
+    int longest = argc > 1 ? std::atoi(argv[1]) : 1000;
+
+    // the lifts do (summers)^2 rewrites so the higher ranks stop shorter
+    Bench bench;
+    for (int rank : { 1, 2, 4, 8 })
+    {
+        std::string series = id("chain/r", rank);
+        int         top    = std::min(longest, 2 * longest / rank);
+        for (int len = top / 8; len <= top; len *= 2)
+            bench.passes(series, len, [=]() { return chain(len, rank); });
+    }
+
+    for (int width = longest / 8; width <= longest; width *= 2)
+        bench.passes("wide", width, [=]() { return wide(width); });
+
+    for (int count = longest / 8; count <= longest; count *= 2)
+        bench.common("repeated", count, repeated(count));
+
+    for (int len = longest / 8; len <= longest; len *= 2)
+        bench.compact("compact", len, chain(len, 2));
+
+    bench.versus("compact", "chain/r2");
+    return bench.report() ? 0 : 1;
+}
@@ -1,6 +1,17 @@
+#ifndef SummerGraph_HH
+#define SummerGraph_HH
+
 #include <iostream>
 #include <memory>
 #include <vector>
+#include <string>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <set>
+#include <sstream>
+#include <stdexcept>
 
 // TODO
 //  - complete optimisation of graph
@@ -23,20 +34,104 @@ typedef std::vector<std::size_t> TensorShape;
 
 class AbstractDispatcher;
 
+enum NodeKind
+{
+    KindVar = 0,
+    KindUnitVec,
+    KindElement,
+    KindSummer,
+    KindMult,
+    KindDot,
+    KindDelta
+};
+
 struct Node
 {
     typedef std::shared_ptr<Node> Handle;
     typedef std::vector<Handle>   Nodes;
+    typedef unsigned int          Mask;     // a bit per NodeKind
+    typedef std::uint64_t         VarMask;  // a (hashed) bit per Var name
+
+    const NodeKind kind_;
+    Nodes          children_;
+
+    // summary of the whole subtree (self included) so the rewrite checks dont
+    // have to walk it.. anything that edits children_ must refresh() the nodes
+    // it touched and their parents (TransformAll does this for its Operation)
+    Mask           kinds_;
+    VarMask        vars_;
+
+    Node(NodeKind kind) :
+        kind_(kind),
+        children_(),
+        kinds_(bit(kind)),
+        vars_(0)
+    {}
 
-    Nodes children_;
+    Node(NodeKind kind,
+         const std::initializer_list<Handle> kids) :
+        kind_(kind),
+        children_(kids),
+        kinds_(0),
+        vars_(0)
+    {
+        refresh();
+    }
 
-    Node() :
-        children_()
-    {}
+    virtual ~Node()
+    {
+        // a right rotated chain is as deep as it has factors and would free
+        // itself one stack frame per level.. so kids only we hold are taken
+        // apart here from a flat list instead
+        bool deep = false;
+        for (const Handle& kid : children_)
+            deep = deep or (kid.use_count() == 1 and not kid->children_.empty());
+        if (not deep)
+            return;
 
-    Node(const std::initializer_list<Handle> kids) :
-        children_(kids)
-    {}
+        Nodes dying;
+        dying.swap(children_);
+        while (not dying.empty())
+        {
+            Handle node = std::move(dying.back());
+            dying.pop_back();
+            if (node.use_count() != 1)
+                continue;
+
+            for (Handle& kid : node->children_)
+                dying.push_back(std::move(kid));
+            node->children_.clear();
+        }
+    }
+
+    static Mask bit(NodeKind kind) { return 1u << kind; }
+
+    static VarMask varBit(const std::string& name)
+    {
+        return VarMask(1) << (std::hash<std::string>()(name) % 64);
+    }
+
+    bool refresh()
+    {
+        // rebuild the summary from the kids.. true if it changed
+        if (kind_ == KindVar)
+            return false;
+
+        Mask    kinds = bit(kind_);
+        VarMask vars  = 0;
+        for (Nodes::const_iterator iit = children_.begin();
+             iit != children_.end();
+             ++iit)
+        {
+            kinds |= (*iit)->kinds_;
+            vars  |= (*iit)->vars_;
+        }
+
+        bool changed = kinds != kinds_ or vars != vars_;
+        kinds_ = kinds;
+        vars_  = vars;
+        return changed;
+    }
 
     virtual void visit(AbstractDispatcher& dispatcher) = 0;
 };
@@ -44,12 +139,20 @@ struct Node
 typedef Node::Handle Handle;
 typedef Node::Nodes  Nodes;
 
+template <typename NodeType>
+bool is(const Handle& node)
+{
+    // kind check in place of a dynamic_cast
+    return node->kind_ == NodeType::Kind;
+}
+
 struct Var;
 struct UnitVec;
 struct Element;
 struct Summer;
 struct Mult;
 struct Dot;
+struct Delta;
 
 class AbstractDispatcher
 {
@@ -61,6 +164,7 @@ public:
     virtual void handle(Summer&   node) = 0;
     virtual void handle(Mult&     node) = 0;
     virtual void handle(Dot&      node) = 0;
+    virtual void handle(Delta&    node) = 0;
 };
 
 template <typename Owner>
@@ -82,6 +186,7 @@ public:
     void handle(Summer&   node) { owner_.handle(node); }
     void handle(Mult&     node) { owner_.handle(node); }
     void handle(Dot&      node) { owner_.handle(node); }
+    void handle(Delta&    node) { owner_.handle(node); }
 };
 
 template <typename Owner, typename State>
@@ -106,6 +211,7 @@ public:
     void handle(Summer&   node) { owner_.handle(state_, node); }
     void handle(Mult&     node) { owner_.handle(state_, node); }
     void handle(Dot&      node) { owner_.handle(state_, node); }
+    void handle(Delta&    node) { owner_.handle(state_, node); }
 };
 
 // ################################################
@@ -114,21 +220,30 @@ public:
 
 struct Var : Node
 {
+    static const NodeKind Kind = KindVar;
+
     std::string name_;
+    std::size_t size_;   // extent of the index.. 0 if not known
 
-    Var(std::string name) :
-        Node(),
-        name_(name)
-    {}
+    Var(std::string name,
+        std::size_t size = 0) :
+        Node(Kind),
+        name_(name),
+        size_(size)
+    {
+        vars_ = varBit(name_);
+    }
 
     void visit(AbstractDispatcher& dispatcher) { dispatcher.handle(*this); }
 };
 
 struct Summer : Node
 {
+    static const NodeKind Kind = KindSummer;
+
     Summer(const Handle& idx,
            const Handle& exp) :
-        Node({idx, exp})
+        Node(Kind, {idx, exp})
     {}
 
     void visit(AbstractDispatcher& dispatcher) { dispatcher.handle(*this); }
@@ -136,26 +251,50 @@ struct Summer : Node
 
 struct UnitVec : Node
 {
+    static const NodeKind Kind = KindUnitVec;
+
     UnitVec(const Handle& idx) :
-        Node({idx})
+        Node(Kind, {idx})
     {}
 
     void visit(AbstractDispatcher& dispatcher) { dispatcher.handle(*this); }
 };
 
+enum ElementForm
+{
+    // what is known about where a tensor is zero or repeats itself.. the data
+    // is still stored dense (zeros and all), the form only lets the rewrites
+    // and loops skip work
+    FormDense = 0,
+    FormSymmetric,   // m_ij == m_ji
+    FormDiagonal,    // zero unless i == j
+    FormBanded,      // zero unless |i - j| <= band_
+    FormSparse       // mostly zeros.. the loops walk the non zeros
+};
+
 struct Element : Node
 {
+    static const NodeKind Kind = KindElement;
+
     std::string name_;
+    ElementForm form_;
+    std::size_t band_;   // FormBanded only
 
-    Element(const std::string name) :
-        Node(),
-        name_(name)
+    Element(const std::string name,
+            ElementForm form = FormDense,
+            std::size_t band = 0) :
+        Node(Kind),
+        name_(name),
+        form_(form),
+        band_(band)
     {}
 
     Element(const std::string name,
             const std::initializer_list<Handle> indexes) :
-        Node(indexes),
-        name_(name)
+        Node(Kind, indexes),
+        name_(name),
+        form_(FormDense),
+        band_(0)
     {}
 
     void visit(AbstractDispatcher& dispatcher) { dispatcher.handle(*this); }
@@ -163,9 +302,11 @@ struct Element : Node
 
 struct Mult : Node
 {
+    static const NodeKind Kind = KindMult;
+
     Mult(const Handle& left,
          const Handle& right) :
-        Node({left, right})
+        Node(Kind, {left, right})
     {}
 
     void visit(AbstractDispatcher& dispatcher) { dispatcher.handle(*this); }
@@ -173,9 +314,24 @@ struct Mult : Node
 
 struct Dot : Node
 {
+    static const NodeKind Kind = KindDot;
+
     Dot(const Handle& left,
         const Handle& right) :
-        Node({left, right})
+        Node(Kind, {left, right})
+    {}
+
+    void visit(AbstractDispatcher& dispatcher) { dispatcher.handle(*this); }
+};
+
+struct Delta : Node
+{
+    static const NodeKind Kind = KindDelta;
+
+    // kronecker delta (sigma) of two indexes.. what U_a.U_b becomes
+    Delta(const Handle& left,
+          const Handle& right) :
+        Node(Kind, {left, right})
     {}
 
     void visit(AbstractDispatcher& dispatcher) { dispatcher.handle(*this); }
@@ -190,15 +346,35 @@ struct Make
     static Handle tensor(std::string name,
                          const std::initializer_list<std::string> shape)
     {
-        // construct element
-        Element* element = new Element(name);
+        return tensor(name, shape, {});
+    }
+
+    static Handle tensor(std::string name,
+                         const std::initializer_list<std::string> shape,
+                         const std::initializer_list<std::size_t> sizes,
+                         ElementForm form = FormDense,
+                         std::size_t band = 0)
+    {
+        // only a matrix can be symmetric, diagonal or banded
+        if (form != FormDense and form != FormSparse and shape.size() != 2)
+        {
+            std::stringstream ss;
+            ss << "Graph element " << name << " has rank " << shape.size()
+               << " but its form needs 2";
+            throw std::runtime_error(ss.str());
+        }
+
+        // construct element.. sizes (if given) go on the index vars
+        Element* element = new Element(name, form, band);
         Handle exp(element);
 
+        const std::size_t* size = sizes.begin();
         for (const std::string& id : shape)
         {
-            Handle idx(new Var(id));
+            Handle idx(new Var(id, size != sizes.end() ? *size++ : 0));
             element->children_.push_back(idx);
         }
+        element->refresh();
 
         // now build summer and unit vars to form tensor
         for (Nodes::const_reverse_iterator iit = element->children_.rbegin();
@@ -239,73 +415,112 @@ struct Make
 
 class Render
 {
-    std::ostream& os_;
-    Dispatcher<Render> dispatch_;
-
-    friend Dispatcher<Render>;
-
-    void handle(Var&      node)
+    // prints an expression.. walked with an explicit stack (a rotated chain
+    // is as deep as it is long) and written into one buffer that is kept and
+    // reused between renders, the stream then gets a single write
+    struct Item
     {
-        os_ << node.name_;
-    }
+        const Node* node_;   // or text_ when null
+        const char* text_;
+    };
 
-    void handle(UnitVec&  node)
-    {
-        os_ << "U_";
-        node.children_[0]->visit(dispatch_);
-    }
+    std::string       buffer_;
+    std::vector<Item> stack_;
+
+    void push(const Node* node) { Item item = { node, NULL }; stack_.push_back(item); }
+    void push(const char* text) { Item item = { NULL, text }; stack_.push_back(item); }
 
-    void handle(Element&  node)
+    void step(const Node& node)
     {
-        os_ << node.name_ << "_";
-        for (Nodes::const_iterator iit = node.children_.begin();
-             iit != node.children_.end();
-             ++iit)
+        // write what comes first and stack the rest (backwards)
+        const Nodes& kids = node.children_;
+        switch (node.kind_)
         {
-            (*iit)->visit(dispatch_);
+        case KindVar:
+            buffer_ += static_cast<const Var&>(node).name_;
+            break;
+
+        case KindUnitVec:
+            buffer_ += "U_";
+            push(kids[0].get());
+            break;
+
+        case KindElement:
+            buffer_ += static_cast<const Element&>(node).name_;
+            buffer_ += "_";
+            for (Nodes::const_reverse_iterator iit = kids.rbegin();
+                 iit != kids.rend();
+                 ++iit)
+            {
+                push(iit->get());
+            }
+            break;
+
+        case KindSummer:
+            buffer_ += "sum_";
+            push(")");
+            push(kids[1].get());
+            push("(");
+            push(kids[0].get());
+            break;
+
+        case KindMult:
+            push(kids[1].get());
+            push("*");
+            push(kids[0].get());
+            break;
+
+        case KindDot:
+            push(kids[1].get());
+            push(".");
+            push(kids[0].get());
+            break;
+
+        case KindDelta:
+            buffer_ += "delta_";
+            push(kids[1].get());
+            push(kids[0].get());
+            break;
         }
     }
 
-    void handle(Summer&   node)
-    {
-        os_ << "sum_";
-        node.children_[0]->visit(dispatch_);
-        os_ << "(";
-        node.children_[1]->visit(dispatch_);
-        os_ << ")";
-    }
+public:
+    Render() :
+        buffer_(),
+        stack_()
+    {}
 
-    void handle(Mult&     node)
+    // the text of exp.. valid till the next render
+    const std::string& text(const Handle& exp)
     {
-        node.children_[0]->visit(dispatch_);
-        os_ << "*";
-        node.children_[1]->visit(dispatch_);
-    }
+        buffer_.clear();
+        push(exp.get());
+        while (not stack_.empty())
+        {
+            Item item = stack_.back();
+            stack_.pop_back();
 
-    void handle(Dot&      node)
-    {
-        node.children_[0]->visit(dispatch_);
-        os_ << ".";
-        node.children_[1]->visit(dispatch_);
+            if (item.node_)
+                step(*item.node_);
+            else
+                buffer_ += item.text_;
+        }
+        return buffer_;
     }
 
-public:
-    Render(std::ostream& os) :
-        os_(os),
-        dispatch_(*this)
-    {}
-
-    void render(Handle exp)
+    void render(std::ostream& os, const Handle& exp)
     {
-        exp->visit(dispatch_);
+        const std::string& text = this->text(exp);
+        os.write(text.data(), text.size());
     }
 };
 
 std::ostream& operator<<(std::ostream& os,
                          const Handle& a)
 {
-    Render render(os);
-    render.render(a);
+    // one per thread so printing in a loop doesnt allocate once warmed up
+    static thread_local Render render;
+    render.render(os, a);
     return os;
 }
 
@@ -322,179 +537,501 @@ public:
 
     bool find(const Handle& node)
     {
-        if (const NodeType* ptr = dynamic_cast<NodeType*>(node.get()))
-            return true;
-
-        for (Nodes::const_iterator iit = node->children_.begin();
-             iit != node->children_.end();
-             ++iit)
-        {
-            if (find(*iit))
-                return true;
-        }
-        return false;
+        // the subtree summary already knows
+        return (node->kinds_ & Node::bit(NodeType::Kind)) != 0;
     }
 };
 // ################################################
 // ################################################
 // ################################################
 
-// TODO rework as a dynamic cast(remove dispatch) and templated type (ie same as Has<>)
 class LocateLastSum
 {
     // given an expression that starts with summers find the last one in the chain of them
+public:
+    LocateLastSum() {}
+
+    Handle find(Handle exp)
+    {
+        Handle lastSummer;
+        for (Handle current = exp; is<Summer>(current); current = current->children_[1])
+            lastSummer = current;
+        return lastSummer;
+    }
+};
 
-    Handle lastSummer_;
-    Handle current_;
-    Dispatcher<LocateLastSum> dispatch_;
+// ################################################
+// ################################################
+// ################################################
 
-    friend Dispatcher<LocateLastSum>;
+class Unshare
+{
+    // the rewrites rotate nodes in place so they need a real tree.. any node
+    // (other than a Var, those never change) reached through more than one
+    // parent is deep copied on its second and later visits
+    std::unordered_set<const Node*> seen_;
 
-    template<typename Specific>
-    void handle(Specific& node)
+    static Handle copy(const Handle& node)
+    {
+        const Nodes& kids = node->children_;
+        switch (node->kind_)
+        {
+        case KindUnitVec: return Handle(new UnitVec(kids[0]));
+        case KindSummer:  return Handle(new Summer(kids[0], kids[1]));
+        case KindMult:    return Handle(new Mult(kids[0], kids[1]));
+        case KindDot:     return Handle(new Dot(kids[0], kids[1]));
+        case KindDelta:   return Handle(new Delta(kids[0], kids[1]));
+        case KindElement:
+        {
+            const Element* from = static_cast<const Element*>(node.get());
+            Element* element = new Element(from->name_, from->form_, from->band_);
+            Handle   exp(element);
+            element->children_ = kids;
+            element->refresh();
+            return exp;
+        }
+        default:          return node;
+        }
+    }
+
+    Handle own(Handle node)
     {
-        // ok we have a no summer..
-        // whatever is in my handles is the result so we just stop..
+        if (is<Var>(node) or seen_.insert(node.get()).second)
+            return node;
+        return copy(node);
     }
 
-    void handle(Summer& node)
+    Handle walk(Handle exp)
     {
-        // ok still a summer so update state and then see what my kid is
-        lastSummer_ = current_;
-        current_    = node.children_[1];
+        // pre-order over (parent, kid) slots.. an explicit stack since the
+        // trees get as deep as they are long
+        exp = own(exp);
+        std::vector<std::pair<Node*,int> > stack;
+        for (int childIdx = exp->children_.size(); childIdx-- > 0; )
+            stack.push_back(std::make_pair(exp.get(), childIdx));
+
+        while (not stack.empty())
+        {
+            Handle& child = stack.back().first->children_[stack.back().second];
+            stack.pop_back();
 
-        current_->visit(dispatch_);
+            child = own(child);
+            for (int childIdx = child->children_.size(); childIdx-- > 0; )
+                stack.push_back(std::make_pair(child.get(), childIdx));
+        }
+        return exp;
     }
 
 public:
-
-    LocateLastSum() :
-        lastSummer_(),
-        current_(),
-        dispatch_(*this)
+    Unshare() :
+        seen_()
     {}
 
-    Handle find(Handle exp)
+    Handle process(Handle exp)
     {
-        current_ = exp;
-        current_->visit(dispatch_);
+        seen_.clear();
+        exp = walk(exp);
+        seen_.clear();
+        return exp;
+    }
+};
 
-        return lastSummer_;
+class CommonSubExpr
+{
+    // hash-consing.. every subtree is looked up by (kind, name, kids) in an
+    // interning table and identical ones come back as the one shared node, so
+    // the tree turns into a DAG. kids are interned first so comparing their
+    // pointers is a full structural compare.
+    // the table only holds weak links and checks each candidate again before
+    // use, so it stays valid when later rewrites mutate or drop nodes.. run
+    // process again after the rewrites and it picks up where it left off
+    typedef std::unordered_multimap<std::size_t, std::weak_ptr<Node> > Table;
+
+    Table                                   table_;
+    std::unordered_map<const Node*, Handle> done_;
+    std::size_t                             hits_;
+
+    static const std::string* nameOf(const Node* node)
+    {
+        if (node->kind_ == KindVar)
+            return &static_cast<const Var*>(node)->name_;
+        if (node->kind_ == KindElement)
+            return &static_cast<const Element*>(node)->name_;
+        return NULL;
     }
+
+    static std::size_t hashOf(const Node* node)
+    {
+        std::size_t hash = node->kind_;
+        if (const std::string* name = nameOf(node))
+            hash ^= std::hash<std::string>()(*name) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+
+        for (Nodes::const_iterator iit = node->children_.begin();
+             iit != node->children_.end();
+             ++iit)
+        {
+            std::size_t kid = std::hash<const Node*>()(iit->get());
+            hash ^= kid + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+        }
+        return hash;
+    }
+
+    static bool same(const Node* a, const Node* b)
+    {
+        if (a->kind_ != b->kind_ or a->children_ != b->children_)
+            return false;
+
+        if (a->kind_ == KindVar and
+            static_cast<const Var*>(a)->size_ != static_cast<const Var*>(b)->size_)
+            return false;
+
+        if (a->kind_ == KindElement and
+            (static_cast<const Element*>(a)->form_ != static_cast<const Element*>(b)->form_ or
+             static_cast<const Element*>(a)->band_ != static_cast<const Element*>(b)->band_))
+            return false;
+
+        const std::string* aName = nameOf(a);
+        const std::string* bName = nameOf(b);
+        return aName == bName or (aName and bName and *aName == *bName);
+    }
+
+    Handle intern(const Handle& node)
+    {
+        std::size_t hash = hashOf(node.get());
+
+        std::pair<Table::iterator, Table::iterator> range = table_.equal_range(hash);
+        for (Table::iterator tit = range.first; tit != range.second; )
+        {
+            Handle known = tit->second.lock();
+            if (not known)
+            {
+                tit = table_.erase(tit);
+                continue;
+            }
+
+            if (known == node)
+                return node;
+
+            // the entry may have been edited since it went in.. check again
+            if (same(known.get(), node.get()))
+            {
+                ++hits_;
+                return known;
+            }
+            ++tit;
+        }
+
+        table_.insert(std::make_pair(hash, std::weak_ptr<Node>(node)));
+        return node;
+    }
+
+    Handle walk(const Handle& exp)
+    {
+        // post-order with an explicit stack.. a node is interned on its second
+        // visit, once all its kids are
+        std::vector<std::pair<Handle,bool> > stack(1, std::make_pair(exp, false));
+        while (not stack.empty())
+        {
+            Handle node  = stack.back().first;
+            bool   ready = stack.back().second;
+            stack.pop_back();
+
+            if (done_.count(node.get()))
+                continue;
+
+            if (not ready)
+            {
+                stack.push_back(std::make_pair(node, true));
+                for (Nodes::const_reverse_iterator iit = node->children_.rbegin();
+                     iit != node->children_.rend();
+                     ++iit)
+                {
+                    if (not done_.count(iit->get()))
+                        stack.push_back(std::make_pair(*iit, false));
+                }
+                continue;
+            }
+
+            bool changed = false;
+            for (std::size_t childIdx = 0;
+                 childIdx < node->children_.size();
+                 ++childIdx)
+            {
+                Handle& child = node->children_[childIdx];
+                Handle  canon = done_[child.get()];
+                if (canon != child)
+                {
+                    child   = canon;
+                    changed = true;
+                }
+            }
+            if (changed)
+                node->refresh();
+
+            done_[node.get()] = intern(node);
+        }
+        return done_[exp.get()];
+    }
+
+public:
+    CommonSubExpr() :
+        table_(),
+        done_(),
+        hits_(0)
+    {}
+
+    Handle process(const Handle& exp)
+    {
+        Handle canon = walk(exp);
+        done_.clear();
+        return canon;
+    }
+
+    // subtrees replaced by one already in the table
+    std::size_t hits() const { return hits_; }
 };
 
 // ################################################
 // ################################################
 // ################################################
 
+template <typename Operation>
+struct OperationPhases
+{
+    // an operation can come in phases (see ApplyRules) that TransformAll runs
+    // to their own fixed points in turn.. most are the one phase
+    static int  count(const Operation&)  { return 1; }
+    static void set(Operation&, int)     {}
+};
+
 template <typename Operation>
 class TransformAll
 {
     // outer walker method to search the tree for transformation points..
-    struct State
+    // rather than restarting from the top after every rewrite it keeps a
+    // worklist of nodes to look at and a side table of parent links, so a
+    // rewrite only queues its own neighbourhood: the new node, its kids out to
+    // Operation::Reach levels and its parent and grand parent. the same
+    // neighbourhood (plus any ancestors whose summary changes) is refreshed.
+    // once the worklist drains a sweep of the whole tree confirms the fixed
+    // point (Has<> style checks can flip far from a rewrite) and feeds any
+    // stragglers back into the worklist.
+    struct Slot
     {
-        Handle parent_;
-        Handle current_;
-        int    currentsIdxInParent_;
+        std::weak_ptr<Node> parent_;   // empty for the root
+        int                 idx_;      // -1 for the root
     };
 
-    friend StatefulDispatcher<TransformAll, State>;
+    typedef std::unordered_map<const Node*, Slot> Parents;
 
-    bool      found_;
-    Handle    parent_;
-    Handle    current_;
-    int       currentsIdxInParent_;
-    Operation op_;
+    friend Dispatcher<TransformAll>;
+
+    Operation                op_;
+    Dispatcher<TransformAll> dispatch_;
+    Handle                   root_;
+    Parents                  parents_;
+    Nodes                    work_;
+    bool                     applicable_;
+    std::size_t              checks_;
+    std::size_t              rewrites_;
 
     template<typename Specific>
-    bool check(State& state, Specific& node)
+    void handle(Specific& node)
+    {
+        applicable_ = op_.isApplicable(node);
+    }
+
+    bool check(const Handle& node)
     {
-        // check child
-        if (op_.isApplicable(node))
+        ++checks_;
+        applicable_ = false;
+        node->visit(dispatch_);
+        return applicable_;
+    }
+
+    void link(const Handle& parent)
+    {
+        for (std::size_t childIdx = 0;
+             childIdx < parent->children_.size();
+             ++childIdx)
         {
-            parent_              = state.parent_;
-            current_             = state.current_;
-            currentsIdxInParent_ = state.currentsIdxInParent_;
-            found_               = true;
+            Slot slot = { parent, static_cast<int>(childIdx) };
+            parents_[parent->children_[childIdx].get()] = slot;
+        }
+    }
+
+    bool live(const Handle& node) const
+    {
+        // stale entries (moved or dropped by an earlier rewrite) are skipped
+        if (node == root_)
             return true;
+
+        typename Parents::const_iterator pit = parents_.find(node.get());
+        if (pit == parents_.end())
+            return false;
+
+        Handle parent = pit->second.parent_.lock();
+        int    idx    = pit->second.idx_;
+        return parent and
+               idx >= 0 and
+               static_cast<std::size_t>(idx) < parent->children_.size() and
+               parent->children_[idx] == node;
+    }
+
+    void queue(const Nodes& found)
+    {
+        // work_ is a stack.. push backwards so the first found goes first
+        for (Nodes::const_reverse_iterator nit = found.rbegin();
+             nit != found.rend();
+             ++nit)
+        {
+            work_.push_back(*nit);
         }
-        return false;
     }
 
-    void next(State& state)
+    void relink(const Handle& top, int reach)
     {
-        for (int childIdx = 0;
-             childIdx < state.current_->children_.size();
-             ++childIdx)
+        // refresh the parent links under a rewritten node and queue them.. a
+        // negative reach means the rewrite may have touched the whole subtree
+        Nodes found;
+        std::vector<std::pair<Handle,int> > stack(1, std::make_pair(top, 0));
+        while (not stack.empty())
         {
-            State nextState;
-            nextState.parent_  = state.current_;
-            nextState.current_ = state.current_->children_[childIdx];
-            nextState.currentsIdxInParent_ = childIdx;
+            Handle node  = stack.back().first;
+            int    depth = stack.back().second;
+            stack.pop_back();
+
+            link(node);
+            found.push_back(node);
+
+            if (reach >= 0 and depth >= reach)
+                continue;
 
-            StatefulDispatcher<TransformAll, State> dispatch(*this,nextState);
-            nextState.current_->visit(dispatch);
+            for (Nodes::const_reverse_iterator iit = node->children_.rbegin();
+                 iit != node->children_.rend();
+                 ++iit)
+            {
+                stack.push_back(std::make_pair(*iit, depth + 1));
+            }
         }
+
+        // kids come after their parents in found.. so backwards refreshes
+        // each summary after the ones it is built from
+        for (Nodes::const_reverse_iterator nit = found.rbegin();
+             nit != found.rend();
+             ++nit)
+        {
+            (*nit)->refresh();
+        }
+        queue(found);
     }
 
-    template<typename Specific>
-    void handle(State& state, Specific& node)
+    bool sweep()
     {
-        if (check(state, node))
-            return;
-        next(state);
+        // full pre-order pass.. rebuilds all links and queues every match
+        parents_.clear();
+        Slot top = { std::weak_ptr<Node>(), -1 };
+        parents_[root_.get()] = top;
+
+        Nodes found;
+        Nodes stack(1, root_);
+        while (not stack.empty())
+        {
+            Handle node = stack.back();
+            stack.pop_back();
+
+            link(node);
+            if (check(node))
+                found.push_back(node);
+
+            for (Nodes::const_reverse_iterator iit = node->children_.rbegin();
+                 iit != node->children_.rend();
+                 ++iit)
+            {
+                stack.push_back(*iit);
+            }
+        }
+
+        queue(found);
+        return not found.empty();
+    }
+
+    void rewrite(const Handle& node)
+    {
+        Slot   slot   = parents_[node.get()];
+        Handle parent = slot.parent_.lock();
+        Handle fresh  = op_.transform(node);
+        ++rewrites_;
+
+        if (not parent)
+            root_ = fresh;
+        else if (fresh != node)
+            parent->children_[slot.idx_] = fresh;
+
+        parents_[fresh.get()] = slot;
+        relink(fresh, Operation::Reach);
+
+        // summaries above only move if the subtree gained or lost something
+        for (Handle up = parent; up and up->refresh(); )
+            up = parents_[up.get()].parent_.lock();
+
+        // the parent and grand parent look at their kids so may now match
+        for (int level = 0; level < 2 and parent; ++level)
+        {
+            work_.push_back(parent);
+            parent = parents_[parent.get()].parent_.lock();
+        }
     }
 
 public:
-    // lift all the sums above other ops
     TransformAll() :
         op_(),
-        found_(false),
-        parent_(),
-        current_()
+        dispatch_(*this),
+        root_(),
+        parents_(),
+        work_(),
+        applicable_(false),
+        checks_(0),
+        rewrites_(0)
     {}
 
     Handle process(Handle exp)
     {
-        found_ = true;
-        while (found_)
+        // shared (CommonSubExpr) subtrees are split back out first.. and an
+        // operation starts afresh, any side tables it keeps are for one graph
+        op_   = Operation();
+        root_ = Unshare().process(exp);
+
+        // phases go round till every one since the last to rewrite has
+        // found nothing more
+        int phases = OperationPhases<Operation>::count(op_);
+        for (int phase = 0, quiet = 0; quiet < phases; phase = (phase + 1) % phases)
         {
-            // Reset  vars
-            parent_.reset();
-            current_.reset();
-            currentsIdxInParent_ = -1;
-            found_ = false;
-
-            // search for transformable item
+            OperationPhases<Operation>::set(op_, phase);
+            std::size_t before = rewrites_;
+            while (sweep())
             {
-                State state;
-                state.parent_.reset();
-                state.current_ = exp;
-                state.currentsIdxInParent_ = -1;
-
-                StatefulDispatcher<TransformAll, State> dispatch(*this,state);
-                exp->visit(dispatch);
-            }
-
-            // TODO it maybe possible to restart searching from the parent of the
-            // found node instead of the top of the tree.. check and optimise
-            if (found_)
-            {
-                if (parent_.get() == NULL)
+                while (not work_.empty())
                 {
-                    exp = op_.transform(exp);
-                }
-                else
-                {
-                    Handle newCurrent = op_.transform(current_);
-                    if (newCurrent != current_)
-                        parent_->children_[currentsIdxInParent_] = newCurrent;
+                    Handle node = work_.back();
+                    work_.pop_back();
+
+                    if (live(node) and check(node))
+                        rewrite(node);
                 }
             }
+            quiet = rewrites_ == before ? quiet + 1 : 1;
         }
 
+        exp = root_;
+        root_.reset();
+        parents_.clear();
         return exp;
     }
+
+    // isApplicable calls and rewrites done so far
+    std::size_t checks()   const { return checks_; }
+    std::size_t rewrites() const { return rewrites_; }
 };
 
 // ################################################
@@ -518,6 +1055,9 @@ class LiftSum
     //             K
 
 public:
+    // how deep under the returned node the rewrite changes links
+    static const int Reach = 2;
+
     LiftSum()
     {}
 
@@ -528,7 +1068,7 @@ public:
              childIdx < node->children_.size();
              ++childIdx)
         {
-            if (const Summer* ptr = dynamic_cast<Summer*>(node->children_[childIdx].get()))
+            if (is<Summer>(node->children_[childIdx]))
             {
                 // ok found it
                 Handle summer = node->children_[childIdx];
@@ -550,20 +1090,14 @@ public:
 
     bool isApplicable(Mult&     node)
     {
-        if (const Summer* ptr = dynamic_cast<Summer*>(node.children_[0].get()))
-            return true;
-        if (const Summer* ptr = dynamic_cast<Summer*>(node.children_[1].get()))
-            return true;
-        return false;
+        return is<Summer>(node.children_[0]) or
+               is<Summer>(node.children_[1]);
     }
 
     bool isApplicable(Dot&      node)
     {
-        if (const Summer* ptr = dynamic_cast<Summer*>(node.children_[0].get()))
-            return true;
-        if (const Summer* ptr = dynamic_cast<Summer*>(node.children_[1].get()))
-            return true;
-        return false;
+        return is<Summer>(node.children_[0]) or
+               is<Summer>(node.children_[1]);
     }
 };
 
@@ -593,6 +1127,9 @@ class RotateDotsMultsToRight
     //           Uj  Xij
 
 public:
+    // how deep under the returned node the rewrite changes links
+    static const int Reach = 2;
+
     RotateDotsMultsToRight()
     {}
 
@@ -612,20 +1149,14 @@ public:
 
     bool isApplicable(Dot&      node)
     {
-        if (const Dot* ptr = dynamic_cast<Dot*>(node.children_[0].get()))
-            return true;
-        if (const Mult* ptr = dynamic_cast<Mult*>(node.children_[0].get()))
-            return true;
-        return false;
+        return is<Dot>(node.children_[0]) or
+               is<Mult>(node.children_[0]);
     }
 
     bool isApplicable(Mult&     node)
     {
-        if (const Dot* ptr = dynamic_cast<Dot*>(node.children_[0].get()))
-            return true;
-        if (const Mult* ptr = dynamic_cast<Mult*>(node.children_[0].get()))
-            return true;
-        return false;
+        return is<Dot>(node.children_[0]) or
+               is<Mult>(node.children_[0]);
     }
 };
 
@@ -655,6 +1186,9 @@ class AttachDotsToUnitVectors
     //           / \
     //          Uj  Xij
 public:
+    // how deep under the returned node the rewrite changes links
+    static const int Reach = 2;
+
     AttachDotsToUnitVectors() {}
 
     Handle transform(Handle mult)
@@ -677,7 +1211,7 @@ public:
     bool isApplicable(Mult&     node)
     {
         Handle rightSide = node.children_[1];
-        if (const Dot* ptr = dynamic_cast<Dot*>(rightSide.get()))
+        if (is<Dot>(rightSide))
         {
             Has<UnitVec> hasVectors;
             if (not hasVectors.find(rightSide->children_[0]))
@@ -710,6 +1244,9 @@ class LiftUnitVectorUp
     //           / \
     //         Xk   Xij
 public:
+    // how deep under the returned node the rewrite changes links
+    static const int Reach = 2;
+
     LiftUnitVectorUp() {}
 
     Handle transform(Handle mult)
@@ -731,9 +1268,9 @@ public:
     bool isApplicable(Mult&     node)
     {
         Handle rightSide = node.children_[1];
-        if (const Mult* ptr = dynamic_cast<Mult*>(rightSide.get()))
+        if (is<Mult>(rightSide))
         {
-            if (const UnitVec* ptr = dynamic_cast<UnitVec*>(rightSide->children_[0].get()))
+            if (is<UnitVec>(rightSide->children_[0]))
             {
                 Has<UnitVec> hasVectors;
                 if (not hasVectors.find(node.children_[0]))
@@ -744,8 +1281,468 @@ public:
     }
 };
 
+// ################################################
+// ################################################
+// ################################################
+
+class UnitVecDotToDelta
+{
+    // pre-requiste: unit vectors have been lifted up to the dots (LiftUnitVectorUp)
+    // stating with: U_k.U_i*U_j*x_k*m_ij
+    //      .
+    //     / \
+    //    Uk  *
+    //       / \
+    //      Ui  *
+    //         / \
+    //        Uj  ...
+    // convert to: delta_ki*U_j*x_k*m_ij
+    //        *
+    //       / \
+    //   d_ki   *
+    //         / \
+    //        Uj  ...
+public:
+    // how deep under the returned node the rewrite changes links
+    static const int Reach = 2;
+
+    UnitVecDotToDelta() {}
+
+    Handle transform(Handle dot)
+    {
+        Handle left  = dot->children_[0];
+        Handle right = dot->children_[1];
+
+        if (is<UnitVec>(right))
+            return Handle(new Delta(left->children_[0], right->children_[0]));
+
+        Handle delta(new Delta(left->children_[0], right->children_[0]->children_[0]));
+        return Handle(new Mult(delta, right->children_[1]));
+    }
+
+    // for outer TransformAll to decide
+    template<typename Specific>
+    bool isApplicable(Specific& node)  { return false; }
+
+    bool isApplicable(Dot&      node)
+    {
+        if (not is<UnitVec>(node.children_[0]))
+            return false;
+
+        Handle rightSide = node.children_[1];
+        return is<UnitVec>(rightSide) or
+               (is<Mult>(rightSide) and is<UnitVec>(rightSide->children_[0]));
+    }
+};
+
+class ReduceDelta
+{
+    // given a summer whose index is tied to another by a delta in a product
+    // below it.. sum_k(...delta_ki*f(k)...) is ...f(i)...
+    // so swap k for i in the body, drop the delta, and drop the summer
+    //  starts as: sum_k(sum_i(sum_j(delta_ki*U_j*x_k*m_ij)))
+    //  converts to: sum_i(sum_j(U_j*x_i*m_ij))
+    //
+    // the summers come in runs (LiftSum leaves them stacked over one body) so
+    // a run is reduced in one go: the delta sites of the body are collected
+    // in one walk, each summer takes the first site on its index (in the order
+    // a walk from the summer would meet them), the swaps are chained by name
+    // and applied in a last walk. one summer at a time costs a walk of the
+    // body per summer and is quadratic on a dot chain.
+
+    struct Holder
+    {
+        Node* parent_;   // null at the top of the run
+        int   idx_;
+    };
+
+    struct Entry
+    {
+        // a delta sat in a Mult.. the Mults pre-order place then the side
+        std::size_t order_;
+        int         side_;
+        Node*       delta_;
+
+        bool operator<(const Entry& other) const
+        {
+            if (order_ != other.order_) return order_ < other.order_;
+            if (side_  != other.side_)  return side_  < other.side_;
+            return delta_ < other.delta_;
+        }
+    };
+
+    // the indexes with a delta site below each summer looked at since the
+    // last transform.. the summers of a run share one set
+    std::unordered_map<const Node*, std::shared_ptr<std::unordered_set<std::string> > > found_;
+
+    static const std::string& name(const Handle& var)
+    {
+        return static_cast<const Var*>(var.get())->name_;
+    }
+
+    static bool mayHold(const Handle& node,
+                        const Handle& var)
+    {
+        // the summaries rule out most subtrees without a walk
+        return (node->kinds_ & Node::bit(KindDelta)) and
+               (node->vars_ & var->vars_);
+    }
+
+    template <typename Visit>
+    static void sites(const Handle& body, Visit visit)
+    {
+        // pre-order over the parts of the body holding deltas.. visit(node,
+        // parent, idx, order) for each and the order counts the nodes seen
+        std::size_t order = 0;
+        std::vector<std::pair<Handle, Holder> > stack;
+        Holder top = { 0, -1 };
+        stack.push_back(std::make_pair(body, top));
+        while (not stack.empty())
+        {
+            Handle node   = stack.back().first;
+            Holder holder = stack.back().second;
+            stack.pop_back();
+            visit(node, holder, order++);
+
+            for (std::size_t childIdx = node->children_.size(); childIdx-- > 0; )
+            {
+                const Handle& child = node->children_[childIdx];
+                if (child->kinds_ & Node::bit(KindDelta))
+                {
+                    Holder below = { node.get(), static_cast<int>(childIdx) };
+                    stack.push_back(std::make_pair(child, below));
+                }
+            }
+        }
+    }
+
+    class Run
+    {
+        // one run of summers and the body under it being reduced
+        typedef std::set<Entry> Entries;
+
+        Handle                                         top_;
+        std::unordered_map<const Node*, Holder>        holders_;
+        std::unordered_map<const Node*, std::size_t>   orders_;
+        std::unordered_map<std::string, Entries>       entries_;   // by index
+        std::unordered_map<std::string, Handle>        swaps_;     // from -> to
+        Nodes                                          dropped_;   // kept alive to the end
+
+        std::string resolve(const std::string& var) const
+        {
+            std::string at = var;
+            for (auto sit = swaps_.find(at); sit != swaps_.end(); sit = swaps_.find(at))
+                at = name(sit->second);
+            return at;
+        }
+
+        Handle resolve(const Handle& var) const
+        {
+            Handle at = var;
+            for (auto sit = swaps_.find(name(at)); sit != swaps_.end(); sit = swaps_.find(name(at)))
+                at = sit->second;
+            return at;
+        }
+
+        void enter(Node* delta, Node* mult, int side)
+        {
+            Entry entry = { orders_[mult], side, delta };
+            entries_[resolve(name(delta->children_[0]))].insert(entry);
+            entries_[resolve(name(delta->children_[1]))].insert(entry);
+        }
+
+        void leave(Node* delta)
+        {
+            const Holder& holder = holders_[delta];
+            Entry entry = { orders_[holder.parent_], holder.idx_, delta };
+            entries_[resolve(name(delta->children_[0]))].erase(entry);
+            entries_[resolve(name(delta->children_[1]))].erase(entry);
+        }
+
+        void replace(Node* node, const Handle& with)
+        {
+            // node (a Mult or a summer) gives its place to one of its kids
+            Holder holder = holders_[node];
+            if (holder.parent_)
+            {
+                dropped_.push_back(holder.parent_->children_[holder.idx_]);
+                holder.parent_->children_[holder.idx_] = with;
+            }
+            else
+            {
+                dropped_.push_back(top_);
+                top_ = with;
+            }
+            holders_[with.get()] = holder;
+
+            // a delta moved up is a site of its new parent if that is a Mult
+            if (is<Delta>(with) and holder.parent_ and holder.parent_->kind_ == KindMult)
+                enter(with.get(), holder.parent_, holder.idx_);
+        }
+
+        bool reduce(const Handle& summer)
+        {
+            // the first site on the summers index.. a delta of the index with
+            // itself is just 1 so it goes and the next is tried
+            std::string from = resolve(name(summer->children_[0]));
+            for (;;)
+            {
+                auto eit = entries_.find(from);
+                if (eit == entries_.end() or eit->second.empty())
+                    return false;
+
+                Node* delta = eit->second.begin()->delta_;
+                Node* mult  = holders_[delta].parent_;
+                int   side  = holders_[delta].idx_;
+                leave(delta);
+                if (is<Delta>(mult->children_[1 - side]))
+                    leave(mult->children_[1 - side].get());
+                replace(mult, mult->children_[1 - side]);
+
+                Handle to = resolve(delta->children_[0]);
+                if (name(to) == from)
+                    to = resolve(delta->children_[1]);
+                if (name(to) == from)
+                    continue;
+
+                // every site on from is now a site on to
+                Entries& moving = entries_[from];
+                Entries& onto   = entries_[name(to)];
+                if (onto.size() < moving.size())
+                    onto.swap(moving);
+                onto.insert(moving.begin(), moving.end());
+                entries_.erase(from);
+                swaps_[from] = to;
+
+                replace(summer.get(), summer->children_[1]);
+                return true;
+            }
+        }
+
+        void substitute()
+        {
+            // the chained swaps in one walk
+            if (swaps_.empty())
+                return;
+
+            Node::VarMask from = 0;
+            for (const std::pair<const std::string, Handle>& swap : swaps_)
+                from |= Node::varBit(swap.first);
+
+            Nodes stack(1, top_);
+            while (not stack.empty())
+            {
+                Handle node = stack.back();
+                stack.pop_back();
+                for (Handle& child : node->children_)
+                {
+                    if (is<Var>(child))
+                    {
+                        if (swaps_.count(name(child)))
+                            child = resolve(child);
+                    }
+                    else if (child->vars_ & from)
+                    {
+                        stack.push_back(child);
+                    }
+                }
+            }
+        }
+
+    public:
+        Run(const Handle& summer) :
+            top_(summer),
+            holders_(),
+            orders_(),
+            entries_(),
+            swaps_(),
+            dropped_()
+        {}
+
+        Handle process()
+        {
+            Nodes  run;
+            Handle body = top_;
+            Holder holder = { 0, -1 };
+            while (is<Summer>(body))
+            {
+                holders_[body.get()] = holder;
+                holder.parent_ = body.get();
+                holder.idx_    = 1;
+                run.push_back(body);
+                body = body->children_[1];
+            }
+
+            // the sites in the order a walk from any of the summers meets them
+            sites(body, [this, &holder](const Handle& node, Holder above, std::size_t order)
+            {
+                holders_[node.get()] = above.parent_ ? above : holder;
+                orders_[node.get()]  = order;
+                if (not is<Mult>(node))
+                    return;
+                for (int side = 0; side < 2; ++side)
+                    if (is<Delta>(node->children_[side]))
+                        enter(node->children_[side].get(), node.get(), side);
+            });
+
+            for (const Handle& summer : run)
+                reduce(summer);
+            substitute();
+            return top_;
+        }
+    };
+
+public:
+    // unlinks and substitutes anywhere under the summer
+    static const int Reach = -1;
+
+    ReduceDelta() :
+        found_()
+    {}
+
+    Handle transform(Handle summer)
+    {
+        // the whole run from here down.. the sets found so far are stale
+        found_.clear();
+        return Run(summer).process();
+    }
+
+    // for outer TransformAll to decide
+    template<typename Specific>
+    bool isApplicable(Specific& node)  { return false; }
+
+    bool isApplicable(Summer&   node)
+    {
+        // the delta must sit in a product somewhere under the summer.. the
+        // body below the run is walked once for all its summers
+        const Handle& var = node.children_[0];
+        if (not mayHold(node.children_[1], var))
+            return false;
+
+        auto fit = found_.find(&node);
+        if (fit == found_.end())
+        {
+            std::vector<const Node*> run(1, &node);
+            Handle body = node.children_[1];
+            std::shared_ptr<std::unordered_set<std::string> > vars;
+            while (is<Summer>(body) and not vars)
+            {
+                auto bit = found_.find(body.get());
+                if (bit != found_.end())
+                    vars = bit->second;
+                else
+                    run.push_back(body.get());
+                body = body->children_[1];
+            }
+
+            if (not vars)
+            {
+                vars = std::make_shared<std::unordered_set<std::string> >();
+                sites(body, [&vars](const Handle& node, Holder, std::size_t)
+                {
+                    if (not is<Mult>(node))
+                        return;
+                    for (const Handle& kid : node->children_)
+                        if (is<Delta>(kid))
+                        {
+                            vars->insert(name(kid->children_[0]));
+                            vars->insert(name(kid->children_[1]));
+                        }
+                });
+            }
+
+            for (const Node* summer : run)
+                found_[summer] = vars;
+            fit = found_.find(&node);
+        }
+        return fit->second->count(name(var)) != 0;
+    }
+};
+
+// ################################################
+// ################################################
+// ################################################
+
+class DiagonalToDelta
+{
+    // a diagonal matrix is zero off its diagonal.. d_ij is delta_ij*d_ii, so
+    // run it before UnitVecDotToDelta/ReduceDelta and a summer goes with it
+    //  starts as: sum_k(sum_i(sum_j(U_k.U_i*U_j*x_k*d_ij)))
+    //  converts to: sum_k(sum_i(sum_j(U_k.U_i*U_j*x_k*delta_ij*d_ii)))
+    //  and reduces to: sum_j(U_j*x_j*d_jj)
+public:
+    // how deep under the returned node the rewrite changes links
+    static const int Reach = 2;
+
+    DiagonalToDelta() {}
+
+    Handle transform(Handle node)
+    {
+        const Element* diag  = static_cast<const Element*>(node.get());
+        const Handle&  left  = diag->children_[0];
+        const Handle&  right = diag->children_[1];
+
+        Element* element = new Element(diag->name_, FormDiagonal);
+        Handle   exp(element);
+        element->children_.push_back(left);
+        element->children_.push_back(left);
+        element->refresh();
+
+        return Handle(new Mult(Handle(new Delta(left, right)), exp));
+    }
+
+    // for outer TransformAll to decide
+    template<typename Specific>
+    bool isApplicable(Specific& node)  { return false; }
+
+    bool isApplicable(Element&  node)
+    {
+        return node.form_ == FormDiagonal and
+               node.children_.size() == 2 and
+               not sameVar(node.children_[0], node.children_[1]);
+    }
+
+    static bool sameVar(const Handle& a, const Handle& b)
+    {
+        return is<Var>(a) and is<Var>(b) and
+               static_cast<const Var*>(a.get())->name_ == static_cast<const Var*>(b.get())->name_;
+    }
+};
+
+class CanonicalSymmetric
+{
+    // a symmetric matrix reads the same either way round.. so s_ji is put in
+    // index name order as s_ij, then two reads that only differ by the order
+    // are the same subtree for CommonSubExpr (and the same kernel read)
+public:
+    // how deep under the returned node the rewrite changes links
+    static const int Reach = 1;
+
+    CanonicalSymmetric() {}
+
+    Handle transform(Handle node)
+    {
+        std::swap(node->children_[0], node->children_[1]);
+        return node;
+    }
+
+    // for outer TransformAll to decide
+    template<typename Specific>
+    bool isApplicable(Specific& node)  { return false; }
+
+    bool isApplicable(Element&  node)
+    {
+        if (node.form_ != FormSymmetric or node.children_.size() != 2 or
+            not is<Var>(node.children_[0]) or not is<Var>(node.children_[1]))
+            return false;
+        return static_cast<const Var*>(node.children_[1].get())->name_ <
+               static_cast<const Var*>(node.children_[0].get())->name_;
+    }
+};
 
 //TODO simple optimiser
-// 1. bring the Unit vectors together
-// 2. then convert the Unit vectors seperated via dots to sigmas.
-// 3. then locate summers tied to sigmas varables and reduce sigmas to 1
+// 1. bring the Unit vectors together (LiftUnitVectorUp)
+// 2. then convert the Unit vectors seperated via dots to sigmas. (UnitVecDotToDelta)
+// 3. then locate summers tied to sigmas varables and reduce sigmas to 1 (ReduceDelta)
+
+#endif
@@ -1,6 +1,9 @@
 #include "SummerGraph.hh"
 
 #include "test.hh"
+#include "test.summer.hh"
+
+#include <unordered_set>
 
 void testExpressions()
 {
@@ -14,9 +17,234 @@ void testExpressions()
     EXPECT_STREAMED_AS("a*b") << mult;
 }
 
+std::size_t countNodes(const Handle& node)
+{
+    std::size_t count = 1;
+    for (const Handle& kid : node->children_)
+        count += countNodes(kid);
+    return count;
+}
+
+bool summariesFresh(const Handle& node)
+{
+    // true if every cached kind/var summary matches a rebuild from scratch
+    for (const Handle& kid : node->children_)
+        if (not summariesFresh(kid))
+            return false;
+    return not node->refresh();
+}
+
+Handle chain(int len)
+{
+    // t0_a0b0.t1_a1b1.t2_a2b2...
+    Handle l = Make::tensor("t0", {"a0","b0"});
+    for (int t = 1; t < len; ++t)
+    {
+        std::string id = std::to_string(t);
+        l = Make::dot(l, Make::tensor("t" + id, {"a" + id, "b" + id}));
+    }
+    return l;
+}
+
+void testWorklist()
+{
+    // the worklist only looks near each rewrite.. so the isApplicable calls
+    // stay a small multiple of the rewrites plus the sweeps over the tree
+    Handle l = chain(32);
+    std::size_t nodes = countNodes(l);
+
+    TransformAll<LiftSum> lift;
+    l = lift.process(l);
+    EXPECT_EQ(true, (lift.checks() < 8 * (lift.rewrites() + nodes)));
+
+    TransformAll<RotateDotsMultsToRight> allDotsRotate;
+    l = allDotsRotate.process(l);
+    EXPECT_EQ(true, (allDotsRotate.checks() < 8 * (allDotsRotate.rewrites() + nodes)));
+    EXPECT_EQ(true, summariesFresh(l));
+
+    // a fixed point.. running again only costs the one confirming sweep
+    TransformAll<LiftSum> again;
+    l = again.process(l);
+    EXPECT_EQ(0u, again.rewrites());
+    EXPECT_EQ(countNodes(l), again.checks());
+
+    // a chains summers end up in one run over the product.. its deltas are
+    // reduced in one rewrite, not a walk of the body per summer
+    l = chain(64);
+    TransformAll<UnitVecDotToDelta> dotsToDeltas;
+    l = dotsToDeltas.process(rewrite(l));
+    nodes = countNodes(l);
+    TransformAll<ReduceDelta> reduceDeltas;
+    l = reduceDeltas.process(l);
+    EXPECT_EQ(1u, reduceDeltas.rewrites());
+    EXPECT_EQ(true, (reduceDeltas.checks() < 4 * nodes));
+    EXPECT_EQ(false, Has<Delta>().find(l));
+    EXPECT_EQ(true, summariesFresh(l));
+
+    // same order the old restart from the top loop produced
+    l = chain(3);
+    TransformAll<LiftSum> liftShort;
+    l = liftShort.process(l);
+    EXPECT_STREAMED_AS("sum_a2(sum_b2(sum_a0(sum_b0(sum_a1(sum_b1(U_a0*U_b0*t0_a0b0.U_a1*U_b1*t1_a1b1.U_a2*U_b2*t2_a2b2))))))") << l;
+}
+
+std::size_t countUnique(const Handle& node, std::unordered_set<const Node*>& seen)
+{
+    // distinct non index nodes
+    if (is<Var>(node) or not seen.insert(node.get()).second)
+        return 0;
+
+    std::size_t count = 1;
+    for (const Handle& kid : node->children_)
+        count += countUnique(kid, seen);
+    return count;
+}
+
+std::size_t countUnique(const Handle& node)
+{
+    std::unordered_set<const Node*> seen;
+    return countUnique(node, seen);
+}
+
+void testCommonSubExpr()
+{
+    // the same x.m term built twice
+    Handle l = Make::dot(Make::dot(Make::tensor("x", {"k"}),
+                                   Make::tensor("m", {"i","j"})),
+                         Make::dot(Make::tensor("x", {"k"}),
+                                   Make::tensor("m", {"i","j"})));
+    std::string before = rendered(l);
+    std::size_t nodes  = countUnique(l);
+
+    CommonSubExpr cse;
+    l = cse.process(l);
+    EXPECT_EQ(l->children_[0], l->children_[1]);
+    EXPECT_EQ(before, rendered(l));
+    EXPECT_EQ(nodes / 2 + 1, countUnique(l));
+
+    // the rewrites split the shared halves back out and cse finds them again
+    TransformAll<LiftSum> lift;
+    l = lift.process(l);
+    EXPECT_STREAMED_AS("sum_k(sum_i(sum_j(sum_k(sum_i(sum_j(U_k*x_k.U_i*U_j*m_ij.U_k*x_k.U_i*U_j*m_ij))))))") << l;
+    EXPECT_EQ(nodes, countUnique(l));
+
+    std::size_t hits = cse.hits();
+    l = cse.process(l);
+    EXPECT_EQ(true, (cse.hits() > hits));
+    EXPECT_EQ(true, (countUnique(l) < nodes));
+    EXPECT_EQ(true, summariesFresh(l));
+}
+
+Handle xs(const Handle& idx, int count, bool right)
+{
+    // x_k*x_k*..*x_k leaning right (as rotated) or left (as built by hand)
+    Handle l(new Element("x", {idx}));
+    for (int i = 1; i < count; ++i)
+    {
+        Handle x(new Element("x", {idx}));
+        l = right ? Handle(new Mult(x, l)) : Handle(new Mult(l, x));
+    }
+    return l;
+}
+
+void testDeep()
+{
+    // far deeper than the stack would take one frame per level
+    const int depth = 1000000;
+    Handle k(new Var("k"));
+
+    Handle l = xs(k, depth, true);
+    std::string text = rendered(l);
+    EXPECT_EQ(4u * depth - 1, text.size());
+    EXPECT_EQ("x_k*x_k*", text.substr(0, 8));
+
+    // all the x_k are the same.. the Mults are not
+    CommonSubExpr cse;
+    l = cse.process(l);
+    EXPECT_EQ(std::size_t(depth - 1), cse.hits());
+    EXPECT_EQ(l->children_[0], l->children_[1]->children_[0]);
+    EXPECT_EQ(text, rendered(l));
+
+    Handle sums = l;
+    for (int i = 0; i < depth; ++i)
+        sums = Handle(new Summer(Handle(new Var("i")), sums));
+    LocateLastSum lls;
+    EXPECT_EQ(l, lls.find(sums)->children_[1]);
+    sums.reset();
+
+    // rewriting a long hand built chain.. Unshare splits the x_k back out
+    l = xs(k, depth / 10, false);
+    TransformAll<RotateDotsMultsToRight> allDotsRotate;
+    l = allDotsRotate.process(l);
+    EXPECT_EQ(std::size_t(depth / 10 - 2), allDotsRotate.rewrites());
+    EXPECT_EQ(true, is<Element>(l->children_[0]));
+    EXPECT_EQ(rendered(xs(k, depth / 10, true)), rendered(l));
+
+    // the delta is found and k swapped for j all the way down
+    Handle j(new Var("j"));
+    l = Handle(new Summer(k, Handle(new Mult(Handle(new Delta(k, j)),
+                                             xs(k, depth / 10, true)))));
+    TransformAll<ReduceDelta> reduceDeltas;
+    l = reduceDeltas.process(l);
+    EXPECT_EQ(rendered(xs(j, depth / 10, true)), rendered(l));
+}
+
+void testStructure()
+{
+    // x.d with d diagonal.. the delta it becomes takes one of the summers
+    Handle l = Make::dot(Make::tensor("x", {"k"}),
+                         Make::tensor("d", {"i","j"}, {}, FormDiagonal));
+    TransformAll<LiftSum>                 lift;
+    TransformAll<RotateDotsMultsToRight>  allDotsRotate;
+    TransformAll<AttachDotsToUnitVectors> moveDotsToVectors;
+    TransformAll<LiftUnitVectorUp>        liftUnitVecUp;
+    l = liftUnitVecUp.process(moveDotsToVectors.process(allDotsRotate.process(lift.process(l))));
+
+    TransformAll<DiagonalToDelta> diagonals;
+    l = diagonals.process(l);
+    EXPECT_STREAMED_AS("sum_k(sum_i(sum_j(U_k.U_i*U_j*x_k*delta_ij*d_ii)))") << l;
+    EXPECT_EQ(1u, diagonals.rewrites());
+
+    TransformAll<UnitVecDotToDelta> dotsToDeltas;
+    TransformAll<ReduceDelta>       reduceDeltas;
+    l = reduceDeltas.process(dotsToDeltas.process(l));
+    EXPECT_STREAMED_AS("sum_j(U_j*x_j*d_jj)") << l;
+
+    // the folded d_jj is left alone
+    TransformAll<DiagonalToDelta> again;
+    again.process(l);
+    EXPECT_EQ(0u, again.rewrites());
+
+    // s_ji and s_ij are the same read of a symmetric s
+    Handle s(new Mult(Make::tensor("s", {"j","i"}, {}, FormSymmetric),
+                      Make::tensor("s", {"i","j"}, {}, FormSymmetric)));
+    TransformAll<CanonicalSymmetric> symmetric;
+    s = symmetric.process(s);
+    EXPECT_STREAMED_AS("sum_j(sum_i(U_j*U_i*s_ij))*sum_i(sum_j(U_i*U_j*s_ij))") << s;
+    EXPECT_EQ(1u, symmetric.rewrites());
+
+    CommonSubExpr cse;
+    s = cse.process(s);
+    const Handle& first  = s->children_[0]->children_[1]->children_[1]->children_[1]->children_[1];
+    const Handle& second = s->children_[1]->children_[1]->children_[1]->children_[1]->children_[1];
+    EXPECT_EQ(first, second);
+
+    // but a dense s_ji is a different matrix
+    Handle dense = Make::tensor("s", {"j","i"});
+    TransformAll<CanonicalSymmetric> none;
+    EXPECT_STREAMED_AS("sum_j(sum_i(U_j*U_i*s_ji))") << none.process(dense);
+
+    EXPECT_THROW(Make::tensor("v", {"i"}, {}, FormBanded, 1),
+                 "Graph element v has rank 1 but its form needs 2");
+}
+
 int main()
 {
     testExpressions();
+    testWorklist();
+    testCommonSubExpr();
+    testDeep();
+    testStructure();
 
     Handle m = Make::tensor("m",
                             {"i","j"});
@@ -58,4 +286,18 @@ int main()
     l = liftUnitVecUp.process(l);
     EXPECT_STREAMED_AS("sum_k(sum_i(sum_j(U_k.U_i*U_j*x_k*m_ij)))") << l;
 
+    TransformAll<UnitVecDotToDelta> dotsToDeltas;
+    l = dotsToDeltas.process(l);
+    EXPECT_STREAMED_AS("sum_k(sum_i(sum_j(delta_ki*U_j*x_k*m_ij)))") << l;
+
+    TransformAll<ReduceDelta> reduceDeltas;
+    l = reduceDeltas.process(l);
+    EXPECT_STREAMED_AS("sum_i(sum_j(U_j*x_i*m_ij))") << l;
+
+    // the subtree summaries followed all the rewrites
+    EXPECT_EQ(true, summariesFresh(l));
+    EXPECT_EQ(false, Has<Delta>().find(l));
+    EXPECT_EQ(false, Has<Dot>().find(l));
+    EXPECT_EQ(true,  Has<UnitVec>().find(l));
+    EXPECT_EQ((Node::varBit("i") | Node::varBit("j")), l->vars_);
 }
@@ -0,0 +1,373 @@
+#ifndef SummerJit_HH
+#define SummerJit_HH
+
+#include "SummerCache.hh"
+
+#include <map>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <memory>
+#include <sstream>
+#include <fstream>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+
+#include <dlfcn.h>
+#include <unistd.h>
+
+// source level jit for planned graphs
+//
+// a Plan is turned into one C++ function with every shape, stride, loop bound
+// and arena offset baked in as a constant, built into a shared object with the
+// system compiler and dlopened. the object is kept on disk under a hash of the
+// graph as it was handed in (before any rewrites) plus the type and the bound
+// shapes, so a later run.. or a later process.. with the same graph goes
+// straight to the loaded function without the passes or the compiler.
+//
+// the bound tensors are only read at run time so rebinding new data of the
+// same shape reuses the kernel. the key, the files and the lookup are the
+// DiskCache ones PlanCache has (SummerCache.hh). links against libdl (-ldl on
+// older glibc)
+
+// ################################################
+// ################################################
+// ################################################
+
+template <typename Type>
+class Jit : public DiskCache<Type>
+{
+public:
+    typedef typename Tensor<Type>::Shape    Shape;
+    typedef typename DiskCache<Type>::Passes Passes;
+
+private:
+    typedef void (*Run)(const Type* const* in, Type* arena);
+    typedef unsigned long (*Layout)(unsigned long* shape, unsigned long size);
+    typedef unsigned long (*Abi)();
+
+    // bumped whenever the entry points change.. an older object is rebuilt
+    static const unsigned long Version = 2;
+
+    struct Compiled
+    {
+        void*                               handle_;
+        Run                                 run_;
+        std::vector<std::string>            inputs_;   // bound names in call order
+        std::shared_ptr<std::vector<Type> > arena_;
+        Tensor<Type>                        output_;
+    };
+
+    using DiskCache<Type>::exec_;
+
+    std::string                                   compiler_;
+    std::map<std::string, std::unique_ptr<Compiled> > kernels_;
+    std::size_t                                   hits_;
+
+    Jit(const Jit&);
+    Jit& operator=(const Jit&);
+
+    static std::string offsets(const std::vector<std::size_t>& stride)
+    {
+        // the flat offset for the current loop indexes
+        std::stringstream ss;
+        for (std::size_t l = 0; l < stride.size(); ++l)
+        {
+            if (stride[l] == 0) continue;
+            if (ss.tellp() > 0) ss << " + ";
+            ss << "l" << l << "*" << stride[l] << "ul";
+        }
+        if (ss.tellp() == 0) ss << "0";
+        return ss.str();
+    }
+
+    std::string pointer(const Plan<Type>& plan,
+                        int step,
+                        const std::vector<std::string>& inputs) const
+    {
+        const typename Plan<Type>::Step& at = plan.steps_[step];
+        std::stringstream ss;
+        if (at.op_ == Plan<Type>::View)
+            ss << "in[" << input(at.kernel_.nest_.reads_[0].name_, inputs) << "]";
+        else
+            ss << "(arena + " << plan.buffers_[at.buffer_].offset_ << "ul)";
+        return ss.str();
+    }
+
+    static std::size_t input(const std::string& name,
+                             const std::vector<std::string>& inputs)
+    {
+        std::vector<std::string>::const_iterator iit = std::find(inputs.begin(), inputs.end(), name);
+        if (iit == inputs.end())
+        {
+            std::stringstream ss;
+            ss << "Jit kernel reads " << name << " which the graph doesnt name";
+            throw std::runtime_error(ss.str());
+        }
+        return iit - inputs.begin();
+    }
+
+    std::string emit(const Plan<Type>& plan,
+                     const std::vector<std::string>& inputs) const
+    {
+        const char* type = JitType<Type>::name();
+
+        std::stringstream src;
+        src << "// generated by SummerJit.hh\n"
+            << "#include <cstdint>\n\n"
+            << "typedef " << type << " T;\n\n"
+            << "extern \"C\" void summer_run(const T* const* in, T* arena)\n"
+            << "{\n";
+
+        for (std::size_t s = 0; s < plan.steps_.size(); ++s)
+        {
+            const typename Plan<Type>::Step& step = plan.steps_[s];
+            if (step.op_ == Plan<Type>::View)
+                continue;
+
+            std::string out  = pointer(plan, s, inputs);
+            std::size_t size = step.out_.size();
+            src << "    {\n"
+                << "        T* out = " << out << ";\n";
+
+            if (step.op_ == Plan<Type>::Kernel)
+            {
+                const LoopNest<Type>& nest = step.kernel_.nest_;
+                src << "        for (unsigned long i = 0; i < " << size << "ul; ++i) out[i] = 0;\n";
+
+                std::string indent = "        ";
+                for (std::size_t l = 0; l < nest.extent_.size(); ++l)
+                {
+                    src << indent << "for (unsigned long l" << l << " = 0; l" << l
+                        << " < " << nest.extent_[l] << "ul; ++l" << l << ")\n";
+                    indent += "    ";
+                }
+                src << indent << "{\n";
+                for (const std::pair<int,int>& delta : nest.deltas_)
+                    src << indent << "    if (l" << delta.first << " != l" << delta.second << ") continue;\n";
+                src << indent << "    out[" << offsets(nest.outStride_) << "] += T(1)";
+                for (const typename LoopNest<Type>::Read& read : nest.reads_)
+                    src << " * in[" << input(read.name_, inputs) << "][" << offsets(read.stride_) << "]";
+                src << ";\n"
+                    << indent << "}\n";
+            }
+            else if (step.op_ == Plan<Type>::Contract)
+            {
+                const Shape& left = plan.steps_[step.left_].shape_;
+                std::size_t K = left.back();
+                std::size_t M = plan.steps_[step.left_].out_.size() / K;
+                std::size_t N = plan.steps_[step.right_].out_.size() / K;
+                src << "        const T* a = " << pointer(plan, step.left_,  inputs) << ";\n"
+                    << "        const T* b = " << pointer(plan, step.right_, inputs) << ";\n"
+                    << "        for (unsigned long i = 0; i < " << size << "ul; ++i) out[i] = 0;\n"
+                    << "        for (unsigned long m = 0; m < " << M << "ul; ++m)\n"
+                    << "            for (unsigned long k = 0; k < " << K << "ul; ++k)\n"
+                    << "            {\n"
+                    << "                const T av = a[m*" << K << "ul + k];\n"
+                    << "                for (unsigned long n = 0; n < " << N << "ul; ++n)\n"
+                    << "                    out[m*" << N << "ul + n] += av * b[k*" << N << "ul + n];\n"
+                    << "            }\n";
+            }
+            else if (step.op_ == Plan<Type>::Scale)
+            {
+                src << "        const T  s = " << pointer(plan, step.left_,  inputs) << "[0];\n"
+                    << "        const T* x = " << pointer(plan, step.right_, inputs) << ";\n"
+                    << "        for (unsigned long i = 0; i < " << size << "ul; ++i) out[i] = s * x[i];\n";
+            }
+            src << "    }\n";
+        }
+        src << "}\n\n";
+
+        // where the result sits and how big the arena has to be
+        const typename Plan<Type>::Step& result = plan.steps_[plan.outputs_[0]];
+        const Shape& shape = result.shape_;
+        src << "extern \"C\" unsigned long summer_layout(unsigned long* shape, unsigned long size)\n"
+            << "{\n"
+            << "    // shape is rank, dims.., result offset, arena size.. only\n"
+            << "    // filled in if size is enough, the count is returned either way\n";
+        std::vector<std::size_t> layout(1, shape.size());
+        layout.insert(layout.end(), shape.begin(), shape.end());
+        layout.push_back(plan.buffers_[result.buffer_].offset_);
+        layout.push_back(plan.peak());
+        src << "    if (size < " << layout.size() << "ul) return " << layout.size() << "ul;\n";
+        for (std::size_t at = 0; at < layout.size(); ++at)
+            src << "    shape[" << at << "] = " << layout[at] << "ul;\n";
+        src << "    return " << layout.size() << "ul;\n"
+            << "}\n\n"
+            << "extern \"C\" unsigned long summer_version() { return " << Version << "ul; }\n";
+        return src.str();
+    }
+
+    void compile(const std::string& name, const std::string& source)
+    {
+        std::string src = this->path(name, ".cc");
+        std::string so  = this->path(name, ".so");
+        {
+            std::ofstream file(src.c_str());
+            file << source;
+            if (not file)
+            {
+                std::stringstream ss;
+                ss << "Jit could not write " << src;
+                throw std::runtime_error(ss.str());
+            }
+        }
+
+        std::string command;
+        bool built = DiskCache<Type>::replace(so, [&](const std::string& tmp)
+        {
+            std::stringstream cmd;
+            cmd << compiler_ << " -O3 -shared -fPIC -o " << tmp << " " << src
+                << " 2> " << this->path(name, ".log");
+            command = cmd.str();
+            return std::system(command.c_str()) == 0;
+        });
+        if (not built)
+        {
+            std::stringstream ss;
+            ss << "Jit compile failed: " << command;
+            throw std::runtime_error(ss.str());
+        }
+    }
+
+    Compiled* open(const std::string& name, const std::vector<std::string>& inputs)
+    {
+        // null if it isnt on disk or was built by an older Jit
+        std::string so = this->path(name, ".so");
+        if (access(so.c_str(), R_OK) != 0)
+            return 0;
+
+        void* handle = dlopen(so.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (not handle)
+        {
+            std::stringstream ss;
+            ss << "Jit could not load " << so << ": " << dlerror();
+            throw std::runtime_error(ss.str());
+        }
+
+        Abi abi = reinterpret_cast<Abi>(dlsym(handle, "summer_version"));
+        if (not abi or abi() != Version)
+        {
+            dlclose(handle);
+            return 0;
+        }
+
+        Run    run    = reinterpret_cast<Run>(dlsym(handle, "summer_run"));
+        Layout layout = reinterpret_cast<Layout>(dlsym(handle, "summer_layout"));
+        if (not run or not layout)
+        {
+            dlclose(handle);
+            std::stringstream ss;
+            ss << "Jit object " << so << " is missing its entry points";
+            throw std::runtime_error(ss.str());
+        }
+
+        // the count first then the layout.. rank, dims, result offset and
+        // arena size, checked as the object may be off disk
+        std::vector<unsigned long> info(layout(0, 0));
+        std::size_t used = layout(info.data(), info.size());
+        Shape shape;
+        if (used == info.size() and used >= 3 and info[0] == used - 3)
+            shape.assign(info.begin() + 1, info.begin() + 1 + info[0]);
+        std::size_t size = 1;
+        for (std::size_t len : shape) size *= len;
+        if (shape.size() + 3 != used or info[used-2] + size > info[used-1])
+        {
+            dlclose(handle);
+            std::stringstream ss;
+            ss << "Jit object " << so << " has a bad layout";
+            throw std::runtime_error(ss.str());
+        }
+
+        std::unique_ptr<Compiled> made(new Compiled);
+        made->handle_ = handle;
+        made->run_    = run;
+        made->inputs_ = inputs;
+        made->arena_.reset(new std::vector<Type>(info[used-1]));
+        made->output_ = Tensor<Type>(shape, made->arena_->data() + info[used-2], made->arena_);
+
+        Compiled* kernel = made.get();
+        kernels_[name] = std::move(made);
+        return kernel;
+    }
+
+public:
+    // compiler is run through the shell
+    Jit(const Executor<Type>& exec,
+        const std::string& dir,
+        const std::string& compiler = "c++") :
+        DiskCache<Type>(exec, dir),
+        compiler_(compiler),
+        kernels_(),
+        hits_(0)
+    {}
+
+    ~Jit()
+    {
+        for (std::pair<const std::string, std::unique_ptr<Compiled> >& kernel : kernels_)
+            dlclose(kernel.second->handle_);
+    }
+
+    // the generated source for exp after passes.. what gets compiled
+    std::string source(const Handle& exp, const Passes& passes = Passes()) const
+    {
+        Handle ready = passes ? passes(exp) : exp;
+        return emit(exec_.plan(ready), this->inputs(exp));
+    }
+
+    Tensor<Type> run(const Handle& exp, const Passes& passes = Passes())
+    {
+        // passes are only run (and the plan only built) when nothing is cached
+        std::vector<std::string> inputs = this->inputs(exp);
+        std::string              name   = this->key(exp);
+
+        Compiled* kernel = 0;
+        typename std::map<std::string, std::unique_ptr<Compiled> >::iterator kit = kernels_.find(name);
+        if (kit != kernels_.end())
+        {
+            kernel = kit->second.get();
+            ++hits_;
+        }
+        else
+        {
+            kernel = this->template fetch<Compiled*>(
+                name,
+                [this, &inputs](const std::string& name, Compiled*& found)
+                {
+                    return (found = open(name, inputs)) != 0;
+                },
+                [this, &name, &inputs, &exp, &passes]()
+                {
+                    compile(name, source(exp, passes));
+                    Compiled* built = open(name, inputs);
+                    if (not built)
+                    {
+                        std::stringstream ss;
+                        ss << "Jit object " << this->path(name, ".so") << " did not load";
+                        throw std::runtime_error(ss.str());
+                    }
+                    return built;
+                });
+        }
+
+        std::vector<const Type*> in;
+        for (const std::string& input : kernel->inputs_)
+            in.push_back(TensorUtils<Type>::data(exec_.tensor(input)).data());
+        kernel->run_(in.data(), kernel->arena_->data());
+
+        // copied out.. output_ sits in the kernels arena and the next run
+        // writes over it
+        Type* result = TensorUtils<Type>::data(kernel->output_).data();
+        return Tensor<Type>(TensorUtils<Type>::shape(kernel->output_),
+                            result,
+                            result + kernel->output_.size());
+    }
+
+    // kernels built, read back off disk and found already loaded
+    std::size_t compiles() const { return this->builds(); }
+    std::size_t hits()     const { return hits_; }
+};
+
+#endif
@@ -0,0 +1,117 @@
+#include "SummerJit.hh"
+
+#include "test.hh"
+#include "test.summer.hh"
+
+#include <fstream>
+
+void testJit(const std::string& dir)
+{
+    Tensor<int> xData({3}, {1,2,3});
+    Tensor<int> mData({3,4}, {1,2,3,4, 5,6,7,8, 9,10,11,12});
+
+    Executor<int> exec;
+    exec.bind("x", xData)
+        .bind("m", mData)
+        .bind("A", Tensor<int>({2,3}, {1,2,3, 4,5,6}))
+        .bind("B", Tensor<int>({3,2}, {1,0, 0,1, 1,1}))
+        .bind("C", Tensor<int>({2,2}, {2,1, 1,2}));
+
+    int passes = 0;
+    Jit<int>::Passes counted = [&passes](const Handle& l) { ++passes; return optimise(l); };
+
+    // the shapes are constants in the generated code
+    std::string src = Jit<int>(exec, dir).source(xm(), optimise);
+    EXPECT_EQ(true, (src.find("l0 < 3ul") != std::string::npos));
+    EXPECT_EQ(true, (src.find("l1 < 4ul") != std::string::npos));
+
+    Tensor<int> expXM = TensorUtils<int>::dot(xData, mData);
+    {
+        Jit<int> jit(exec, dir);
+        EXPECT_EQ(expXM, jit.run(xm(), counted));
+        EXPECT_EQ(1u, jit.compiles());
+        EXPECT_EQ(1, passes);
+
+        // same graph again.. no passes and no compiler
+        EXPECT_EQ(expXM, jit.run(xm(), counted));
+        EXPECT_EQ(1u, jit.compiles());
+        EXPECT_EQ(1u, jit.hits());
+        EXPECT_EQ(1, passes);
+
+        // dot steps and a chain left in order
+        Tensor<int> expChain = exec.run(chain());
+        EXPECT_EQ(expChain, jit.run(chain()));
+        EXPECT_EQ(2u, jit.compiles());
+    }
+
+    // a new Jit (or process) finds the objects on disk
+    {
+        Jit<int> jit(exec, dir);
+        EXPECT_EQ(expXM, jit.run(xm(), counted));
+        EXPECT_EQ(0u, jit.compiles());
+        EXPECT_EQ(1u, jit.loads());
+        EXPECT_EQ(1, passes);
+
+        // new data of the same shape runs on the same kernel.. and a result
+        // already handed back isnt written over by the next run
+        Tensor<int> before = jit.run(xm(), counted);
+        Tensor<int> other({3}, {0,1,0});
+        exec.bind("x", other);
+        EXPECT_EQ(TensorUtils<int>::dot(other, mData), jit.run(xm(), counted));
+        EXPECT_EQ(expXM, before);
+        EXPECT_EQ(0u, jit.compiles());
+
+        // a new shape is a new kernel
+        Tensor<int> wide({3,2}, {1,2, 3,4, 5,6});
+        exec.bind("m", wide);
+        EXPECT_EQ(TensorUtils<int>::dot(other, wide), jit.run(xm(), counted));
+        EXPECT_EQ(1u, jit.compiles());
+        EXPECT_EQ(2, passes);
+    }
+
+    // an object from an older Jit (no summer_version) is built again rather
+    // than handed a layout buffer it doesnt know the size of
+    {
+        std::ofstream old(dir + "/old.cc");
+        old << "extern \"C\" void summer_run(const int* const*, int*) {}\n"
+            << "extern \"C\" unsigned long summer_layout(unsigned long* shape)\n"
+            << "{ shape[0] = 0; shape[1] = 0; shape[2] = 1; return 3ul; }\n";
+    }
+    std::system(("for so in " + dir + "/summer_*.so; do g++ -shared -fPIC -o $so "
+                 + dir + "/old.cc; done").c_str());
+    {
+        Jit<int> jit(exec, dir);
+        EXPECT_EQ(TensorUtils<int>::dot(exec.tensor("x"), exec.tensor("m")), jit.run(xm()));
+        EXPECT_EQ(1u, jit.compiles());
+        EXPECT_EQ(0u, jit.loads());
+    }
+
+    // the file name has the hash in it so only check the front
+    std::string error;
+    try
+    {
+        Jit<int>(exec, dir + "/missing").run(xm());
+    }
+    catch (std::exception& e)
+    {
+        error = e.what();
+    }
+    EXPECT_EQ(0u, error.find("Jit could not write " + dir + "/missing/summer_"));
+}
+
+int main()
+{
+    char tmpl[] = "/tmp/summer_jit_XXXXXX";
+    std::string dir = mkdtemp(tmpl);
+
+    try
+    {
+        testJit(dir);
+    }
+    catch (std::exception& e)
+    {
+        std::cout << "Opps... " << e.what() << "\n";
+    }
+
+    std::system(("rm -rf " + dir).c_str());
+}
@@ -0,0 +1,432 @@
+#ifndef SummerOrder_HH
+#define SummerOrder_HH
+
+#include "SummerExec.hh"
+
+#include <map>
+#include <string>
+#include <vector>
+#include <limits>
+#include <queue>
+#include <functional>
+
+// contraction order for chains of Dots
+//
+// Make::dot nests the products in whatever order they were written, but
+// A.B.C.x can cost wildly different amounts depending on the brackets. as long
+// as every operand inside the chain (all but the two ends) has 2+ axes, each
+// dot hits different axes and any bracketing gives the same answer.. so we are
+// free to pick the cheapest one, same as the classic matrix chain problem.
+//
+// cost is counted with the Var sizes (Make::tensor(name, ids, sizes)):
+//   flops for X.Y = 2 * |X| * |Y| / shared
+//   peak          = the most intermediate elements alive at once when the
+//                   chain is run depth first (inputs and the final result
+//                   arent counted)
+// short chains get the exact O(n^3) dp, long ones a greedy cheapest adjacent
+// pair first search.
+
+// ################################################
+// ################################################
+// ################################################
+
+class ReorderDots
+{
+    typedef std::vector<std::size_t> Dims;
+
+    struct Operand
+    {
+        Handle node_;
+        Dims   dims_;
+    };
+
+    struct Step
+    {
+        // a bracketing.. leaf if left_ is -1
+        int    left_;
+        int    right_;
+        Handle node_;
+        Dims   dims_;
+        double flops_;   // of the whole subtree
+    };
+
+    std::size_t dpLimit_;
+    double      flops_;
+    double      naiveFlops_;
+    double      peak_;
+    std::size_t chains_;
+
+    static double elements(const Dims& dims)
+    {
+        double count = 1;
+        for (std::size_t dim : dims) count *= dim;
+        return count;
+    }
+
+    static Dims joined(const Dims& left, const Dims& right)
+    {
+        // left without its last axis then right without its first
+        Dims dims(left.begin(), left.end() - 1);
+        dims.insert(dims.end(), right.begin() + 1, right.end());
+        return dims;
+    }
+
+    static double cost(const Dims& left, const Dims& right)
+    {
+        return 2 * elements(left) * elements(right) / left.back();
+    }
+
+    static void sizesOf(const Handle& node, std::map<std::string, std::size_t>& sizes)
+    {
+        // the walkers here keep their own stacks.. a chain is as deep as it is long
+        std::vector<const Node*> stack(1, node.get());
+        while (not stack.empty())
+        {
+            const Node* at = stack.back();
+            stack.pop_back();
+            if (at->kind_ == KindVar)
+            {
+                const Var* var = static_cast<const Var*>(at);
+                if (var->size_ != 0)
+                    sizes[var->name_] = var->size_;
+                continue;
+            }
+            for (std::size_t k = at->children_.size(); k-- > 0; )
+                stack.push_back(at->children_[k].get());
+        }
+    }
+
+    static bool dimsOf(const Handle& node, Dims& dims)
+    {
+        // the output axes of a chain operand.. false if any size is unknown
+        std::map<std::string, std::size_t> sizes;
+        sizesOf(node, sizes);
+
+        Contraction form = Flatten::of(node);
+        for (const std::string& var : form.basis_)
+        {
+            std::map<std::string, std::size_t>::const_iterator sit = sizes.find(var);
+            if (sit == sizes.end())
+                return false;
+            dims.push_back(sit->second);
+        }
+        return not dims.empty();
+    }
+
+    static void leaves(const Handle& node, Nodes& found)
+    {
+        // the operands left to right
+        std::vector<Handle> stack(1, node);
+        while (not stack.empty())
+        {
+            Handle at = stack.back();
+            stack.pop_back();
+            if (not is<Dot>(at))
+            {
+                found.push_back(at);
+                continue;
+            }
+            stack.push_back(at->children_[1]);
+            stack.push_back(at->children_[0]);
+        }
+    }
+
+    static double peakOf(const std::vector<Step>& steps, int root)
+    {
+        // most intermediate elements alive at once running this depth first..
+        // a step's peak is known once both its sides have theirs
+        std::vector<double> peaks(steps.size(), 0);
+        std::vector<std::pair<int, bool> > stack(1, std::make_pair(root, false));
+        while (not stack.empty())
+        {
+            int  at    = stack.back().first;
+            bool sides = stack.back().second;
+            const Step& step = steps[at];
+            if (step.left_ < 0)
+            {
+                stack.pop_back();
+                continue;
+            }
+            if (not sides)
+            {
+                stack.back().second = true;
+                stack.push_back(std::make_pair(step.right_, false));
+                stack.push_back(std::make_pair(step.left_, false));
+                continue;
+            }
+            stack.pop_back();
+
+            const Step& left  = steps[step.left_];
+            const Step& right = steps[step.right_];
+            double leftLive  = left.left_  < 0 ? 0 : elements(left.dims_);
+            double rightLive = right.left_ < 0 ? 0 : elements(right.dims_);
+            double out       = at == root ? 0 : elements(step.dims_);
+
+            double peak = std::max(peaks[step.left_], leftLive + peaks[step.right_]);
+            peaks[at] = std::max(peak, leftLive + rightLive + out);
+        }
+        return peaks[root];
+    }
+
+    static double naiveOf(const Handle& node,
+                          const std::map<const Node*, Dims>& known)
+    {
+        // flops of the chain as it was written.. the dims of the sides done
+        // so far wait on their own stack
+        double                              flops = 0;
+        std::vector<Dims>                   sides;
+        std::vector<std::pair<const Node*, bool> > stack(1, std::make_pair(node.get(), false));
+        while (not stack.empty())
+        {
+            const Node* at    = stack.back().first;
+            bool        kids  = stack.back().second;
+            if (at->kind_ != KindDot)
+            {
+                stack.pop_back();
+                sides.push_back(known.find(at)->second);
+                continue;
+            }
+            if (not kids)
+            {
+                stack.back().second = true;
+                stack.push_back(std::make_pair(at->children_[1].get(), false));
+                stack.push_back(std::make_pair(at->children_[0].get(), false));
+                continue;
+            }
+            stack.pop_back();
+
+            Dims right = sides.back();
+            sides.pop_back();
+            Dims left = sides.back();
+            sides.pop_back();
+            flops += cost(left, right);
+            sides.push_back(joined(left, right));
+        }
+        return flops;
+    }
+
+    int exact(const std::vector<Operand>& ops, std::vector<Step>& steps)
+    {
+        // classic matrix chain dp.. best[i][j] is a step index for ops i..j
+        std::size_t n = ops.size();
+        std::vector<std::vector<int> > best(n, std::vector<int>(n, -1));
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            Step leaf = { -1, -1, ops[i].node_, ops[i].dims_, 0 };
+            steps.push_back(leaf);
+            best[i][i] = steps.size() - 1;
+        }
+
+        for (std::size_t len = 2; len <= n; ++len)
+        {
+            for (std::size_t i = 0; i + len <= n; ++i)
+            {
+                std::size_t j = i + len - 1;
+                Step pick = { -1, -1, Handle(), Dims(), std::numeric_limits<double>::max() };
+                for (std::size_t k = i; k < j; ++k)
+                {
+                    const Step& left  = steps[best[i][k]];
+                    const Step& right = steps[best[k+1][j]];
+                    double flops = left.flops_ + right.flops_ + cost(left.dims_, right.dims_);
+                    if (flops < pick.flops_)
+                    {
+                        pick.left_  = best[i][k];
+                        pick.right_ = best[k+1][j];
+                        pick.flops_ = flops;
+                    }
+                }
+                pick.dims_ = joined(steps[pick.left_].dims_, steps[pick.right_].dims_);
+                steps.push_back(pick);
+                best[i][j] = steps.size() - 1;
+            }
+        }
+        return best[0][n-1];
+    }
+
+    struct Pair
+    {
+        // an adjacent pair in the greedy row.. stale once its left slot has
+        // changed since (the version no longer matches)
+        double      flops_;
+        std::size_t at_;
+        std::size_t version_;
+
+        bool operator>(const Pair& other) const
+        {
+            // cheapest first, then the left most
+            if (flops_ != other.flops_) return flops_ > other.flops_;
+            return at_ > other.at_;
+        }
+    };
+
+    int greedy(const std::vector<Operand>& ops, std::vector<Step>& steps)
+    {
+        // keep joining the cheapest adjacent pair.. the row is a linked list
+        // over the operand slots and the pairs wait in a heap, so a long chain
+        // isnt rescanned after every join
+        const std::size_t end = ops.size();
+        std::vector<int>         row;
+        std::vector<std::size_t> next(end), prev(end), version(end, 0);
+        for (std::size_t i = 0; i < end; ++i)
+        {
+            Step leaf = { -1, -1, ops[i].node_, ops[i].dims_, 0 };
+            steps.push_back(leaf);
+            row.push_back(steps.size() - 1);
+            next[i] = i + 1;
+            prev[i] = i == 0 ? end : i - 1;
+        }
+
+        std::priority_queue<Pair, std::vector<Pair>, std::greater<Pair> > heap;
+        auto offer = [&](std::size_t at)
+        {
+            Pair pair = { cost(steps[row[at]].dims_, steps[row[next[at]]].dims_), at, version[at] };
+            heap.push(pair);
+        };
+        for (std::size_t i = 0; i + 1 < end; ++i)
+            offer(i);
+
+        while (not heap.empty())
+        {
+            Pair pick = heap.top();
+            heap.pop();
+            std::size_t at = pick.at_;
+            if (pick.version_ != version[at] or next[at] == end)
+                continue;
+
+            std::size_t gone  = next[at];
+            const Step& left  = steps[row[at]];
+            const Step& right = steps[row[gone]];
+            Step join = { row[at], row[gone], Handle(),
+                          joined(left.dims_, right.dims_),
+                          left.flops_ + right.flops_ + pick.flops_ };
+            steps.push_back(join);
+
+            // the right slot drops out of the row
+            row[at]    = steps.size() - 1;
+            next[at]   = next[gone];
+            next[gone] = end;
+            if (next[at] != end) prev[next[at]] = at;
+            ++version[at];
+
+            if (next[at] != end)
+                offer(at);
+            if (prev[at] != end)
+            {
+                ++version[prev[at]];
+                offer(prev[at]);
+            }
+        }
+        return row[0];
+    }
+
+    static Handle build(std::vector<Step>& steps, int root)
+    {
+        // a step's Dot is made once both its sides have nodes
+        std::vector<std::pair<int, bool> > stack(1, std::make_pair(root, false));
+        while (not stack.empty())
+        {
+            int   at    = stack.back().first;
+            bool  sides = stack.back().second;
+            Step& step  = steps[at];
+            if (step.left_ < 0 or step.node_)
+            {
+                stack.pop_back();
+                continue;
+            }
+            if (not sides)
+            {
+                stack.back().second = true;
+                stack.push_back(std::make_pair(step.right_, false));
+                stack.push_back(std::make_pair(step.left_, false));
+                continue;
+            }
+            stack.pop_back();
+            step.node_ = Make::dot(steps[step.left_].node_, steps[step.right_].node_);
+        }
+        return steps[root].node_;
+    }
+
+    Handle chain(const Handle& top)
+    {
+        Nodes found;
+        leaves(top, found);
+
+        std::vector<Operand>        ops;
+        std::map<const Node*, Dims> known;
+        for (const Handle& leaf : found)
+        {
+            Operand op;
+            op.node_ = process(leaf);
+            if (not dimsOf(op.node_, op.dims_))
+                return top;
+            ops.push_back(op);
+            known[leaf.get()] = op.dims_;
+        }
+
+        // the inner operands need two axes or the bracketing changes the answer
+        for (std::size_t i = 1; i + 1 < ops.size(); ++i)
+            if (ops[i].dims_.size() < 2)
+                return top;
+
+        naiveFlops_ += naiveOf(top, known);
+
+        std::vector<Step> steps;
+        int root = ops.size() <= dpLimit_ ? exact(ops, steps) : greedy(ops, steps);
+
+        flops_ += steps[root].flops_;
+        peak_   = std::max(peak_, peakOf(steps, root));
+        ++chains_;
+
+        return build(steps, root);
+    }
+
+public:
+    ReorderDots(std::size_t dpLimit = 16) :
+        dpLimit_(dpLimit),
+        flops_(0),
+        naiveFlops_(0),
+        peak_(0),
+        chains_(0)
+    {}
+
+    Handle process(const Handle& exp)
+    {
+        // run on the graph before LiftSum.. once the sums are lifted the
+        // chain is gone and its all one loop nest. each node is refreshed
+        // once its kids (and any chains among them) are done
+        if (is<Dot>(exp))
+            return chain(exp);
+
+        std::vector<std::pair<Node*, bool> > stack(1, std::make_pair(exp.get(), false));
+        while (not stack.empty())
+        {
+            Node* at   = stack.back().first;
+            bool  kids = stack.back().second;
+            if (kids)
+            {
+                stack.pop_back();
+                at->refresh();
+                continue;
+            }
+
+            stack.back().second = true;
+            for (std::size_t k = at->children_.size(); k-- > 0; )
+            {
+                Handle& kid = at->children_[k];
+                if (is<Dot>(kid))
+                    kid = chain(kid);
+                else
+                    stack.push_back(std::make_pair(kid.get(), false));
+            }
+        }
+        return exp;
+    }
+
+    // estimates for the chains reordered so far
+    double      flops()      const { return flops_; }
+    double      naiveFlops() const { return naiveFlops_; }
+    double      peak()       const { return peak_; }
+    std::size_t chains()     const { return chains_; }
+};
+
+#endif
@@ -0,0 +1,89 @@
+#include "SummerOrder.hh"
+
+#include "test.hh"
+
+Tensor<int> filled(const Tensor<int>::Shape& shape, int seed)
+{
+    Tensor<int> t(shape);
+    TensorUtils<int>::Data& data = TensorUtils<int>::data(t);
+    for (std::size_t i = 0; i < data.size(); ++i)
+        data[i] = static_cast<int>((i * 7 + seed) % 5) - 2;
+    return t;
+}
+
+Handle badChain()
+{
+    // A.(B.C) with A 10x100, B 100x5, C 5x50.. (A.B).C is 10x cheaper
+    return Make::dot(Make::tensor("A", {"i","j"}, {10,100}),
+                     Make::dot(Make::tensor("B", {"k","l"}, {100,5}),
+                               Make::tensor("C", {"m","n"}, {5,50})));
+}
+
+void testReorder()
+{
+    Executor<int> exec;
+    exec.bind("A", filled({10,100}, 1))
+        .bind("B", filled({100,5},  2))
+        .bind("C", filled({5,50},   3));
+
+    // the operands are bound tensors used in place.. only the dot steps count
+
+    Handle l = badChain();
+    Tensor<int> expected = exec.run(l);
+    EXPECT_EQ(100*5*50 + 10*100*50, exec.iterations());
+
+    ReorderDots order;
+    l = order.process(l);
+    EXPECT_STREAMED_AS("sum_i(sum_j(U_i*U_j*A_ij)).sum_k(sum_l(U_k*U_l*B_kl)).sum_m(sum_n(U_m*U_n*C_mn))") << l;
+    EXPECT_EQ(1u, order.chains());
+    EXPECT_EQ(2.0 * (10*100*5 + 10*5*50), order.flops());
+    EXPECT_EQ(2.0 * (100*5*50 + 10*100*50), order.naiveFlops());
+    EXPECT_EQ(10.0*5, order.peak());
+
+    // its the left bracketing now
+    EXPECT_EQ(true, is<Dot>(l->children_[0]));
+    EXPECT_EQ(expected, exec.run(l));
+    EXPECT_EQ(10*100*5 + 10*5*50, exec.iterations());
+
+    // the greedy search finds the same here
+    ReorderDots greedy(0);
+    l = greedy.process(badChain());
+    EXPECT_EQ(true, is<Dot>(l->children_[0]));
+    EXPECT_EQ(order.flops(), greedy.flops());
+
+    // a vector in the middle pins the order
+    ReorderDots pinned;
+    l = pinned.process(Make::dot(Make::dot(Make::tensor("A", {"i","j"}, {10,100}),
+                                           Make::tensor("v", {"k"}, {100})),
+                                 Make::tensor("w", {"l"}, {10})));
+    EXPECT_EQ(0u, pinned.chains());
+
+    // a chain as deep as it is long (right nested, as a rotation leaves it)
+    // is walked off explicit stacks and the greedy joins from a heap.. all
+    // the pairs cost the same so it takes the left most each time
+    const std::size_t length = 1000000;
+    Handle deep = Make::tensor("R", {"a0","b0"}, {2,2});
+    for (std::size_t t = 1; t < length; ++t)
+    {
+        std::string id = std::to_string(t);
+        deep = Make::dot(Make::tensor("R", {"a" + id, "b" + id}, {2,2}), deep);
+    }
+    ReorderDots flat;
+    deep = flat.process(deep);
+    EXPECT_EQ(1u, flat.chains());
+    EXPECT_EQ(16.0 * (length - 1), flat.flops());
+    EXPECT_EQ(16.0 * (length - 1), flat.naiveFlops());
+    EXPECT_EQ(4.0 + 4.0, flat.peak());
+    EXPECT_EQ(true, is<Dot>(deep->children_[0]));
+    EXPECT_EQ(false, is<Dot>(deep->children_[1]));
+
+    // no sizes.. nothing to go on
+    ReorderDots unsized;
+    unsized.process(Make::dot(Make::tensor("x", {"k"}), Make::tensor("m", {"i","j"})));
+    EXPECT_EQ(0u, unsized.chains());
+}
+
+int main()
+{
+    testReorder();
+}
@@ -0,0 +1,140 @@
+#include "SummerRules.hh"
+#include "SummerExec.hh"
+
+#include "test.hh"
+#include "test.summer.hh"
+
+void structure(const Handle& exp, std::ostream& os)
+{
+    // fully bracketed.. the streamed form drops the ()
+    os << exp << "[";
+    for (const Handle& kid : exp->children_)
+    {
+        structure(kid, os);
+        os << ",";
+    }
+    os << "]";
+}
+
+std::string bracketed(const Handle& exp)
+{
+    std::stringstream ss;
+    structure(exp, ss);
+    return ss.str();
+}
+
+Handle passes(Handle l, std::size_t& checks)
+{
+    // the four passes one after the other.. again till none of them
+    // rewrites, a later pass can open up work for an earlier one
+    for (;;)
+    {
+        TransformAll<LiftSum>                 lift;
+        TransformAll<RotateDotsMultsToRight>  allDotsRotate;
+        TransformAll<AttachDotsToUnitVectors> moveDotsToVectors;
+        TransformAll<LiftUnitVectorUp>        liftUnitVecUp;
+        l = liftUnitVecUp.process(moveDotsToVectors.process(allDotsRotate.process(lift.process(l))));
+        checks += lift.checks() + allDotsRotate.checks() + moveDotsToVectors.checks() + liftUnitVecUp.checks();
+        if (lift.rewrites() + allDotsRotate.rewrites() + moveDotsToVectors.rewrites() + liftUnitVecUp.rewrites() == 0)
+            return l;
+    }
+}
+
+Handle chain(int len)
+{
+    Handle l = Make::tensor("t0", {"a0","b0"});
+    for (int i = 1; i < len; ++i)
+    {
+        std::stringstream name, a, b;
+        name << "t" << i;
+        a << "a" << i;
+        b << "b" << i;
+        l = Make::dot(l, Make::tensor(name.str(), {a.str(), b.str()}));
+    }
+    return l;
+}
+
+void checkSame(Executor<int>& exec, const Handle& before, const Handle& again)
+{
+    // the rules dont always meet in the same place (they dont commute) but
+    // the combined set lands on a fixed point that computes the same thing
+    // and gets there with fewer checks
+    TransformAll<ApplyRules<StandardRules> > rules;
+    Handle combined = rules.process(before);
+
+    std::size_t checks = 0;
+    Handle separate = passes(again, checks);
+    EXPECT_EQ(true, (rules.checks() < checks));
+
+    TransformAll<ApplyRules<StandardRules> > more;
+    std::string done = bracketed(combined);
+    EXPECT_EQ(done, bracketed(more.process(combined)));
+    EXPECT_EQ(0u, more.rewrites());
+
+    EXPECT_EQ(exec.run(separate), exec.run(combined));
+}
+
+void testRules()
+{
+    EXPECT_EQ(10u, StandardRules::rules().size());
+
+    TransformAll<ApplyRules<StandardRules> > rules;
+    Handle l = rules.process(xm());
+    EXPECT_STREAMED_AS("sum_k(sum_i(sum_j(U_k.U_i*U_j*x_k*m_ij)))") << l;
+
+    Executor<int> exec;
+    exec.bind("x", Tensor<int>({3}, {1,2,3}))
+        .bind("m", Tensor<int>({3,2}, {1,2, 3,4, 5,6}))
+        .bind("y", Tensor<int>({2}, {1,-1}))
+        .bind("s", Tensor<int>({}, {3}));
+    for (int i = 0; i < 8; ++i)
+    {
+        std::stringstream name;
+        name << "t" << i;
+        exec.bind(name.str(), Tensor<int>({2,2}, {1,i, 2,1}));
+    }
+
+    checkSame(exec, xm(), xm());
+    checkSame(exec, Make::dot(xm(), Make::tensor("y", {"l"})),
+                    Make::dot(xm(), Make::tensor("y", {"l"})));
+    checkSame(exec, chain(3), chain(3));
+    checkSame(exec, chain(8), chain(8));
+    checkSame(exec, Handle(new Mult(Make::tensor("s", {}), xm())),
+                    Handle(new Mult(Make::tensor("s", {}), xm())));
+
+    // a hand made set
+    RuleSet swap;
+    swap.add("Mult(a,b) -> Mult(b,a)");
+    Nodes captures;
+    Handle ab(new Mult(Make::tensor("a", {}), Make::tensor("b", {})));
+    int rule = swap.match(*ab, captures);
+    EXPECT_EQ(0, rule);
+    EXPECT_STREAMED_AS("b_*a_") << swap.apply(rule, ab, captures);
+    EXPECT_EQ(-1, swap.match(*Make::tensor("a", {"i"}), captures));
+
+    // guards read the kind masks
+    RuleSet guarded;
+    guarded.add("Mult(a!UnitVec,b) -> Mult(b,a)");
+    EXPECT_EQ(-1, guarded.match(*Handle(new Mult(Handle(new UnitVec(Handle(new Var("i")))),
+                                                 Make::tensor("a", {}))), captures));
+
+    EXPECT_THROW(RuleSet().add("Mult(a,b)"), "Rule \"Mult(a,b)\" has no ->");
+    EXPECT_THROW(RuleSet().add("Mult(a,a) -> a"), "Rule \"Mult(a,a) \" captures a twice at 8");
+    EXPECT_THROW(RuleSet().add("Mult(a,b) -> c"), "Rule \" c\" uses c without capturing it at 2");
+    EXPECT_THROW(RuleSet().add("Mul(a,b) -> a"), "Rule \"Mul(a,b) \" has unknown kind Mul at 3");
+    EXPECT_THROW(RuleSet().add("a -> a"), "Rule \"a \" must match a Kind(..) at the top at 2");
+    EXPECT_THROW(RuleSet().add("Mult(Mult(Mult(a,b),c),d) -> a"),
+                 "Rule \" a\" reaches deeper than the rewrite relinks at 2");
+}
+
+int main()
+{
+    try
+    {
+        testRules();
+    }
+    catch (std::exception& e)
+    {
+        std::cout << "Opps... " << e.what() << "\n";
+    }
+}
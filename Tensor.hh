@@ -13,6 +13,18 @@
 #include <algorithm>
 #include <iostream>
 #include <iomanip>
+#include <limits>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <exception>
+#include <deque>
+#include <condition_variable>
+
+#if defined(__SSE__)
+#include <immintrin.h>
+#endif
 
 // ****************************************************************
 // *************************** Tensor *****************************
@@ -27,11 +39,87 @@ std::string join(const Container& vec, const char* delim)
     return ss.str();
 }
 
+template <typename Type>
+class TensorData
+{
+    // contiguous backing store for a Tensor.. either its own vector or an
+    // adopted external buffer that is kept alive by an owner token
+    std::vector<Type>     owned_;
+    Type*                 begin_;
+    std::size_t           size_;
+    std::shared_ptr<void> owner_;
+
+    TensorData(const TensorData&);
+    TensorData& operator=(const TensorData&);
+
+public:
+    typedef Type        value_type;
+    typedef Type*       iterator;
+    typedef const Type* const_iterator;
+
+    TensorData() :
+        owned_(),
+        begin_(NULL),
+        size_(0),
+        owner_()
+    {}
+
+    TensorData(Type* data,
+               std::size_t size,
+               std::shared_ptr<void> owner) :
+        owned_(),
+        begin_(data),
+        size_(size),
+        owner_(owner)
+    {}
+
+    bool adopted() const { return begin_ != NULL and begin_ != owned_.data(); }
+
+    void resize(std::size_t size)
+    {
+        if (adopted())
+        {
+            if (size == size_) return;
+
+            std::stringstream ss;
+            ss << "Tensor cant resize adopted data"
+               << " size: " << size_
+               << " requested: " << size;
+            throw std::runtime_error(ss.str());
+        }
+
+        owned_.resize(size);
+        begin_ = owned_.data();
+        size_  = size;
+    }
+
+    template <typename Iterator>
+    void assign(Iterator first, Iterator last)
+    {
+        resize(std::distance(first, last));
+        std::copy(first, last, begin_);
+    }
+
+    std::size_t size() const { return size_; }
+    bool        empty() const { return size_ == 0; }
+
+    Type*       data()       { return begin_; }
+    const Type* data() const { return begin_; }
+
+    iterator       begin()       { return begin_; }
+    iterator       end()         { return begin_ + size_; }
+    const_iterator begin() const { return begin_; }
+    const_iterator end()   const { return begin_ + size_; }
+
+    Type&       operator[](std::size_t i)       { return begin_[i]; }
+    const Type& operator[](std::size_t i) const { return begin_[i]; }
+};
+
 template <typename Type>
 class Tensor
 {
 public:
-    typedef std::vector<Type> Data;
+    typedef TensorData<Type> Data;
     typedef std::vector<std::size_t> Shape;
 
     friend class Accessor;
@@ -151,6 +239,7 @@ public:
                << " (end-begin): " << (end-begin)
                << " shape: " << join(shape_, "x")
                << " hence size:" << theSize;
+            throw std::runtime_error(ss.str());
         }
 
         data_->resize(size());
@@ -163,6 +252,38 @@ public:
         shape_(shape)
     {}
 
+    Tensor(const Shape& shape,
+           std::shared_ptr<std::vector<Type> > vec) :
+        data_(),
+        shape_(shape)
+    {
+        // adopts the vector without copying.. the tensor keeps it alive
+        if (not vec or vec->size() != size())
+        {
+            std::stringstream ss;
+            ss << "Tensor shape wrong for supplied data"
+               << " size: " << (vec ? vec->size() : 0)
+               << " shape: " << join(shape_, "x")
+               << " hence size:" << size();
+            throw std::runtime_error(ss.str());
+        }
+
+        data_.reset(new Data(vec->data(), vec->size(), vec));
+    }
+
+    Tensor(const Shape& shape,
+           Type* data,
+           std::shared_ptr<void> owner) :
+        data_(),
+        shape_(shape)
+    {
+        // zero copy view of an externally owned buffer of size() elements.
+        // owner is the lifetime token: std::shared_ptr<void>(data, deleter)
+        // for a custom deleter, a handle on the shared memory segment, etc..
+        // or empty if the caller guarantees the buffer outlives the tensor
+        data_.reset(new Data(data, size(), owner));
+    }
+
     std::size_t size() const
     {
         std::size_t theSize = 1;
@@ -200,227 +321,1665 @@ public:
 };
 
 // ****************************************************************
-// ************************ Tensor UTILS **************************
+// ********************** Transpose KERNELS ***********************
 // ****************************************************************
 
 template <typename Type>
-struct TensorUtils : public Tensor<Type>::Accessor
+struct TransposeKernel
 {
-    typedef typename Tensor<Type>::Data  Data;
-    typedef typename Tensor<Type>::Shape Shape;
+    // transposes one full Block x Block tile
+    //   dst[c*dstStride + r] = src[r*srcStride + c]
+    // plain c++ version.. small enough for the compiler to keep in registers
+    static const std::size_t Block = 8;
+
+    static void tile(const Type* src, std::size_t srcStride,
+                     Type*       dst, std::size_t dstStride)
+    {
+        for (std::size_t r = 0; r < Block; ++r)
+            for (std::size_t c = 0; c < Block; ++c)
+                dst[c*dstStride + r] = src[r*srcStride + c];
+    }
+};
+
+#if defined(__AVX__)
+template <>
+struct TransposeKernel<float>
+{
+    // 8x8 in register transpose via unpack/shuffle/lane permute
+    static const std::size_t Block = 8;
+
+    static void tile(const float* src, std::size_t srcStride,
+                     float*       dst, std::size_t dstStride)
+    {
+        __m256 r0 = _mm256_loadu_ps(src + 0*srcStride);
+        __m256 r1 = _mm256_loadu_ps(src + 1*srcStride);
+        __m256 r2 = _mm256_loadu_ps(src + 2*srcStride);
+        __m256 r3 = _mm256_loadu_ps(src + 3*srcStride);
+        __m256 r4 = _mm256_loadu_ps(src + 4*srcStride);
+        __m256 r5 = _mm256_loadu_ps(src + 5*srcStride);
+        __m256 r6 = _mm256_loadu_ps(src + 6*srcStride);
+        __m256 r7 = _mm256_loadu_ps(src + 7*srcStride);
+
+        __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+        __m256 t1 = _mm256_unpackhi_ps(r0, r1);
+        __m256 t2 = _mm256_unpacklo_ps(r2, r3);
+        __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+        __m256 t4 = _mm256_unpacklo_ps(r4, r5);
+        __m256 t5 = _mm256_unpackhi_ps(r4, r5);
+        __m256 t6 = _mm256_unpacklo_ps(r6, r7);
+        __m256 t7 = _mm256_unpackhi_ps(r6, r7);
+
+        __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1,0,1,0));
+        __m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3,2,3,2));
+        __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1,0,1,0));
+        __m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3,2,3,2));
+        __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1,0,1,0));
+        __m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3,2,3,2));
+        __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1,0,1,0));
+        __m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3,2,3,2));
+
+        _mm256_storeu_ps(dst + 0*dstStride, _mm256_permute2f128_ps(s0, s4, 0x20));
+        _mm256_storeu_ps(dst + 1*dstStride, _mm256_permute2f128_ps(s1, s5, 0x20));
+        _mm256_storeu_ps(dst + 2*dstStride, _mm256_permute2f128_ps(s2, s6, 0x20));
+        _mm256_storeu_ps(dst + 3*dstStride, _mm256_permute2f128_ps(s3, s7, 0x20));
+        _mm256_storeu_ps(dst + 4*dstStride, _mm256_permute2f128_ps(s0, s4, 0x31));
+        _mm256_storeu_ps(dst + 5*dstStride, _mm256_permute2f128_ps(s1, s5, 0x31));
+        _mm256_storeu_ps(dst + 6*dstStride, _mm256_permute2f128_ps(s2, s6, 0x31));
+        _mm256_storeu_ps(dst + 7*dstStride, _mm256_permute2f128_ps(s3, s7, 0x31));
+    }
+};
+
+template <>
+struct TransposeKernel<double>
+{
+    // 4x4 in register transpose
+    static const std::size_t Block = 4;
+
+    static void tile(const double* src, std::size_t srcStride,
+                     double*       dst, std::size_t dstStride)
+    {
+        __m256d r0 = _mm256_loadu_pd(src + 0*srcStride);
+        __m256d r1 = _mm256_loadu_pd(src + 1*srcStride);
+        __m256d r2 = _mm256_loadu_pd(src + 2*srcStride);
+        __m256d r3 = _mm256_loadu_pd(src + 3*srcStride);
+
+        __m256d t0 = _mm256_unpacklo_pd(r0, r1);
+        __m256d t1 = _mm256_unpackhi_pd(r0, r1);
+        __m256d t2 = _mm256_unpacklo_pd(r2, r3);
+        __m256d t3 = _mm256_unpackhi_pd(r2, r3);
+
+        _mm256_storeu_pd(dst + 0*dstStride, _mm256_permute2f128_pd(t0, t2, 0x20));
+        _mm256_storeu_pd(dst + 1*dstStride, _mm256_permute2f128_pd(t1, t3, 0x20));
+        _mm256_storeu_pd(dst + 2*dstStride, _mm256_permute2f128_pd(t0, t2, 0x31));
+        _mm256_storeu_pd(dst + 3*dstStride, _mm256_permute2f128_pd(t1, t3, 0x31));
+    }
+};
+#elif defined(__SSE__)
+template <>
+struct TransposeKernel<float>
+{
+    // 4x4 in register transpose
+    static const std::size_t Block = 4;
+
+    static void tile(const float* src, std::size_t srcStride,
+                     float*       dst, std::size_t dstStride)
+    {
+        __m128 r0 = _mm_loadu_ps(src + 0*srcStride);
+        __m128 r1 = _mm_loadu_ps(src + 1*srcStride);
+        __m128 r2 = _mm_loadu_ps(src + 2*srcStride);
+        __m128 r3 = _mm_loadu_ps(src + 3*srcStride);
+
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+        _mm_storeu_ps(dst + 0*dstStride, r0);
+        _mm_storeu_ps(dst + 1*dstStride, r1);
+        _mm_storeu_ps(dst + 2*dstStride, r2);
+        _mm_storeu_ps(dst + 3*dstStride, r3);
+    }
+};
+#endif
+
+// ****************************************************************
+// ******************** Scratch POOL + THREADS ********************
+// ****************************************************************
+
+template <typename Type>
+class ScratchPool
+{
+    // recycles scratch buffers so the hot kernels (gemm packing, im2col..)
+    // stop going to new/delete once the pool has warmed up to their size
+    typedef std::vector<Type> Buffer;
+
+    std::mutex                           mutex_;
+    std::vector<std::unique_ptr<Buffer>> free_;
+
+public:
+    static ScratchPool& instance()
+    {
+        static ScratchPool pool;
+        return pool;
+    }
+
+    class Lease
+    {
+        ScratchPool&            pool_;
+        std::unique_ptr<Buffer> buffer_;
+
+    public:
+        Lease(std::size_t len) :
+            Lease(ScratchPool::instance(), len)
+        {}
+
+        Lease(ScratchPool& pool, std::size_t len) :
+            pool_(pool),
+            buffer_(pool.acquire(len))
+        {}
+
+        ~Lease()
+        {
+            pool_.release(std::move(buffer_));
+        }
+
+        Type* data() { return buffer_->data(); }
+
+    private:
+        Lease(const Lease&);
+        Lease& operator=(const Lease&);
+    };
+
+    std::unique_ptr<Buffer> acquire(std::size_t len)
+    {
+        std::unique_ptr<Buffer> buffer;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            // first that fits.. else the biggest so the regrow is minimal
+            std::size_t pick = free_.size();
+            for (std::size_t i = 0; i < free_.size(); ++i)
+            {
+                if (free_[i]->size() >= len) { pick = i; break; }
+                if (pick == free_.size() or free_[i]->size() > free_[pick]->size()) pick = i;
+            }
+
+            if (pick != free_.size())
+            {
+                buffer = std::move(free_[pick]);
+                free_.erase(free_.begin() + pick);
+            }
+        }
+
+        if (not buffer) buffer.reset(new Buffer);
+        if (buffer->size() < len) buffer->resize(len);
+        return buffer;
+    }
+
+    void release(std::unique_ptr<Buffer> buffer)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(std::move(buffer));
+    }
+};
+
+inline std::size_t workerCount(std::size_t requested)
+{
+    if (requested != 0) return requested;
+    std::size_t hw = std::thread::hardware_concurrency();
+    return (hw == 0) ? 1 : hw;
+}
+
+inline void parallelFor(std::size_t count,
+                        std::size_t threads,
+                        const std::function<void (std::size_t)>& body)
+{
+    // runs body(0..count-1) over up to threads workers.. the calling thread
+    // is one of them. the first exception thrown is passed back out
+    threads = std::min(workerCount(threads), count);
+    if (threads <= 1)
+    {
+        for (std::size_t i = 0; i < count; ++i) body(i);
+        return;
+    }
+
+    std::atomic<std::size_t> next(0);
+    std::exception_ptr       error;
+    std::mutex               errorMutex;
+
+    auto worker = [&]()
+    {
+        for (std::size_t i = next++; i < count; i = next++)
+        {
+            try
+            {
+                body(i);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (not error) error = std::current_exception();
+                next = count;
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (std::size_t t = 1; t < threads; ++t) pool.push_back(std::thread(worker));
+    worker();
+    for (std::thread& thread : pool) thread.join();
+
+    if (error) std::rethrow_exception(error);
+}
+
+class WorkerPool
+{
+    // threads kept for the life of the process so a run doesnt pay for
+    // starting them. a run hands body to workers 1..n-1 and is worker 0
+    // itself, then waits till they are all out of it. one run at a time.. a
+    // run that finds the pool busy (another thread, or a task inside the
+    // current run) starts threads of its own instead. body mustnt throw
+public:
+    typedef std::function<void (std::size_t)> Body;
+
+private:
+    std::atomic<bool>        busy_;
+    std::mutex               mutex_;
+    std::condition_variable  wake_;       // a run (or stop) for the workers
+    std::condition_variable  finished_;   // the last worker left the body
+    std::vector<std::thread> threads_;
+    const Body*              body_;
+    std::size_t              round_;      // bumped per run so each worker joins it once
+    std::size_t              wanted_;     // workers the run uses besides the caller
+    std::size_t              running_;
+    bool                     stop_;
+
+    WorkerPool(const WorkerPool&);
+    WorkerPool& operator=(const WorkerPool&);
+
+    void loop(std::size_t w)
+    {
+        std::size_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;)
+        {
+            wake_.wait(lock, [&]() { return stop_ or (round_ != seen and w <= wanted_); });
+            if (stop_)
+                return;
+            seen = round_;
+
+            const Body& body = *body_;
+            lock.unlock();
+            body(w);
+            lock.lock();
+            if (--running_ == 0)
+                finished_.notify_all();
+        }
+    }
+
+public:
+    WorkerPool() :
+        busy_(false),
+        mutex_(),
+        wake_(),
+        finished_(),
+        threads_(),
+        body_(0),
+        round_(0),
+        wanted_(0),
+        running_(0),
+        stop_(false)
+    {}
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (std::thread& thread : threads_) thread.join();
+    }
+
+    static WorkerPool& instance()
+    {
+        static WorkerPool pool;
+        return pool;
+    }
+
+    std::size_t size() const { return threads_.size(); }
+
+    void run(std::size_t workers, const Body& body)
+    {
+        if (workers <= 1)
+        {
+            body(0);
+            return;
+        }
+
+        if (busy_.exchange(true))
+        {
+            std::vector<std::thread> own;
+            for (std::size_t w = 1; w < workers; ++w) own.push_back(std::thread(body, w));
+            body(0);
+            for (std::thread& thread : own) thread.join();
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            while (threads_.size() + 1 < workers)
+                threads_.push_back(std::thread(&WorkerPool::loop, this, threads_.size() + 1));
+            body_    = &body;
+            wanted_  = workers - 1;
+            running_ = workers - 1;
+            ++round_;
+        }
+        wake_.notify_all();
+
+        body(0);
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            finished_.wait(lock, [this]() { return running_ == 0; });
+        }
+        busy_ = false;
+    }
+};
+
+class TaskGraph
+{
+    // tasks with dependency counts run over a work stealing pool.
+    //
+    // each worker owns a deque. it takes its newest task first (so whatever
+    // just got made ready runs while its inputs are still in cache) and when
+    // its own deque is dry steals the oldest task off another worker. a task
+    // made ready is pushed onto the deque of the worker that finished its
+    // last dependency, which keeps a chain of work on one core. a worker with
+    // nothing to take sleeps till a task is queued or the run is over. the
+    // workers are the WorkerPool threads. the first exception thrown stops
+    // the run and is passed back out
+public:
+    typedef std::function<void ()> Body;
+
+private:
+    struct Task
+    {
+        Body                     body_;
+        std::vector<std::size_t> next_;
+        std::size_t              deps_;
+    };
+
+    struct Queue
+    {
+        std::mutex              mutex_;
+        std::deque<std::size_t> tasks_;
+    };
+
+    std::vector<Task> tasks_;
+    std::size_t       steals_;
+
+public:
+    TaskGraph() :
+        tasks_(),
+        steals_(0)
+    {}
+
+    std::size_t add(const Body& body)
+    {
+        Task task = { body, std::vector<std::size_t>(), 0 };
+        tasks_.push_back(task);
+        return tasks_.size() - 1;
+    }
+
+    // task waits for on to finish
+    void depends(std::size_t task, std::size_t on)
+    {
+        tasks_[on].next_.push_back(task);
+        ++tasks_[task].deps_;
+    }
+
+    std::size_t size()   const { return tasks_.size(); }
+    std::size_t steals() const { return steals_; }
+
+    void run(std::size_t threads = 0)
+    {
+        const std::size_t count = tasks_.size();
+        threads = std::max<std::size_t>(1, std::min(workerCount(threads), count));
+
+        std::unique_ptr<std::atomic<std::size_t>[]> pending(new std::atomic<std::size_t>[count]);
+        std::vector<std::unique_ptr<Queue> >        queues;
+        for (std::size_t w = 0; w < threads; ++w) queues.push_back(std::unique_ptr<Queue>(new Queue));
+
+        // the ready ones are dealt out round robin
+        std::size_t deal = 0;
+        for (std::size_t t = 0; t < count; ++t)
+        {
+            pending[t] = tasks_[t].deps_;
+            if (tasks_[t].deps_ == 0)
+                queues[deal++ % threads]->tasks_.push_back(t);
+        }
+
+        std::atomic<std::size_t> done(0);
+        std::atomic<std::size_t> queued(0);   // bumped before a push, dropped after a take
+        std::atomic<std::size_t> steals(0);
+        std::atomic<bool>        stop(false);
+        std::exception_ptr       error;
+        std::mutex               errorMutex;
+        std::mutex               idleMutex;
+        std::condition_variable  idle;
+
+        for (const std::unique_ptr<Queue>& queue : queues)
+            queued += queue->tasks_.size();
+
+        auto wake = [&](bool all)
+        {
+            // through the mutex so a worker between its check and its wait
+            // cant miss it
+            {
+                std::lock_guard<std::mutex> lock(idleMutex);
+            }
+            if (all) idle.notify_all();
+            else     idle.notify_one();
+        };
+
+        auto take = [&](std::size_t w, std::size_t& task) -> bool
+        {
+            {
+                Queue& own = *queues[w];
+                std::lock_guard<std::mutex> lock(own.mutex_);
+                if (not own.tasks_.empty())
+                {
+                    task = own.tasks_.back();
+                    own.tasks_.pop_back();
+                    --queued;
+                    return true;
+                }
+            }
+
+            for (std::size_t v = 1; v < threads; ++v)
+            {
+                Queue& other = *queues[(w + v) % threads];
+                std::lock_guard<std::mutex> lock(other.mutex_);
+                if (not other.tasks_.empty())
+                {
+                    task = other.tasks_.front();
+                    other.tasks_.pop_front();
+                    --queued;
+                    ++steals;
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        WorkerPool::Body worker = [&](std::size_t w)
+        {
+            while (done < count and not stop)
+            {
+                std::size_t task;
+                if (not take(w, task))
+                {
+                    std::unique_lock<std::mutex> lock(idleMutex);
+                    idle.wait(lock, [&]() { return queued > 0 or done == count or stop; });
+                    continue;
+                }
+
+                try
+                {
+                    tasks_[task].body_();
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if (not error) error = std::current_exception();
+                    stop = true;
+                }
+
+                for (std::size_t next : tasks_[task].next_)
+                {
+                    if (--pending[next] == 0)
+                    {
+                        ++queued;
+                        {
+                            Queue& own = *queues[w];
+                            std::lock_guard<std::mutex> lock(own.mutex_);
+                            own.tasks_.push_back(next);
+                        }
+                        wake(false);
+                    }
+                }
+                if (++done == count or stop)
+                    wake(true);
+            }
+        };
+
+        WorkerPool::instance().run(threads, worker);
+
+        steals_ = steals;
+        if (error) std::rethrow_exception(error);
+    }
+};
+
+// ****************************************************************
+// ************************* GEMM KERNELS *************************
+// ****************************************************************
+
+struct Overflow
+{
+    // how a widened accumulator is narrowed back into the tensor type
+    enum Mode
+    {
+        Wrap,      // plain cast.. the old behaviour
+        Saturate,  // clamp to the types range
+        Checked    // throw if it doesnt fit
+    };
+};
+
+template <typename Type>
+struct GemmTraits
+{
+    // Packed: what the panels are repacked into
+    // Wide:   what the inner products accumulate in
+    typedef Type Packed;
+    typedef Type Wide;
+};
+
+// int8 is packed as int16 so the inner loop can use pmaddwd.. every int8*int8
+// pair sum fits in an int32 lane and the lanes are flushed to int64 well before
+// they can overflow
+template <> struct GemmTraits<int8_t>  { typedef int16_t Packed; typedef int64_t Wide; };
+template <> struct GemmTraits<int16_t> { typedef int32_t Packed; typedef int64_t Wide; };
+template <> struct GemmTraits<int32_t> { typedef int32_t Packed; typedef int64_t Wide; };
+
+template <typename Packed, typename Wide>
+struct GemmDot
+{
+    // inner product of two packed rows.. several partial sums to break the
+    // dependency chain and let the compiler vectorise
+    static Wide run(const Packed* x, const Packed* y, std::size_t len)
+    {
+        Wide s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+        std::size_t k = 0;
+        for (; k + 4 <= len; k += 4)
+        {
+            s0 += static_cast<Wide>(x[k+0]) * static_cast<Wide>(y[k+0]);
+            s1 += static_cast<Wide>(x[k+1]) * static_cast<Wide>(y[k+1]);
+            s2 += static_cast<Wide>(x[k+2]) * static_cast<Wide>(y[k+2]);
+            s3 += static_cast<Wide>(x[k+3]) * static_cast<Wide>(y[k+3]);
+        }
+        for (; k < len; ++k)
+            s0 += static_cast<Wide>(x[k]) * static_cast<Wide>(y[k]);
+
+        return (s0 + s1) + (s2 + s3);
+    }
+};
+
+#if defined(__AVX__)
+template <>
+struct GemmDot<float, float>
+{
+    static float run(const float* x, const float* y, std::size_t len)
+    {
+        __m256 s0 = _mm256_setzero_ps();
+        __m256 s1 = _mm256_setzero_ps();
+        std::size_t k = 0;
+        for (; k + 16 <= len; k += 16)
+        {
+#if defined(__FMA__)
+            s0 = _mm256_fmadd_ps(_mm256_loadu_ps(x+k),   _mm256_loadu_ps(y+k),   s0);
+            s1 = _mm256_fmadd_ps(_mm256_loadu_ps(x+k+8), _mm256_loadu_ps(y+k+8), s1);
+#else
+            s0 = _mm256_add_ps(s0, _mm256_mul_ps(_mm256_loadu_ps(x+k),   _mm256_loadu_ps(y+k)));
+            s1 = _mm256_add_ps(s1, _mm256_mul_ps(_mm256_loadu_ps(x+k+8), _mm256_loadu_ps(y+k+8)));
+#endif
+        }
+
+        float lanes[8];
+        _mm256_storeu_ps(lanes, _mm256_add_ps(s0, s1));
+        float sum = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) +
+                    ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+
+        for (; k < len; ++k) sum += x[k] * y[k];
+        return sum;
+    }
+};
+#endif
+
+#if defined(__SSE2__)
+template <>
+struct GemmDot<int16_t, int64_t>
+{
+    // int8 data sign extended into int16.. pmaddwd (or vpdpwssd with vnni)
+    // accumulates pairs into int32 lanes which get flushed into int64
+    static const std::size_t Flush = 1 << 14;
+
+    static int64_t run(const int16_t* x, const int16_t* y, std::size_t len)
+    {
+        int64_t     sum = 0;
+        std::size_t k   = 0;
+        int32_t     lanes[16];
+
+        while (k < len)
+        {
+#if defined(__AVX512VNNI__) and defined(__AVX512BW__)
+            const std::size_t Width = 32;
+            __m512i acc = _mm512_setzero_si512();
+            for (std::size_t steps = 0; k + Width <= len and steps < Flush; k += Width, ++steps)
+            {
+                acc = _mm512_dpwssd_epi32(acc,
+                                          _mm512_loadu_si512(x+k),
+                                          _mm512_loadu_si512(y+k));
+            }
+            _mm512_storeu_si512(lanes, acc);
+#elif defined(__AVX2__)
+            const std::size_t Width = 16;
+            __m256i acc = _mm256_setzero_si256();
+            for (std::size_t steps = 0; k + Width <= len and steps < Flush; k += Width, ++steps)
+            {
+                acc = _mm256_add_epi32(acc,
+                                       _mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)(x+k)),
+                                                         _mm256_loadu_si256((const __m256i*)(y+k))));
+            }
+            _mm256_storeu_si256((__m256i*)lanes, acc);
+            std::fill(lanes+8, lanes+16, 0);
+#else
+            const std::size_t Width = 8;
+            __m128i acc = _mm_setzero_si128();
+            for (std::size_t steps = 0; k + Width <= len and steps < Flush; k += Width, ++steps)
+            {
+                acc = _mm_add_epi32(acc,
+                                    _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(x+k)),
+                                                   _mm_loadu_si128((const __m128i*)(y+k))));
+            }
+            _mm_storeu_si128((__m128i*)lanes, acc);
+            std::fill(lanes+4, lanes+16, 0);
+#endif
+            for (std::size_t l = 0; l < 16; ++l) sum += lanes[l];
+
+            if (k + Width > len)
+            {
+                for (; k < len; ++k) sum += static_cast<int32_t>(x[k]) * y[k];
+            }
+        }
+        return sum;
+    }
+};
+#endif
+
+template <typename Type>
+struct Gemm
+{
+    // C[MxN] = A[MxK] . B[KxN] + beta*C with arbitrary row/col strides
+    // C can be the input type or wider (ie the Wide type to keep everything)
+    //
+    // A row panels and B column panels are repacked into contiguous rows
+    // (widened where the traits say so) so every output is one streaming
+    // inner product, then narrowed back according to the overflow mode
+    typedef typename GemmTraits<Type>::Packed Packed;
+    typedef typename GemmTraits<Type>::Wide   Wide;
+
+    static const std::size_t Panel = 64;
+
+    template <typename Out>
+    static Out narrow(Wide value, Overflow::Mode mode)
+    {
+        if (mode == Overflow::Wrap or
+            not std::numeric_limits<Out>::is_integer)
+            return static_cast<Out>(value);
+
+        const Wide lo = static_cast<Wide>(std::numeric_limits<Out>::min());
+        const Wide hi = static_cast<Wide>(std::numeric_limits<Out>::max());
+        if (value >= lo and value <= hi) return static_cast<Out>(value);
+
+        if (mode == Overflow::Saturate) return (value < lo) ? static_cast<Out>(lo) : static_cast<Out>(hi);
+
+        std::stringstream ss;
+        ss << "Tensor dot result out of range"
+           << " value: " << value
+           << " range: " << lo << ".." << hi;
+        throw std::overflow_error(ss.str());
+    }
+
+    static void pack(const Type* src,
+                     std::size_t lineStride,
+                     std::size_t elemStride,
+                     std::size_t lines,
+                     std::size_t len,
+                     Packed*     dst)
+    {
+        for (std::size_t l = 0; l < lines; ++l)
+        {
+            const Type* line = src + l*lineStride;
+            for (std::size_t k = 0; k < len; ++k)
+                *dst++ = static_cast<Packed>(line[k*elemStride]);
+        }
+    }
+
+    template <typename Out>
+    static void run(std::size_t M, std::size_t N, std::size_t K,
+                    const Type* a, std::size_t aRow, std::size_t aCol,
+                    const Type* b, std::size_t bRow, std::size_t bCol,
+                    Out*        c, std::size_t cRow, std::size_t cCol,
+                    Out beta = 0,
+                    Overflow::Mode mode = Overflow::Wrap)
+    {
+        const std::size_t panel = Panel;
+
+        typename ScratchPool<Packed>::Lease packA(std::min(M, panel) * K);
+        typename ScratchPool<Packed>::Lease packB(std::min(N, panel) * K);
+
+        for (std::size_t j0 = 0; j0 < N; j0 += panel)
+        {
+            std::size_t nb = std::min(panel, N - j0);
+            pack(b + j0*bCol, bCol, bRow, nb, K, packB.data());
+
+            for (std::size_t i0 = 0; i0 < M; i0 += panel)
+            {
+                std::size_t mb = std::min(panel, M - i0);
+                pack(a + i0*aRow, aRow, aCol, mb, K, packA.data());
+
+                for (std::size_t i = 0; i < mb; ++i)
+                {
+                    const Packed* arow = packA.data() + i*K;
+                    Out*          crow = c + (i0+i)*cRow + j0*cCol;
+
+                    for (std::size_t j = 0; j < nb; ++j)
+                    {
+                        Wide sum = GemmDot<Packed,Wide>::run(arow, packB.data() + j*K, K);
+                        if (beta != 0) sum += static_cast<Wide>(beta) * static_cast<Wide>(crow[j*cCol]);
+                        crow[j*cCol] = narrow<Out>(sum, mode);
+                    }
+                }
+            }
+        }
+    }
+};
+
+// ****************************************************************
+// ************************* CONV PARAMS **************************
+// ****************************************************************
+
+struct ConvParams
+{
+    enum Algorithm
+    {
+        Auto,    // direct for 3x3.. im2col+gemm for the rest
+        Im2col,
+        Direct
+    };
+
+    std::size_t stride_;
+    std::size_t padding_;
+    std::size_t dilation_;
+    Algorithm   algorithm_;
+    std::size_t threads_;   // 0 is one per core
+
+    ConvParams(std::size_t stride   = 1,
+               std::size_t padding  = 0,
+               std::size_t dilation = 1,
+               Algorithm   algorithm = Auto,
+               std::size_t threads  = 0) :
+        stride_(stride),
+        padding_(padding),
+        dilation_(dilation),
+        algorithm_(algorithm),
+        threads_(threads)
+    {}
+};
+
+// ****************************************************************
+// ************************ Tensor UTILS **************************
+// ****************************************************************
+
+template <typename Type>
+struct TensorUtils : public Tensor<Type>::Accessor
+{
+    typedef typename Tensor<Type>::Data  Data;
+    typedef typename Tensor<Type>::Shape Shape;
+
+    typedef typename Tensor<Type>::Data::iterator       iterator;
+    typedef typename Tensor<Type>::Data::const_iterator const_iterator;
+
+    // *sigh*.. why gcc 4.9.. the compiler had better inline this crud..
+    static       Data&  data (      Tensor<Type>& a) { return Tensor<Type>::Accessor::data(a);  }
+    static const Data&  data (const Tensor<Type>& a) { return Tensor<Type>::Accessor::data(a);  }
+    static       Shape& shape(      Tensor<Type>& a) { return Tensor<Type>::Accessor::shape(a); }
+    static const Shape& shape(const Tensor<Type>& a) { return Tensor<Type>::Accessor::shape(a); }
+
+    static bool increment(      Shape& idx,
+                          const Shape& limit,
+                          int skip)
+    {
+        // add one to the little end (the end of the idx)
+        int offset = idx.size()-1;
+        idx[offset] += 1;
+
+        // now ripple count forward
+        while (offset >= 0 and
+               (offset == skip or
+                idx[offset] >= limit[offset]))
+        {
+            idx[offset] = 0;
+            offset -= 1;
+            if (offset >= 0) idx[offset] += 1;
+        }
+
+        // determine carry overflow (and hence termination..)
+        if (offset < 0) return false;
+        return true;
+    }
+
+    // ************************ into helpers **************************
+    // the *_into ops write a caller shaped destination (dst = op + beta*dst)
+    // so a fixed shape loop can run without touching the heap
+
+    static Type blend(Type value, Type old, Type beta)
+    {
+        // beta of 0 never reads dst.. it may be uninitialised
+        return (beta == Type(0)) ? value : value + beta*old;
+    }
+
+    static void check_into(const char* op,
+                           const Tensor<Type>& dst,
+                           const Shape& expect)
+    {
+        if (shape(dst) == expect) return;
+
+        std::stringstream ss;
+        ss << "Tensor shapes mismatch for " << op
+           << " dst: "    << join(shape(dst), "x")
+           << " expect: " << join(expect, "x");
+        throw std::runtime_error(ss.str());
+    }
+
+    static void check_alias(const char* op,
+                            const Tensor<Type>& dst,
+                            const Tensor<Type>& src,
+                            bool elementwise)
+    {
+        // elementwise ops are fine writing straight over their own input
+        // anything else (or a partial overlap) would read clobbered data
+        const Type* db = data(dst).data();
+        const Type* de = db + data(dst).size();
+        const Type* sb = data(src).data();
+        const Type* se = sb + data(src).size();
+
+        if (db >= se or sb >= de) return;
+        if (elementwise and db == sb and de == se) return;
+
+        std::stringstream ss;
+        ss << "Tensor destination aliases input for " << op;
+        throw std::runtime_error(ss.str());
+    }
+
+    static void print(std::ostream& os, const Tensor<Type>& a)
+    {
+        if (shape(a).size() == 1)
+        {
+            os << "[";
+            for (std::size_t x = 0; x < shape(a)[0]; ++x)
+            {
+                if (x != 0) os << " ";
+                os << std::setw(5) << a.at({x});
+            }
+            os << "]\n";
+        }
+        // else if (shape(a).size() == 2)
+        // {
+        //     os << "[";
+        //     for (std::size_t y = 0; y < shape(a)[0]; ++y)
+        //     {
+        //         if (y != 0) os << "\n ";
+        //         os << "[";
+        //         for (std::size_t x = 0; x < shape(a)[1]; ++x)
+        //         {
+        //             if (x != 0) os << " ";
+        //             os << std::setw(5) << a.at({y,x});
+        //         }
+        //         os << "]";
+        //     }
+        //     os << "]\n";
+        // }
+        else
+        {
+            // N-dim print
+            const Shape& limit = shape(a);
+            int lenA = limit.size();
+            Shape idxA(lenA,0);
+
+            os << join(limit, "x") << "\n";
+            do
+            {
+                for (std::size_t x=0; x < lenA-1; ++x)
+                {
+                    os << idxA[x] << ":";
+                }
+
+                os << "[";
+                for (std::size_t x = 0; x < limit[lenA-1]; ++x)
+                {
+                    if (x != 0) os << " ";
+                    idxA[lenA-1] = x;
+
+                    if (x != 0) os << " ";
+                    os << std::setw(5) << a.at(idxA);
+                }
+                os << "]\n";
+             }
+             while(increment(idxA, shape(a), lenA-1));
+        }
+    }
+
+    static Shape dot_shape(const Tensor<Type>& a,
+                           const Tensor<Type>& b,
+                           std::size_t& M,
+                           std::size_t& N,
+                           std::size_t& iLen)
+    {
+        int lenA = shape(a).size();
+        int lenB = shape(b).size();
+
+        // double check for scaler product..
+        // it might happen because im having trouble with the template reduction of zeros..
+        // some ops also shorten tensors of 0 and 1 to raw scaler .. hmm "1" would be incorrect
+        // if (lenA == 1 and shape(a)[0] == 1)
+
+        if (shape(a)[lenA-1] != shape(b)[0])
+        {
+            std::stringstream ss;
+            ss << "Tensor shapes wrong for dot"
+               << " a: " << join(shape(a),"x")
+               << " b: " << join(shape(b),"x");
+            throw std::runtime_error(ss.str());
+        }
+        iLen = shape(b)[0];
+
+        // the new shape is the start of the left (remove the last dim)
+        // with the end of the right (remove the first dim)
+        // a 1D x 1D can do this.. resulting in a scaler..
+        Shape rShape;
+        if (lenA > 1) std::copy(shape(a).begin()  , shape(a).end()-1, std::back_inserter(rShape));
+        if (lenB > 1) std::copy(shape(b).begin()+1, shape(b).end()  , std::back_inserter(rShape));
+
+        if (rShape.size() == 0) rShape = Shape({1});
+
+        // std::cout << "DEBUG ashape:"  << join(shape(a),"x") << "\n";
+        // std::cout << "DEBUG bshape:"  << join(shape(b),"x") << "\n";
+        // std::cout << "DEBUG rshape:"  << join(rShape,"x") << "\n";
+
+        // hence the general form is
+        // r[n,m,l,...,z,y,x,...] = sum_i(a[n,m,l...,i] * b[i,z,y,x,...])
+        // both sides are row major so thats just a plain (n*m*l...) x i x (z*y*x...) gemm
+        M = 1;
+        N = 1;
+        for (int r = 0; r < lenA-1; ++r) M *= shape(a)[r];
+        for (int r = 1; r < lenB;   ++r) N *= shape(b)[r];
+
+        return rShape;
+    }
+
+    static Tensor<Type> dot(const Tensor<Type>& a,
+                            const Tensor<Type>& b,
+                            Overflow::Mode mode = Overflow::Wrap)
+    {
+        // https://people.rit.edu/pnveme/EMEM851n/constitutive/tensors_rect.html
+
+        // t1 = sum_y(sum_x( e_y e_x v_yx ))
+        // t2 = sum_z(e_z v2_z)
+        // t3 = t1 . t2
+        //    = sum_y(sum_x( e_y e_x v_yx )) . sum_z(e_z v2_z)
+        //    = sum_y(sum_x(sum_z( e_y e_x v_yx . e_z v2_z)))
+        //    = sum_y(sum_x(sum_z( e_y dirac_xz v_yx v2_z)))
+        //    = sum_y( e_y sum_j ( v_yj v2_j))
+
+        // Note change of axis Y is now in dim 0
+
+        std::size_t M, N, iLen;
+        Tensor<Type> res(dot_shape(a, b, M, N, iLen));
+
+        Gemm<Type>::run(M, N, iLen,
+                        data(a).data(), iLen, 1,
+                        data(b).data(), N,    1,
+                        data(res).data(), N,  1,
+                        Type(0), mode);
+
+        return res;
+    }
+
+    typedef typename GemmTraits<Type>::Wide Wide;
+
+    static Tensor<Wide> dot_wide(const Tensor<Type>& a,
+                                 const Tensor<Type>& b)
+    {
+        // same as dot but hands back the widened accumulators untouched
+        std::size_t M, N, iLen;
+        Tensor<Wide> res(dot_shape(a, b, M, N, iLen));
+
+        Gemm<Type>::run(M, N, iLen,
+                        data(a).data(), iLen, 1,
+                        data(b).data(), N,    1,
+                        TensorUtils<Wide>::data(res).data(), N, 1);
+
+        return res;
+    }
+
+    static void dot_into(Tensor<Type>& dst,
+                         const Tensor<Type>& a,
+                         const Tensor<Type>& b,
+                         Type beta = 0,
+                         Overflow::Mode mode = Overflow::Wrap)
+    {
+        const Shape& as = shape(a);
+        const Shape& bs = shape(b);
+        const Shape& ds = shape(dst);
+        std::size_t lenA = as.size();
+        std::size_t lenB = bs.size();
+
+        if (as[lenA-1] != bs[0])
+        {
+            std::stringstream ss;
+            ss << "Tensor shapes wrong for dot"
+               << " a: " << join(as,"x")
+               << " b: " << join(bs,"x");
+            throw std::runtime_error(ss.str());
+        }
+
+        // compare against the expected shape piecewise.. building it would allocate
+        std::size_t rank = (lenA-1) + (lenB-1);
+        bool valid = (ds.size() == std::max<std::size_t>(rank, 1));
+        for (std::size_t r = 0; valid and r < rank; ++r)
+            valid = (ds[r] == ((r < lenA-1) ? as[r] : bs[r - (lenA-1) + 1]));
+        if (rank == 0) valid = valid and ds[0] == 1;
+
+        std::size_t M, N, iLen;
+        if (not valid) check_into("dot_into", dst, dot_shape(a, b, M, N, iLen));
+        check_alias("dot_into", dst, a, false);
+        check_alias("dot_into", dst, b, false);
+
+        iLen = bs[0];
+        M = 1;
+        N = 1;
+        for (std::size_t r = 0; r < lenA-1; ++r) M *= as[r];
+        for (std::size_t r = 1; r < lenB;   ++r) N *= bs[r];
+
+        Gemm<Type>::run(M, N, iLen,
+                        data(a).data(), iLen, 1,
+                        data(b).data(), N,    1,
+                        data(dst).data(), N,  1,
+                        beta, mode);
+    }
+
+    static void check_sel(const char* op,
+                          const Tensor<Type>& dst,
+                          const Tensor<Type>& a,
+                          std::size_t rows,
+                          std::size_t cols,
+                          std::size_t pick,
+                          std::size_t limit)
+    {
+        if (shape(a).size() != 2 or pick >= limit)
+        {
+            std::stringstream ss;
+            ss << "Tensor index out of range for " << op
+               << " a: "     << join(shape(a), "x")
+               << " index: " << pick;
+            throw std::runtime_error(ss.str());
+        }
+        if (shape(dst).size() != 2 or shape(dst)[0] != rows or shape(dst)[1] != cols)
+            check_into(op, dst, Shape({rows, cols}));
+        check_alias(op, dst, a, false);
+    }
+
+    static void selrow_into(Tensor<Type>& dst,
+                            std::size_t row,
+                            const Tensor<Type>& a,
+                            Type beta = 0)
+    {
+        std::size_t len  = shape(a).size() == 2 ? shape(a)[0] : 0;
+        std::size_t cols = shape(a).size() == 2 ? shape(a)[1] : 0;
+        check_sel("selrow_into", dst, a, len, 1, row, cols);
+
+        const Type* src = data(a).data() + row;
+        Type*       out = data(dst).data();
+        for (std::size_t x = 0; x < len; ++x)
+            out[x] = blend(src[x*cols], out[x], beta);
+    }
+
+    static Tensor<Type> selrow(std::size_t row,
+                               const Tensor<Type>& a)
+    {
+        // TODO reimpl as an iterator!
+        Tensor<Type> r({shape(a)[0],1});
+        selrow_into(r, row, a);
+        return r;
+    }
+
+    static void selcol_into(Tensor<Type>& dst,
+                            std::size_t col,
+                            const Tensor<Type>& a,
+                            Type beta = 0)
+    {
+        std::size_t rows = shape(a).size() == 2 ? shape(a)[0] : 0;
+        std::size_t len  = shape(a).size() == 2 ? shape(a)[1] : 0;
+        check_sel("selcol_into", dst, a, 1, len, col, rows);
+
+        const Type* src = data(a).data() + col*len;
+        Type*       out = data(dst).data();
+        for (std::size_t y = 0; y < len; ++y)
+            out[y] = blend(src[y], out[y], beta);
+    }
+
+    static Tensor<Type> selcol(std::size_t col,
+                               const Tensor<Type>& a)
+    {
+        Tensor<Type> r({1,shape(a)[1]});
+        selcol_into(r, col, a);
+        return r;
+    }
+
+    static void transpose_block(const Type* src, std::size_t srcStride,
+                                Type*       dst, std::size_t dstStride,
+                                std::size_t rows,
+                                std::size_t cols)
+    {
+        // cache oblivious transpose of a rows x cols block
+        //   dst[c*dstStride + r] = src[r*srcStride + c]
+        // keep halving the long side until the block fits in L1 then sweep
+        // it with the in register tile kernel
+        const std::size_t Block = TransposeKernel<Type>::Block;
+        const std::size_t Leaf  = 32;
+
+        if (rows > Leaf or cols > Leaf)
+        {
+            if (rows >= cols)
+            {
+                // keep the split on a tile boundary so the kernels stay full
+                std::size_t half = (rows/2) / Block * Block;
+                if (half == 0) half = rows/2;
+
+                transpose_block(src, srcStride,
+                                dst, dstStride,
+                                half, cols);
+                transpose_block(src + half*srcStride, srcStride,
+                                dst + half,           dstStride,
+                                rows - half, cols);
+            }
+            else
+            {
+                std::size_t half = (cols/2) / Block * Block;
+                if (half == 0) half = cols/2;
+
+                transpose_block(src, srcStride,
+                                dst, dstStride,
+                                rows, half);
+                transpose_block(src + half,           srcStride,
+                                dst + half*dstStride, dstStride,
+                                rows, cols - half);
+            }
+            return;
+        }
+
+        std::size_t fullRows = rows / Block * Block;
+        std::size_t fullCols = cols / Block * Block;
+
+        for (std::size_t r = 0; r < fullRows; r += Block)
+            for (std::size_t c = 0; c < fullCols; c += Block)
+                TransposeKernel<Type>::tile(src + r*srcStride + c, srcStride,
+                                            dst + c*dstStride + r, dstStride);
+
+        // ragged edges
+        for (std::size_t r = 0; r < rows; ++r)
+            for (std::size_t c = (r < fullRows ? fullCols : 0); c < cols; ++c)
+                dst[c*dstStride + r] = src[r*srcStride + c];
+    }
+
+    static void permute_data(const Type*  src,
+                             const Shape& srcShape,
+                             const Shape& axes,
+                             Type*        dst)
+    {
+        // dst axis n is src axis axes[n].. src and dst must not overlap
+        int rank = srcShape.size();
+
+        std::size_t total = 1;
+        for (std::size_t len : srcShape) total *= len;
+        if (total == 0) return;
+
+        if (rank <= 1)
+        {
+            std::copy(src, src+total, dst);
+            return;
+        }
+
+        // row major strides + odometer.. from the pool so this stays off the heap
+        typename ScratchPool<std::size_t>::Lease scratch(4*rank);
+        std::size_t* srcStride = scratch.data();
+        std::size_t* dstStride = srcStride + rank;
+        std::size_t* limit     = dstStride + rank;
+        std::size_t* idx       = limit     + rank;
+
+        srcStride[rank-1] = 1;
+        dstStride[rank-1] = 1;
+        for (int r = rank-2; r >= 0; --r)
+        {
+            srcStride[r] = srcStride[r+1] * srcShape[r+1];
+            dstStride[r] = dstStride[r+1] * srcShape[axes[r+1]];
+        }
+
+        // locate the 2D plane that needs transposing.. the src axis that
+        // becomes dst contiguous and where the src contiguous axis lands in dst
+        int inner = axes[rank-1];
+        int lands = std::find(axes.begin(), axes.end(), rank-1) - axes.begin();
+
+        // the remaining dst axes are just walked as an outer odometer
+        for (int r = 0; r < rank; ++r)
+        {
+            idx[r]   = 0;
+            limit[r] = (r != rank-1 and r != lands) ? srcShape[axes[r]] : 1;
+        }
+
+        int carry;
+        do
+        {
+            std::size_t srcOffset = 0;
+            std::size_t dstOffset = 0;
+            for (int r = 0; r < rank; ++r)
+            {
+                srcOffset += idx[r] * srcStride[axes[r]];
+                dstOffset += idx[r] * dstStride[r];
+            }
+
+            if (inner == rank-1)
+            {
+                // contiguous axis stays put.. its a plain row copy
+                std::copy(src + srcOffset,
+                          src + srcOffset + srcShape[rank-1],
+                          dst + dstOffset);
+            }
+            else
+            {
+                transpose_block(src + srcOffset, srcStride[inner],
+                                dst + dstOffset, dstStride[lands],
+                                srcShape[inner],
+                                srcShape[rank-1]);
+            }
+
+            for (carry = rank-1; carry >= 0 and ++idx[carry] >= limit[carry]; --carry)
+                idx[carry] = 0;
+        }
+        while(carry >= 0);
+    }
+
+    static Shape permute_shape(const Shape& srcShape,
+                               const Shape& axes)
+    {
+        Shape seen(srcShape.size(),0);
+        bool  valid = (axes.size() == srcShape.size());
+        for (std::size_t i = 0; valid and i < axes.size(); ++i)
+        {
+            valid = (axes[i] < srcShape.size()) and (seen[axes[i]]++ == 0);
+        }
+
+        if (not valid)
+        {
+            std::stringstream ss;
+            ss << "Tensor axes wrong for permute"
+               << " shape: " << join(srcShape, "x")
+               << " axes: "  << join(axes, ",");
+            throw std::runtime_error(ss.str());
+        }
+
+        Shape rShape;
+        for (std::size_t axis : axes) rShape.push_back(srcShape[axis]);
+        return rShape;
+    }
+
+    static Tensor<Type> permute(const Tensor<Type>& a,
+                                const Shape& axes)
+    {
+        // general N-D axis permutation.. ie permute(nchw, {0,2,3,1}) gives nhwc
+        Tensor<Type> r(permute_shape(shape(a), axes));
+
+        permute_data(data(a).data(), shape(a), axes, data(r).data());
+
+        return r;
+    }
+
+    static void permute_into(Tensor<Type>& dst,
+                             const Tensor<Type>& a,
+                             const Shape& axes,
+                             Type beta = 0)
+    {
+        const Shape& as = shape(a);
+        const Shape& ds = shape(dst);
+
+        bool valid = (axes.size() == as.size() and ds.size() == as.size());
+        for (std::size_t i = 0; valid and i < axes.size(); ++i)
+        {
+            valid = (axes[i] < as.size()) and
+                    (std::count(axes.begin(), axes.end(), axes[i]) == 1) and
+                    (ds[i] == as[axes[i]]);
+        }
+        if (not valid) check_into("permute_into", dst, permute_shape(as, axes));
+        check_alias("permute_into", dst, a, false);
+
+        if (beta == Type(0))
+        {
+            permute_data(data(a).data(), as, axes, data(dst).data());
+            return;
+        }
 
-    typedef typename Tensor<Type>::Data::iterator       iterator;
-    typedef typename Tensor<Type>::Data::const_iterator const_iterator;
+        typename ScratchPool<Type>::Lease scratch(data(a).size());
+        permute_data(data(a).data(), as, axes, scratch.data());
 
-    // *sigh*.. why gcc 4.9.. the compiler had better inline this crud..
-    static       Data&  data (      Tensor<Type>& a) { return Tensor<Type>::Accessor::data(a);  }
-    static const Data&  data (const Tensor<Type>& a) { return Tensor<Type>::Accessor::data(a);  }
-    static       Shape& shape(      Tensor<Type>& a) { return Tensor<Type>::Accessor::shape(a); }
-    static const Shape& shape(const Tensor<Type>& a) { return Tensor<Type>::Accessor::shape(a); }
+        Type* out = data(dst).data();
+        for (std::size_t i = 0; i < data(dst).size(); ++i)
+            out[i] = blend(scratch.data()[i], out[i], beta);
+    }
 
-    static bool increment(      Shape& idx,
-                          const Shape& limit,
-                          int skip)
+    static void transpose_into(Tensor<Type>& dst,
+                               const Tensor<Type>& a,
+                               Type beta = 0)
     {
-        // add one to the little end (the end of the idx)
-        int offset = idx.size()-1;
-        idx[offset] += 1;
+        static const Shape swap = {1,0};
 
-        // now ripple count forward
-        while (offset >= 0 and
-               (offset == skip or
-                idx[offset] >= limit[offset]))
+        if (shape(a).size() != 2)
         {
-            idx[offset] = 0;
-            offset -= 1;
-            if (offset >= 0) idx[offset] += 1;
+            std::stringstream ss;
+            ss << "Tensor shape wrong for transpose"
+               << " a: " << join(shape(a), "x");
+            throw std::runtime_error(ss.str());
         }
 
-        // determine carry overflow (and hence termination..)
-        if (offset < 0) return false;
-        return true;
+        permute_into(dst, a, swap, beta);
     }
 
-    static void print(std::ostream& os, const Tensor<Type>& a)
+    static Tensor<Type> transpose(const Tensor<Type>& a)
     {
-        if (shape(a).size() == 1)
+        if (shape(a).size() != 2)
         {
-            os << "[";
-            for (std::size_t x = 0; x < shape(a)[0]; ++x)
-            {
-                if (x != 0) os << " ";
-                os << std::setw(5) << a.at({x});
-            }
-            os << "]\n";
+            std::stringstream ss;
+            ss << "Tensor shape wrong for transpose"
+               << " a: " << join(shape(a), "x");
+            throw std::runtime_error(ss.str());
         }
-        // else if (shape(a).size() == 2)
-        // {
-        //     os << "[";
-        //     for (std::size_t y = 0; y < shape(a)[0]; ++y)
-        //     {
-        //         if (y != 0) os << "\n ";
-        //         os << "[";
-        //         for (std::size_t x = 0; x < shape(a)[1]; ++x)
-        //         {
-        //             if (x != 0) os << " ";
-        //             os << std::setw(5) << a.at({y,x});
-        //         }
-        //         os << "]";
-        //     }
-        //     os << "]\n";
-        // }
-        else
+
+        return permute(a, {1,0});
+    }
+
+    static void transpose_inplace(Tensor<Type>& a)
+    {
+        if (shape(a).size() != 2 or
+            shape(a)[0] != shape(a)[1])
         {
-            // N-dim print
-            const Shape& limit = shape(a);
-            int lenA = limit.size();
-            Shape idxA(lenA,0);
+            std::stringstream ss;
+            ss << "Tensor shape wrong for transpose_inplace"
+               << " a: " << join(shape(a), "x");
+            throw std::runtime_error(ss.str());
+        }
 
-            os << join(limit, "x") << "\n";
-            do
+        // swap mirrored tiles via two stack tiles.. the diagonal tiles swap with themselves
+        const std::size_t Block = TransposeKernel<Type>::Block;
+        const std::size_t len   = shape(a)[0];
+        const std::size_t full  = len / Block * Block;
+        Type* raw = data(a).data();
+
+        Type upper[Block*Block];
+        Type lower[Block*Block];
+
+        for (std::size_t r = 0; r < full; r += Block)
+        {
+            for (std::size_t c = r; c < full; c += Block)
             {
-                for (std::size_t x=0; x < lenA-1; ++x)
-                {
-                    os << idxA[x] << ":";
-                }
+                Type* x = raw + r*len + c;
+                Type* y = raw + c*len + r;
 
-                os << "[";
-                for (std::size_t x = 0; x < limit[lenA-1]; ++x)
-                {
-                    if (x != 0) os << " ";
-                    idxA[lenA-1] = x;
+                TransposeKernel<Type>::tile(x, len, upper, Block);
+                TransposeKernel<Type>::tile(y, len, lower, Block);
 
-                    if (x != 0) os << " ";
-                    os << std::setw(5) << a.at(idxA);
+                for (std::size_t t = 0; t < Block; ++t)
+                {
+                    std::copy(upper + t*Block, upper + (t+1)*Block, y + t*len);
+                    if (x != y)
+                        std::copy(lower + t*Block, lower + (t+1)*Block, x + t*len);
                 }
-                os << "]\n";
-             }
-             while(increment(idxA, shape(a), lenA-1));
+            }
         }
+
+        // ragged edge strip
+        for (std::size_t r = 0; r < len; ++r)
+            for (std::size_t c = std::max(r+1, full); c < len; ++c)
+                std::swap(raw[r*len + c], raw[c*len + r]);
     }
 
-    static Tensor<Type> dot(const Tensor<Type>& a,
-                            const Tensor<Type>& b)
+    struct ConvGeometry
     {
-        // https://people.rit.edu/pnveme/EMEM851n/constitutive/tensors_rect.html
-
-        // t1 = sum_y(sum_x( e_y e_x v_yx ))
-        // t2 = sum_z(e_z v2_z)
-        // t3 = t1 . t2
-        //    = sum_y(sum_x( e_y e_x v_yx )) . sum_z(e_z v2_z)
-        //    = sum_y(sum_x(sum_z( e_y e_x v_yx . e_z v2_z)))
-        //    = sum_y(sum_x(sum_z( e_y dirac_xz v_yx v2_z)))
-        //    = sum_y( e_y sum_j ( v_yj v2_j))
-
-        // Note change of axis Y is now in dim 0
+        std::size_t N, C, H, W;
+        std::size_t OC, KH, KW;
+        std::size_t OH, OW;
+        std::size_t strideH, strideW;
+        std::size_t padH, padW;
+        std::size_t dilH, dilW;
+    };
 
-        int lenA = shape(a).size();
-        int lenB = shape(b).size();
+    static std::size_t conv_out_len(std::size_t len, std::size_t k,
+                                    std::size_t stride, std::size_t pad, std::size_t dil)
+    {
+        long reach = static_cast<long>(dil*(k-1) + 1);
+        long room  = static_cast<long>(len + 2*pad) - reach;
+        if (room < 0 or k == 0 or stride == 0) return 0;
+        return room / stride + 1;
+    }
 
-        // double check for scaler product..
-        // it might happen because im having trouble with the template reduction of zeros..
-        // some ops also shorten tensors of 0 and 1 to raw scaler .. hmm "1" would be incorrect
-        // if (lenA == 1 and shape(a)[0] == 1)
+    static void conv_valid(std::size_t outLen, std::size_t stride, std::size_t pad,
+                           std::size_t offset, std::size_t inLen,
+                           std::size_t& lo, std::size_t& hi)
+    {
+        // range of outputs o where 0 <= o*stride - pad + offset < inLen
+        long shift = static_cast<long>(pad) - static_cast<long>(offset);
+        long s     = static_cast<long>(stride);
+        long first = (shift > 0) ? (shift + s - 1) / s : 0;
+        long last  = static_cast<long>(inLen) + shift;
+        last = (last > 0) ? (last + s - 1) / s : 0;
+
+        lo = std::min<long>(first, outLen);
+        hi = std::max<long>(lo, std::min<long>(last, outLen));
+    }
 
-        if (shape(a)[lenA-1] != shape(b)[0])
+    static void im2col(const Type* in, const ConvGeometry& g, Type* col)
+    {
+        // col[(c*KH + kh)*KW + kw][oh*OW + ow] = in[c][ih][iw] (or the zero pad)
+        const std::size_t plane = g.OH * g.OW;
+        for (std::size_t c = 0; c < g.C; ++c)
+        for (std::size_t kh = 0; kh < g.KH; ++kh)
+        for (std::size_t kw = 0; kw < g.KW; ++kw)
         {
-            std::stringstream ss;
-            ss << "Tensor shapes wrong for dot"
-               << " a: " << join(shape(a),"x")
-               << " b: " << join(shape(b),"x");
-            throw std::runtime_error(ss.str());
-        }
-        std::size_t iLen = shape(b)[0];
+            Type* row = col + ((c*g.KH + kh)*g.KW + kw) * plane;
+            std::fill(row, row + plane, Type(0));
 
-        // the new shape is the start of the left (remove the last dim)
-        // with the end of the right (remove the first dim)
-        // a 1D x 1D can do this.. resulting in a scaler..
-        Shape rShape;
-        if (lenA > 1) std::copy(shape(a).begin()  , shape(a).end()-1, std::back_inserter(rShape));
-        if (lenB > 1) std::copy(shape(b).begin()+1, shape(b).end()  , std::back_inserter(rShape));
+            std::size_t ohLo, ohHi, owLo, owHi;
+            conv_valid(g.OH, g.strideH, g.padH, kh*g.dilH, g.H, ohLo, ohHi);
+            conv_valid(g.OW, g.strideW, g.padW, kw*g.dilW, g.W, owLo, owHi);
 
-        if (rShape.size() == 0) rShape = Shape({1});
+            const long shift = static_cast<long>(kw*g.dilW) - static_cast<long>(g.padW);
+            for (std::size_t oh = ohLo; oh < ohHi; ++oh)
+            {
+                const Type* src = in + (c*g.H + oh*g.strideH + kh*g.dilH - g.padH) * g.W;
+                Type*       dst = row + oh*g.OW;
+                for (std::size_t ow = owLo; ow < owHi; ++ow)
+                    dst[ow] = src[static_cast<long>(ow*g.strideW) + shift];
+            }
+        }
+    }
 
-        // std::cout << "DEBUG ashape:"  << join(shape(a),"x") << "\n";
-        // std::cout << "DEBUG bshape:"  << join(shape(b),"x") << "\n";
-        // std::cout << "DEBUG rshape:"  << join(rShape,"x") << "\n";
+    static void conv_direct(const Type* in, const Type* w, const ConvGeometry& g, Type* out)
+    {
+        // one output channel plane.. shifted axpys with the padding handled by
+        // the loop bounds rather than per element checks
+        std::fill(out, out + g.OH*g.OW, Type(0));
+        for (std::size_t c = 0; c < g.C; ++c)
+        for (std::size_t kh = 0; kh < g.KH; ++kh)
+        for (std::size_t kw = 0; kw < g.KW; ++kw)
+        {
+            const Type weight = w[(c*g.KH + kh)*g.KW + kw];
 
-        // ACS todo.. the general tensor form please..
-        Tensor<Type> res(rShape);
+            std::size_t ohLo, ohHi, owLo, owHi;
+            conv_valid(g.OH, g.strideH, g.padH, kh*g.dilH, g.H, ohLo, ohHi);
+            conv_valid(g.OW, g.strideW, g.padW, kw*g.dilW, g.W, owLo, owHi);
 
-        // hence the general form is
-        // r[n,m,l,...,z,y,x,...] = sum_i(a[n,m,l...,i] * b[i,z,y,x,...])
-        Shape idxA(lenA,0);
-        do
-        {
-            Shape idxB(lenB,0);
-            do
+            const long shift = static_cast<long>(kw*g.dilW) - static_cast<long>(g.padW);
+            for (std::size_t oh = ohLo; oh < ohHi; ++oh)
             {
-                Type sum = 0;
-                for (std::size_t i = 0; i < iLen; ++i)
+                const Type* src = in + (c*g.H + oh*g.strideH + kh*g.dilH - g.padH) * g.W;
+                Type*       dst = out + oh*g.OW;
+                if (g.strideW == 1)
                 {
-                    idxA[lenA-1] = i;
-                    idxB[0]      = i;
-                    sum += a.at(idxA) * b.at(idxB);
-                    // std::cout << "DEBUG a:" << join(idxA,"x") << " (" << a.at(idxA) << ") + "
-                    //           << " b:" << join(idxB,"x") << " (" << b.at(idxB) << ") -> "
-                    //           << " sum:" << sum << "\n";
+                    const Type* shifted = src + shift;
+                    for (std::size_t ow = owLo; ow < owHi; ++ow) dst[ow] += weight * shifted[ow];
+                }
+                else
+                {
+                    for (std::size_t ow = owLo; ow < owHi; ++ow)
+                        dst[ow] += weight * src[static_cast<long>(ow*g.strideW) + shift];
                 }
-
-                // ACS this sucks.. its copying the counts over and over.. can be done better
-                Shape idxR;
-                std::copy(idxA.begin()  , idxA.end()-1, std::back_inserter(idxR));
-                std::copy(idxB.begin()+1, idxB.end()  , std::back_inserter(idxR));
-
-                // std::cout << "DEBUG r:" << join(idxR,"x") << " --> " << sum << "\n";
-                res.at(idxR) = sum;
             }
-            while(increment(idxB, shape(b), 0));
         }
-        while(increment(idxA, shape(a), lenA-1));
-
-        return res;
     }
 
-    static Tensor<Type> selrow(std::size_t row,
-                               const Tensor<Type>& a)
+    static void conv_run(const Tensor<Type>& input,
+                         const Tensor<Type>& weight,
+                         const ConvGeometry& g,
+                         const ConvParams&   params,
+                         Tensor<Type>&       r)
     {
-        // TODO reimpl as an iterator!
-        Tensor<Type> r({shape(a)[0],1});
+        const Type* in  = data(input).data();
+        const Type* w   = data(weight).data();
+        Type*       out = data(r).data();
+
+        const std::size_t inLen   = g.C * g.H * g.W;
+        const std::size_t plane   = g.OH * g.OW;
+        const std::size_t depth   = g.C * g.KH * g.KW;
+        const std::size_t threads = workerCount(params.threads_);
 
-        for (std::size_t x = 0; x < shape(a)[0]; ++x)
+        // nothing to do.. and the chunking below divides by both
+        if (g.N == 0 or g.OC == 0)
+            return;
+
+        ConvParams::Algorithm algo = params.algorithm_;
+        if (algo == ConvParams::Auto)
+            algo = (g.KH <= 3 and g.KW == 3) ? ConvParams::Direct : ConvParams::Im2col;
+
+        if (algo == ConvParams::Direct)
         {
-            r.at({x,0}) = a.at({x,row});
+            parallelFor(g.N * g.OC, threads,
+                        [&](std::size_t task)
+                        {
+                            std::size_t n  = task / g.OC;
+                            std::size_t oc = task % g.OC;
+                            conv_direct(in + n*inLen, w + oc*depth, g, out + (n*g.OC + oc)*plane);
+                        });
+            return;
         }
 
-        return r;
+        // im2col a group of images at a time (bounds the scratch), then split
+        // each images gemm over blocks of output channels
+        const std::size_t group    = std::min(g.N, threads);
+        const std::size_t ocChunks = std::min(g.OC, (threads + group - 1) / group);
+        const std::size_t ocBlock  = (g.OC + ocChunks - 1) / ocChunks;
+
+        typename ScratchPool<Type>::Lease cols(group * depth * plane);
+
+        for (std::size_t n0 = 0; n0 < g.N; n0 += group)
+        {
+            std::size_t count = std::min(group, g.N - n0);
+
+            parallelFor(count, threads,
+                        [&](std::size_t i)
+                        {
+                            im2col(in + (n0+i)*inLen, g, cols.data() + i*depth*plane);
+                        });
+
+            parallelFor(count * ocChunks, threads,
+                        [&](std::size_t task)
+                        {
+                            std::size_t i   = task / ocChunks;
+                            std::size_t oc0 = (task % ocChunks) * ocBlock;
+                            if (oc0 >= g.OC) return;
+                            std::size_t ocs = std::min(ocBlock, g.OC - oc0);
+
+                            Gemm<Type>::run(ocs, plane, depth,
+                                            w + oc0*depth,                  depth, 1,
+                                            cols.data() + i*depth*plane,    plane, 1,
+                                            out + ((n0+i)*g.OC + oc0)*plane, plane, 1);
+                        });
+        }
     }
 
-    static Tensor<Type> selcol(std::size_t col,
-                               const Tensor<Type>& a)
+    static Tensor<Type> conv2d(const Tensor<Type>& input,
+                               const Tensor<Type>& weight,
+                               const ConvParams&   params = ConvParams())
     {
-        Tensor<Type> r({1,shape(a)[1]});
+        // input NxCxHxW, weight OCxCxKHxKW -> NxOCxOHxOW
+        const Shape& is = shape(input);
+        const Shape& ws = shape(weight);
+
+        ConvGeometry g;
+        if (is.size() == 4 and ws.size() == 4 and is[1] == ws[1])
+        {
+            g.N  = is[0]; g.C  = is[1]; g.H  = is[2]; g.W  = is[3];
+            g.OC = ws[0]; g.KH = ws[2]; g.KW = ws[3];
+            g.strideH = g.strideW = params.stride_;
+            g.padH    = g.padW    = params.padding_;
+            g.dilH    = g.dilW    = params.dilation_;
+            g.OH = conv_out_len(g.H, g.KH, g.strideH, g.padH, g.dilH);
+            g.OW = conv_out_len(g.W, g.KW, g.strideW, g.padW, g.dilW);
+        }
 
-        for (std::size_t y = 0; y < shape(a)[1]; ++y)
+        if (is.size() != 4 or ws.size() != 4 or is[1] != ws[1] or
+            g.OH == 0 or g.OW == 0)
         {
-            r.at({0,y}) = a.at({col,y});
+            std::stringstream ss;
+            ss << "Tensor shapes wrong for conv2d"
+               << " input: "  << join(is, "x")
+               << " weight: " << join(ws, "x");
+            throw std::runtime_error(ss.str());
         }
 
+        Tensor<Type> r({g.N, g.OC, g.OH, g.OW});
+        conv_run(input, weight, g, params, r);
         return r;
     }
 
-    static Tensor<Type> transpose(const Tensor<Type>& a)
+    static Tensor<Type> conv1d(const Tensor<Type>& input,
+                               const Tensor<Type>& weight,
+                               const ConvParams&   params = ConvParams())
     {
-        Tensor<Type> r({shape(a)[1],shape(a)[0]});
+        // input NxCxW, weight OCxCxK -> NxOCxOW.. run as a 2D conv with H of 1
+        const Shape& is = shape(input);
+        const Shape& ws = shape(weight);
 
-        for (std::size_t y = 0; y < shape(a)[1]; ++y)
+        ConvGeometry g;
+        if (is.size() == 3 and ws.size() == 3 and is[1] == ws[1])
         {
-            for (std::size_t x = 0; x < shape(a)[0]; ++x)
-            {
-                r.at({y,x}) = a.at({x,y});
-            }
+            g.N  = is[0]; g.C  = is[1]; g.H  = 1; g.W = is[2];
+            g.OC = ws[0]; g.KH = 1;     g.KW = ws[2];
+            g.strideH = 1; g.strideW = params.stride_;
+            g.padH    = 0; g.padW    = params.padding_;
+            g.dilH    = 1; g.dilW    = params.dilation_;
+            g.OH = 1;
+            g.OW = conv_out_len(g.W, g.KW, g.strideW, g.padW, g.dilW);
+        }
+
+        if (is.size() != 3 or ws.size() != 3 or is[1] != ws[1] or
+            g.OW == 0)
+        {
+            std::stringstream ss;
+            ss << "Tensor shapes wrong for conv1d"
+               << " input: "  << join(is, "x")
+               << " weight: " << join(ws, "x");
+            throw std::runtime_error(ss.str());
         }
 
+        Tensor<Type> r({g.N, g.OC, g.OW});
+        conv_run(input, weight, g, params, r);
         return r;
     }
 
@@ -439,31 +1998,39 @@ struct TensorUtils : public Tensor<Type>::Accessor
         }
     }
 
-    static Tensor<Type> unifunctor(std::function<Type (Type)> func,
-                                   const Tensor<Type>& a)
-
+    static void unifunctor_into(Tensor<Type>& dst,
+                                std::function<Type (Type)> func,
+                                const Tensor<Type>& a,
+                                Type beta = 0)
     {
-        // TODO this feels llike there should be an std:algo for it
-        //  maybe generate ??
-
-        Tensor<Type> r(shape(a));
+        check_into("unifunctor_into", dst, shape(a));
+        check_alias("unifunctor_into", dst, a, true);
 
         const_iterator ait = data(a).begin();
-        for(iterator rit = data(r).begin();
-            rit != data(r).end();
-            ++rit)
+        iterator       rit = data(dst).begin();
+
+        while (rit != data(dst).end())
         {
-            *rit = func(*ait);
+            *rit = blend(func(*ait), *rit, beta);
             ++ait;
+            ++rit;
         }
+    }
+
+    static Tensor<Type> unifunctor(std::function<Type (Type)> func,
+                                   const Tensor<Type>& a)
 
+    {
+        Tensor<Type> r(shape(a));
+        unifunctor_into(r, func, a);
         return r;
     }
 
-    static Tensor<Type> bifunctor(std::function<Type (Type,Type)> func,
-                                  const Tensor<Type>& a,
-                                  const Tensor<Type>& b)
-
+    static void bifunctor_into(Tensor<Type>& dst,
+                               std::function<Type (Type,Type)> func,
+                               const Tensor<Type>& a,
+                               const Tensor<Type>& b,
+                               Type beta = 0)
     {
         if (shape(a) != shape(b))
         {
@@ -473,23 +2040,30 @@ struct TensorUtils : public Tensor<Type>::Accessor
                << " b: " << join(shape(b), "x");
             throw std::runtime_error(ss.str());
         }
-
-        // TODO this feels llike there should be an std:algo for it
-        //  maybe generate ??
-        Tensor<Type> r(shape(a));
+        check_into("bifunctor_into", dst, shape(a));
+        check_alias("bifunctor_into", dst, a, true);
+        check_alias("bifunctor_into", dst, b, true);
 
         const_iterator ait = data(a).begin();
         const_iterator bit = data(b).begin();
-        iterator       rit = data(r).begin();
+        iterator       rit = data(dst).begin();
 
-        while (rit != data(r).end())
+        while (rit != data(dst).end())
         {
-            *rit = func(*ait, *bit);
+            *rit = blend(func(*ait, *bit), *rit, beta);
             ++ait;
             ++bit;
             ++rit;
         }
+    }
 
+    static Tensor<Type> bifunctor(std::function<Type (Type,Type)> func,
+                                  const Tensor<Type>& a,
+                                  const Tensor<Type>& b)
+
+    {
+        Tensor<Type> r(shape(a));
+        bifunctor_into(r, func, a, b);
         return r;
     }
 
@@ -509,8 +2083,6 @@ struct TensorUtils : public Tensor<Type>::Accessor
 
         // TODO this feels llike there should be an std:algo for it
         //  maybe generate ??
-        Tensor<Type> r(shape(a));
-
         const_iterator bit = data(b).begin();
         for(iterator ait = data(a).begin();
             ait != data(a).end();
@@ -521,9 +2093,11 @@ struct TensorUtils : public Tensor<Type>::Accessor
         }
     }
 
-    static Tensor<Type> bifunctor_row(std::function<Type (Type,Type)> func,
-                                      const Tensor<Type>& a,
-                                      const Tensor<Type>& b)
+    static void bifunctor_row_into(Tensor<Type>& dst,
+                                   std::function<Type (Type,Type)> func,
+                                   const Tensor<Type>& a,
+                                   const Tensor<Type>& b,
+                                   Type beta = 0)
     {
         if (shape(a)[0] != shape(b)[0] or
             shape(b)[1] != 1)
@@ -534,68 +2108,90 @@ struct TensorUtils : public Tensor<Type>::Accessor
                << " b: " << join(shape(b), "x");
             throw std::runtime_error(ss.str());
         }
-
-        // TODO this feels llike there should be an std:algo for it
-        //  maybe generate ??
-        Tensor<Type> r(shape(a));
+        check_into("bifunctor_row_into", dst, shape(a));
+        check_alias("bifunctor_row_into", dst, a, true);
+        check_alias("bifunctor_row_into", dst, b, false);
 
         const_iterator ait = data(a).begin();
         const_iterator bit = data(b).begin();
-        iterator       rit = data(r).begin();
+        iterator       rit = data(dst).begin();
 
-        while (rit != data(r).end())
+        while (rit != data(dst).end())
         {
             if (bit == data(b).end()) bit = data(b).begin();
 
-            *rit = func(*ait, *bit);
+            *rit = blend(func(*ait, *bit), *rit, beta);
             ++ait;
             ++bit;
             ++rit;
         }
+    }
 
+    static Tensor<Type> bifunctor_row(std::function<Type (Type,Type)> func,
+                                      const Tensor<Type>& a,
+                                      const Tensor<Type>& b)
+    {
+        Tensor<Type> r(shape(a));
+        bifunctor_row_into(r, func, a, b);
         return r;
     }
 
-    static Tensor<Type> bifunctor_scaler(std::function<Type (Type,Type)> func,
-                                        const Type a,
-                                        const Tensor<Type>& b)
-
+    static void bifunctor_scaler_into(Tensor<Type>& dst,
+                                      std::function<Type (Type,Type)> func,
+                                      const Type a,
+                                      const Tensor<Type>& b,
+                                      Type beta = 0)
     {
-        // TODO this feels llike there should be an std:algo for it
-        //  maybe generate ??
-        Tensor<Type> r(shape(b));
+        check_into("bifunctor_scaler_into", dst, shape(b));
+        check_alias("bifunctor_scaler_into", dst, b, true);
 
         const_iterator bit = data(b).begin();
-        iterator       rit = data(r).begin();
+        iterator       rit = data(dst).begin();
 
-        while (rit != data(r).end())
+        while (rit != data(dst).end())
         {
-            *rit = func(a,*bit);
+            *rit = blend(func(a,*bit), *rit, beta);
             ++bit;
             ++rit;
         }
-
-        return r;
     }
 
-    static Tensor<Type> bifunctor_scaler(std::function<Type (Type,Type)> func,
-                                        const Tensor<Type>& a,
-                                        const Type b)
+    static void bifunctor_scaler_into(Tensor<Type>& dst,
+                                      std::function<Type (Type,Type)> func,
+                                      const Tensor<Type>& a,
+                                      const Type b,
+                                      Type beta = 0)
     {
-        // TODO this feels llike there should be an std:algo for it
-        //  maybe generate ??
-        Tensor<Type> r(shape(a));
+        check_into("bifunctor_scaler_into", dst, shape(a));
+        check_alias("bifunctor_scaler_into", dst, a, true);
 
         const_iterator ait = data(a).begin();
-        iterator       rit = data(r).begin();
+        iterator       rit = data(dst).begin();
 
-        while (rit != data(r).end())
+        while (rit != data(dst).end())
         {
-            *rit = func(*ait,b);
+            *rit = blend(func(*ait,b), *rit, beta);
             ++ait;
             ++rit;
         }
+    }
+
+    static Tensor<Type> bifunctor_scaler(std::function<Type (Type,Type)> func,
+                                        const Type a,
+                                        const Tensor<Type>& b)
+
+    {
+        Tensor<Type> r(shape(b));
+        bifunctor_scaler_into(r, func, a, b);
+        return r;
+    }
 
+    static Tensor<Type> bifunctor_scaler(std::function<Type (Type,Type)> func,
+                                        const Tensor<Type>& a,
+                                        const Type b)
+    {
+        Tensor<Type> r(shape(a));
+        bifunctor_scaler_into(r, func, a, b);
         return r;
     }
 
@@ -728,6 +2324,13 @@ Tensor<Type> transpose(const Tensor<Type>& a)
     return TensorUtils<Type>::transpose(a);
 }
 
+template <typename Type>
+Tensor<Type> permute(const Tensor<Type>& a,
+                     const typename Tensor<Type>::Shape& axes)
+{
+    return TensorUtils<Type>::permute(a,axes);
+}
+
 template <typename Type>
 Tensor<Type> tanh(const Tensor<Type>& a)
 {
@@ -2,6 +2,22 @@
 
 #include "test.hh"
 
+#include <atomic>
+#include <new>
+
+// count heap traffic so the *_into tests can prove a loop is allocation free
+std::atomic<std::size_t> allocations(0);
+
+void* operator new(std::size_t size)
+{
+    ++allocations;
+    if (void* ptr = std::malloc(size)) return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept              { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+
 void basicTest()
 {
 
@@ -45,11 +61,379 @@ void basicTest()
     EXPECT_EQ(expDxC, TensorUtils<int>::dot(d,c));
 }
 
+template <typename Type>
+void transposeCheck(std::size_t rows, std::size_t cols)
+{
+    Tensor<Type> a({rows, cols});
+    Tensor<Type> naive({cols, rows});
+    for (std::size_t y = 0; y < rows; ++y)
+    {
+        for (std::size_t x = 0; x < cols; ++x)
+        {
+            typename Tensor<Type>::Shape yx = {y,x};
+            typename Tensor<Type>::Shape xy = {x,y};
+            a.at(yx)     = y*cols + x;
+            naive.at(xy) = y*cols + x;
+        }
+    }
+
+    EXPECT_EQ(true, (naive == TensorUtils<Type>::transpose(a)));
+
+    if (rows == cols)
+    {
+        TensorUtils<Type>::transpose_inplace(a);
+        EXPECT_EQ(true, (naive == a));
+    }
+}
+
+void transposeTest()
+{
+    Tensor<int> d({4,2,3},
+                  {0,1,2,    3,4,5,
+                   6,7,8,    9,10,11,
+                   12,13,14, 15,16,17,
+                   18,19,20, 21,22,23});
+
+    Tensor<int> expD201({3,4,2},
+                        {0,3,   6,9,   12,15, 18,21,
+                         1,4,   7,10,  13,16, 19,22,
+                         2,5,   8,11,  14,17, 20,23});
+    EXPECT_EQ(expD201, permute(d, {2,0,1}));
+
+    Tensor<int> expD102({2,4,3},
+                        {0,1,2,    6,7,8,    12,13,14, 18,19,20,
+                         3,4,5,    9,10,11,  15,16,17, 21,22,23});
+    EXPECT_EQ(expD102, permute(d, {1,0,2}));
+    EXPECT_EQ(d, permute(permute(d, {2,0,1}), {1,2,0}));
+
+    EXPECT_THROW(permute(d, {0,0,1}), "Tensor axes wrong for permute shape: 4x2x3x axes: 0,0,1,");
+    EXPECT_THROW(TensorUtils<int>::transpose_inplace(d), "Tensor shape wrong for transpose_inplace a: 4x2x3x");
+
+    // odd sizes to hit the ragged edges of the tile kernels
+    transposeCheck<int>(3, 5);
+    transposeCheck<int>(37, 37);
+    transposeCheck<float>(67, 45);
+    transposeCheck<float>(64, 64);
+    transposeCheck<float>(83, 83);
+    transposeCheck<double>(129, 31);
+    transposeCheck<double>(50, 50);
+}
+
+template <typename Type>
+void dotCheck(std::size_t m, std::size_t k, std::size_t n, int range)
+{
+    Tensor<Type> a({m, k});
+    Tensor<Type> b({k, n});
+    a = unifunc(a, std::function<Type (Type)>([range](Type) { return static_cast<Type>(std::rand() % (2*range+1) - range); }));
+    b = unifunc(b, std::function<Type (Type)>([range](Type) { return static_cast<Type>(std::rand() % (2*range+1) - range); }));
+
+    // widened reference
+    Tensor<int64_t> naive({m, n});
+    for (std::size_t y = 0; y < m; ++y)
+    {
+        for (std::size_t x = 0; x < n; ++x)
+        {
+            int64_t sum = 0;
+            for (std::size_t i = 0; i < k; ++i)
+            {
+                sum += static_cast<int64_t>(a.at({y,i})) * static_cast<int64_t>(b.at({i,x}));
+            }
+            Tensor<int64_t>::Shape yx = {y,x};
+            naive.at(yx) = sum;
+        }
+    }
+
+    EXPECT_EQ(naive, TensorUtils<Type>::dot_wide(a, b));
+
+    Tensor<Type> r = TensorUtils<Type>::dot(a, b, Overflow::Saturate);
+    bool same = true;
+    for (std::size_t y = 0; y < m; ++y)
+    {
+        for (std::size_t x = 0; x < n; ++x)
+        {
+            int64_t expect = std::min<int64_t>(std::max<int64_t>(naive.at({y,x}),
+                                                                 std::numeric_limits<Type>::min()),
+                                               std::numeric_limits<Type>::max());
+            same &= (expect == r.at({y,x}));
+        }
+    }
+    EXPECT_EQ(true, same);
+}
+
+void integerDotTest()
+{
+    // intermediate sum leaves int range but the result doesnt
+    Tensor<int> a({1,3}, {1<<30, 1<<30, -(1<<30)});
+    Tensor<int> b({3,1}, {1, 1, 1});
+    EXPECT_EQ(Tensor<int>({1,1}, {1<<30}), TensorUtils<int>::dot(a, b, Overflow::Checked));
+
+    Tensor<int> c({1,2}, {1<<30, 1<<30});
+    Tensor<int> d({2,1}, {1, 1});
+    EXPECT_EQ(Tensor<int>({1,1}, {std::numeric_limits<int>::max()}), TensorUtils<int>::dot(c, d, Overflow::Saturate));
+    EXPECT_THROW(TensorUtils<int>::dot(c, d, Overflow::Checked),
+                 "Tensor dot result out of range value: 2147483648 range: -2147483648..2147483647");
+
+    dotCheck<int8_t>(5, 70000, 3, 128);
+    dotCheck<int8_t>(67, 131, 71, 128);
+    dotCheck<int16_t>(33, 300, 65, 32768);
+    dotCheck<int>(17, 1000, 9, 1 << 20);
+}
+
+Tensor<int> naiveConv2d(const Tensor<int>& in, const Tensor<int>& w,
+                        std::size_t stride, std::size_t pad, std::size_t dil,
+                        std::size_t OH, std::size_t OW)
+{
+    std::size_t N = TensorUtils<int>::shape(in)[0];
+    std::size_t C = TensorUtils<int>::shape(in)[1];
+    long        H = TensorUtils<int>::shape(in)[2];
+    long        W = TensorUtils<int>::shape(in)[3];
+    std::size_t OC = TensorUtils<int>::shape(w)[0];
+    std::size_t KH = TensorUtils<int>::shape(w)[2];
+    std::size_t KW = TensorUtils<int>::shape(w)[3];
+
+    Tensor<int> r({N, OC, OH, OW});
+    for (std::size_t n = 0; n < N; ++n)
+    for (std::size_t oc = 0; oc < OC; ++oc)
+    for (std::size_t oh = 0; oh < OH; ++oh)
+    for (std::size_t ow = 0; ow < OW; ++ow)
+    {
+        int sum = 0;
+        for (std::size_t c = 0; c < C; ++c)
+        for (std::size_t kh = 0; kh < KH; ++kh)
+        for (std::size_t kw = 0; kw < KW; ++kw)
+        {
+            long ih = oh*stride + kh*dil - pad;
+            long iw = ow*stride + kw*dil - pad;
+            if (ih < 0 or ih >= H or iw < 0 or iw >= W) continue;
+            sum += in.at({n, c, std::size_t(ih), std::size_t(iw)}) * w.at({oc, c, kh, kw});
+        }
+        Tensor<int>::Shape idx = {n, oc, oh, ow};
+        r.at(idx) = sum;
+    }
+    return r;
+}
+
+void convCheck(std::size_t N, std::size_t C, std::size_t H, std::size_t W,
+               std::size_t OC, std::size_t K,
+               std::size_t stride, std::size_t pad, std::size_t dil)
+{
+    Tensor<int> in({N, C, H, W});
+    Tensor<int> w({OC, C, K, K});
+    in = unifunc(in, std::function<int (int)>([](int) { return std::rand() % 19 - 9; }));
+    w  = unifunc(w,  std::function<int (int)>([](int) { return std::rand() % 19 - 9; }));
+
+    Tensor<int> direct = TensorUtils<int>::conv2d(in, w, ConvParams(stride, pad, dil, ConvParams::Direct, 3));
+    Tensor<int> im2col = TensorUtils<int>::conv2d(in, w, ConvParams(stride, pad, dil, ConvParams::Im2col, 3));
+
+    std::size_t OH = TensorUtils<int>::shape(direct)[2];
+    std::size_t OW = TensorUtils<int>::shape(direct)[3];
+    Tensor<int> naive = naiveConv2d(in, w, stride, pad, dil, OH, OW);
+
+    EXPECT_EQ(true, (naive == direct));
+    EXPECT_EQ(true, (naive == im2col));
+}
+
+void convTest()
+{
+    Tensor<int> in({1,1,5}, {1,2,3,4,5});
+    Tensor<int> w({2,1,3},  {1,0,-1,
+                             1,1,1});
+    Tensor<int> expValid({1,2,3}, {-2,-2,-2,
+                                   6,9,12});
+    EXPECT_EQ(expValid, TensorUtils<int>::conv1d(in, w));
+
+    Tensor<int> expPadStride({1,2,3}, {-2,-2,4,
+                                       3,9,9});
+    EXPECT_EQ(expPadStride, TensorUtils<int>::conv1d(in, w, ConvParams(2, 1)));
+    EXPECT_EQ(expPadStride, TensorUtils<int>::conv1d(in, w, ConvParams(2, 1, 1, ConvParams::Im2col)));
+
+    EXPECT_THROW(TensorUtils<int>::conv1d(w, in), "Tensor shapes wrong for conv1d input: 2x1x3x weight: 1x1x5x");
+
+    convCheck(2, 3, 7, 9, 4, 3, 1, 1, 1);
+    convCheck(3, 2, 11, 8, 5, 3, 2, 1, 2);
+    convCheck(1, 4, 9, 9, 3, 5, 2, 2, 1);
+    convCheck(4, 1, 6, 6, 2, 1, 1, 0, 1);
+
+    // an empty batch or no output channels is an empty result on either path
+    Tensor<int> none({0,1,5,5});
+    Tensor<int> kernel({2,1,3,3});
+    Tensor<int> empty = TensorUtils<int>::conv2d(none, kernel, ConvParams(1, 0, 1, ConvParams::Im2col));
+    EXPECT_EQ(0u, empty.size());
+    empty = TensorUtils<int>::conv2d(none, kernel, ConvParams(1, 0, 1, ConvParams::Direct));
+    EXPECT_EQ(0u, empty.size());
+    empty = TensorUtils<int>::conv2d(Tensor<int>({1,1,5,5}), Tensor<int>({0,1,3,3}),
+                                     ConvParams(1, 0, 1, ConvParams::Im2col));
+    EXPECT_EQ(0u, empty.size());
+}
+
+void intoTest()
+{
+    Tensor<int> a({2, 2},
+                  {1,2,
+                   3,4});
+    Tensor<int> c({3, 2},
+                  {2,3,
+                   4,5,
+                   6,7});
+
+    Tensor<int> r({3,2}, {1,1, 1,1, 1,1});
+    TensorUtils<int>::dot_into(r, c, a, 2);
+    EXPECT_EQ(Tensor<int>({3,2},{13,18,21,30,29,42}), r);
+
+    TensorUtils<int>::dot_into(r, c, a);
+    EXPECT_EQ(Tensor<int>({3,2},{11,16,19,28,27,40}), r);
+
+    Tensor<int> wrong({2,2});
+    EXPECT_THROW(TensorUtils<int>::dot_into(wrong, c, a), "Tensor shapes mismatch for dot_into dst: 2x2x expect: 3x2x");
+    EXPECT_THROW(TensorUtils<int>::dot_into(a, a, a), "Tensor destination aliases input for dot_into");
+    EXPECT_THROW(TensorUtils<int>::transpose_into(c, c), "Tensor shapes mismatch for permute_into dst: 3x2x expect: 2x3x");
+
+    Tensor<int> ct({2,3});
+    TensorUtils<int>::transpose_into(ct, c);
+    EXPECT_EQ(transpose(c), ct);
+    TensorUtils<int>::transpose_into(ct, c, -1);
+    EXPECT_EQ(Tensor<int>({2,3},{0,0,0,0,0,0}), ct);
+
+    // elementwise ops may write straight over an input
+    TensorUtils<int>::bifunctor_into(a, &TensorUtils<int>::Helpers::add, a, a, 1);
+    EXPECT_EQ(Tensor<int>({2,2},{3,6,9,12}), a);
+
+    Tensor<int> row({3,1});
+    TensorUtils<int>::selrow_into(row, 1, c);
+    EXPECT_EQ(Tensor<int>({3,1},{3,5,7}), row);
+    EXPECT_THROW(TensorUtils<int>::selrow_into(row, 2, c), "Tensor index out of range for selrow_into a: 3x2x index: 2");
+
+    Tensor<int> col({1,2});
+    TensorUtils<int>::selcol_into(col, 2, c, 1);
+    EXPECT_EQ(Tensor<int>({1,2},{6,7}), col);
+
+    // a fixed shape training step.. once warmed up it must not allocate
+    Tensor<float> x({4,16});
+    Tensor<float> w({16,8});
+    Tensor<float> bias({4,1});
+    Tensor<float> h({4,8});
+    Tensor<float> hb({4,8});
+    Tensor<float> ht({8,4});
+    rand(x);
+    rand(w);
+    rand(bias);
+
+    std::size_t before = 0;
+    for (int step = 0; step < 3; ++step)
+    {
+        if (step == 2) before = allocations;
+
+        TensorUtils<float>::dot_into(h, x, w);
+        TensorUtils<float>::bifunctor_row_into(hb, &TensorUtils<float>::Helpers::add, h, bias);
+        TensorUtils<float>::unifunctor_into(hb, &TensorUtils<float>::Helpers::tanh, hb);
+        TensorUtils<float>::transpose_into(ht, hb);
+        TensorUtils<float>::bifunctor_scaler_into(hb, &TensorUtils<float>::Helpers::mul, 0.5f, hb, 0.5f);
+    }
+    EXPECT_EQ(before, allocations);
+}
+
+void adoptTest()
+{
+    int raw[6] = {1,2,3,4,5,6};
+    EXPECT_THROW(Tensor<int>({2,2}, raw, raw+6), "Tensor shape wrong for supplied data (end-begin): 6 shape: 2x2x hence size:4");
+
+    // custom deleter runs once the last tensor sharing the buffer goes
+    static int freed = 0;
+    int* decoded = static_cast<int*>(std::malloc(6 * sizeof(int)));
+    std::copy(raw, raw+6, decoded);
+    {
+        Tensor<int> m({2,3}, decoded, std::shared_ptr<void>(decoded, [](void* p) { ++freed; std::free(p); }));
+        EXPECT_EQ(true, (TensorUtils<int>::data(m).data() == decoded));
+
+        Tensor<int> mt = transpose(m);
+        EXPECT_EQ(Tensor<int>({2,2}, {14,32,32,77}), TensorUtils<int>::dot(m, mt));
+
+        Tensor<int> alias = m;
+        TensorUtils<int>::unifunctor_inplace([](int v) { return v*2; }, alias);
+        EXPECT_EQ(12, decoded[5]);
+        EXPECT_EQ(0, freed);
+    }
+    EXPECT_EQ(1, freed);
+
+    // borrowed view.. the caller keeps the memory alive
+    Tensor<int> view({3,2}, raw, std::shared_ptr<void>());
+    EXPECT_EQ(Tensor<int>({3,2},{1,2,3,4,5,6}), view);
+    EXPECT_THROW(TensorUtils<int>::data(view).resize(7), "Tensor cant resize adopted data size: 6 requested: 7");
+
+    // a vector handed over without a copy
+    std::shared_ptr<std::vector<int> > vec(new std::vector<int>(raw, raw+6));
+    Tensor<int> fromVec({6}, vec);
+    EXPECT_EQ(true, (TensorUtils<int>::data(fromVec).data() == vec->data()));
+    EXPECT_THROW(Tensor<int>({5}, vec), "Tensor shape wrong for supplied data size: 6 shape: 5x hence size:5");
+}
+
+void taskGraphTest()
+{
+    // a diamond per lane.. every task has to see its dependencies finished
+    const std::size_t lanes = 64;
+    std::vector<std::atomic<int> > stage(lanes);
+    std::atomic<int> wrong(0);
+
+    TaskGraph graph;
+    for (std::size_t l = 0; l < lanes; ++l)
+    {
+        stage[l] = 0;
+        std::size_t top   = graph.add([&stage, l]() { stage[l] = 1; });
+        std::size_t left  = graph.add([&stage, &wrong, l]() { if (stage[l] < 1) ++wrong; });
+        std::size_t right = graph.add([&stage, &wrong, l]() { if (stage[l] < 1) ++wrong; });
+        std::size_t join  = graph.add([&stage, l]() { stage[l] = 2; });
+        graph.depends(left,  top);
+        graph.depends(right, top);
+        graph.depends(join,  left);
+        graph.depends(join,  right);
+    }
+    EXPECT_EQ(4*lanes, graph.size());
+
+    graph.run(4);
+    EXPECT_EQ(0, wrong.load());
+    for (std::size_t l = 0; l < lanes; ++l)
+        EXPECT_EQ(2, stage[l].load());
+
+    // the pool keeps its workers.. another run starts no threads
+    std::size_t workers = WorkerPool::instance().size();
+    EXPECT_EQ(true, (workers >= 3));
+    graph.run(4);
+    EXPECT_EQ(workers, WorkerPool::instance().size());
+    EXPECT_EQ(0, wrong.load());
+
+    // a run from inside a task finds the pool busy and brings its own
+    std::atomic<int> inner(0);
+    TaskGraph outer;
+    outer.add([&inner]()
+    {
+        TaskGraph nested;
+        for (int t = 0; t < 8; ++t) nested.add([&inner]() { ++inner; });
+        nested.run(2);
+    });
+    outer.run(2);
+    EXPECT_EQ(8, inner.load());
+
+    // again single threaded and with the first error passed out
+    graph.run(1);
+    EXPECT_EQ(0, wrong.load());
+
+    TaskGraph failing;
+    failing.add([]() { throw std::runtime_error("Task failed"); });
+    failing.add([]() {});
+    EXPECT_THROW(failing.run(2), "Task failed");
+}
+
 int main()
 {
     try
     {
         basicTest();
+        transposeTest();
+        integerDotTest();
+        convTest();
+        intoTest();
+        adoptTest();
+        taskGraphTest();
     }
     catch (std::exception& e)
     {
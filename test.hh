@@ -55,6 +55,7 @@ struct StreamedCheck
     StreamedCheck& operator<<(const T& t)
     {
         ss_ << t;
+        return *this;
     }
 };
 
@@ -0,0 +1,54 @@
+#include "SummerGraph.hh"
+
+#include <sstream>
+#include <string>
+
+// graphs and passes the Summer*.test.cc files share
+
+Handle rewrite(Handle l)
+{
+    TransformAll<LiftSum> lift;
+    l = lift.process(l);
+    TransformAll<RotateDotsMultsToRight> allDotsRotate;
+    l = allDotsRotate.process(l);
+    TransformAll<AttachDotsToUnitVectors> moveDotsToVectors;
+    l = moveDotsToVectors.process(l);
+    TransformAll<LiftUnitVectorUp> liftUnitVecUp;
+    l = liftUnitVecUp.process(l);
+    return l;
+}
+
+Handle reduce(Handle l)
+{
+    TransformAll<UnitVecDotToDelta> dotsToDeltas;
+    l = dotsToDeltas.process(l);
+    TransformAll<ReduceDelta> reduceDeltas;
+    l = reduceDeltas.process(l);
+    return l;
+}
+
+// the whole pipeline.. rewrite then reduce
+Handle optimise(Handle l)
+{
+    return reduce(rewrite(l));
+}
+
+Handle xm()
+{
+    return Make::dot(Make::tensor("x", {"k"}),
+                     Make::tensor("m", {"i","j"}));
+}
+
+Handle chain()
+{
+    return Make::dot(Make::dot(Make::tensor("A", {"i","j"}),
+                               Make::tensor("B", {"k","l"})),
+                     Make::tensor("C", {"m","n"}));
+}
+
+std::string rendered(const Handle& node)
+{
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}